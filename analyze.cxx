@@ -0,0 +1,603 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+//
+// This program analyzes the console output recorded from igtlrepeater, e.g.
+//
+//   $ igtlrepeater 192.168.0.4 18944 18944 > case.log
+//   $ igtlanalyze case.log
+//
+// Each record line starts with the direction, the system time stamp, the
+// message time stamp, the device name, and the device type:
+//
+//   C->S, 1690476966.486063000, 0.000000000, LinearTransform, TRANSFORM, ...
+//
+// The direction may carry a label, e.g. "18945:C->S" with several mappings,
+// "C->S/1" for a relay stage, or "S1->C" for an additional server; it is
+// kept as part of the series. Streamed messages whose CRC turned out to be
+// wrong after they were forwarded are tagged "CRC error after forwarding"
+// and counted per series.
+//
+// The file is split into chunks parsed in parallel; the samples of each
+// (direction, device name, device type) series are then concatenated in
+// file order and the statistics of the series are computed in parallel.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "igtlMultiThreader.h"
+
+typedef long long Nanosec;
+
+typedef struct {
+  Nanosec sys;   // System time stamp
+  Nanosec msg;   // Message time stamp (0 if not set by the sender)
+} Sample;
+
+typedef std::vector<Sample> Series;
+typedef std::map<std::string, Series> SeriesMap;
+typedef std::map<std::string, long> CountMap;
+
+// Tag of a streamed message forwarded with a CRC error
+static const char CRC_ERROR_TAG[] = "CRC error after forwarding";
+
+typedef struct {
+  std::string key;
+  long        count;
+  double      duration;      // s
+  double      rate;          // Hz
+  double      meanInterval;  // ms
+  double      jitter;        // ms; standard deviation of the intervals
+  double      medianInterval;// ms
+  double      maxGap;        // ms
+  long        gaps;          // # of intervals longer than gapFactor x median
+  long        skewCount;     // # of samples with a message time stamp
+  double      skewMean;      // ms; system - message time stamp
+  double      skewMin;       // ms
+  double      skewMax;       // ms
+  double      transitJitter; // ms; RFC 3550 inter-arrival jitter
+  double      drift;         // ppm; slope of the skew over time
+} SeriesStatistics;
+
+typedef struct {
+  std::string                fileName;
+  long long                  fileSize;
+  int                        nChunks;
+  std::vector<SeriesMap>     chunkSeries;   // One per chunk
+  std::vector<CountMap>      chunkCRCErrors;
+  std::vector<long>          chunkLines;
+  std::vector<std::string>   keys;          // After merging
+  std::vector<Series*>       merged;
+  std::vector<SeriesStatistics> stats;
+  double                     gapFactor;
+} AnalyzerData;
+
+
+//-----------------------------------------------------------------------------
+// Parses "<sec>.<fraction>" into nanoseconds. Returns 0 on error.
+static int ParseTime(const char * s, const char * end, Nanosec * t)
+{
+  Nanosec sec = 0;
+  Nanosec nsec = 0;
+  const char * p = s;
+  while (p < end && *p == ' ')
+    {
+    p ++;
+    }
+  if (p == end || *p < '0' || *p > '9')
+    {
+    return 0;
+    }
+  while (p < end && *p >= '0' && *p <= '9')
+    {
+    sec = sec * 10 + (*p - '0');
+    p ++;
+    }
+  if (p < end && *p == '.')
+    {
+    p ++;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+      {
+      if (digits < 9)
+        {
+        nsec = nsec * 10 + (*p - '0');
+        digits ++;
+        }
+      p ++;
+      }
+    for (; digits < 9; digits ++)
+      {
+      nsec *= 10;
+      }
+    }
+  *t = sec * 1000000000LL + nsec;
+  return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Parses one line and adds the sample to 'series'. Returns 1 if the line is a record.
+static int ParseLine(const char * line, const char * end, SeriesMap & series, CountMap & crcErrors)
+{
+  // Fields: direction, sys, msg, name, type
+  const char * field[5];
+  const char * fieldEnd[5];
+  const char * p = line;
+
+  // The direction is a single token with an arrow, such as "C->S",
+  // "18945:C->S", "C->S/1", or "S1->C".
+  bool arrow = false;
+  while (p < end && !(p[0] == ',' && p + 1 < end && p[1] == ' '))
+    {
+    if (*p == ' ' || *p == '\t')
+      {
+      return 0;
+      }
+    if (p[0] == '-' && p + 1 < end && p[1] == '>')
+      {
+      arrow = true;
+      }
+    p ++;
+    }
+  if (p == line || p >= end || !arrow)
+    {
+    return 0;
+    }
+
+  p = line;
+  for (int i = 0; i < 5; i ++)
+    {
+    field[i] = p;
+    while (p < end && !(p[0] == ',' && p + 1 < end && p[1] == ' '))
+      {
+      p ++;
+      }
+    fieldEnd[i] = p;
+    if (p >= end && i < 4)
+      {
+      return 0;
+      }
+    p += 2;
+    }
+
+  Sample sample;
+  if (!ParseTime(field[1], fieldEnd[1], &sample.sys) ||
+      !ParseTime(field[2], fieldEnd[2], &sample.msg))
+    {
+    return 0;
+    }
+
+  std::string key(field[0], fieldEnd[0]);
+  key.append(", ");
+  key.append(field[3], fieldEnd[3]);
+  key.append(", ");
+  key.append(field[4], fieldEnd[4]);
+  series[key].push_back(sample);
+
+  const char * tagEnd = CRC_ERROR_TAG + sizeof(CRC_ERROR_TAG) - 1;
+  if (p < end && std::search(p, end, CRC_ERROR_TAG, tagEnd) != end)
+    {
+    crcErrors[key] ++;
+    }
+  return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Parses chunk #ThreadID of the file. A chunk owns the lines that start
+// within its byte range.
+static void ParseThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  AnalyzerData * data = static_cast<AnalyzerData *>(info->UserData);
+
+  int chunk = info->ThreadID;
+  long long begin = data->fileSize * chunk / data->nChunks;
+  long long end   = data->fileSize * (chunk + 1) / data->nChunks;
+
+  FILE * fp = fopen(data->fileName.c_str(), "rb");
+  if (!fp)
+    {
+    return;
+    }
+
+  const size_t bufSize = 1 << 20;
+  std::vector<char> buf(bufSize);
+  std::string line;
+  SeriesMap & series = data->chunkSeries[chunk];
+  CountMap & crcErrors = data->chunkCRCErrors[chunk];
+  long nLines = 0;
+
+  // Unless this is the first chunk, the line that contains 'begin - 1'
+  // belongs to the previous chunk.
+  long long pos = begin;
+  bool skipFirst = (begin > 0);
+  if (skipFirst)
+    {
+    pos = begin - 1;
+    }
+  fseek(fp, (long) pos, SEEK_SET);
+
+  long long lineStart = pos;
+  bool done = false;
+  while (!done)
+    {
+    size_t n = fread(&buf[0], 1, bufSize, fp);
+    if (n == 0)
+      {
+      if (!line.empty() && !skipFirst && lineStart < end)
+        {
+        nLines += ParseLine(line.data(), line.data() + line.size(), series, crcErrors);
+        }
+      break;
+      }
+    const char * p = &buf[0];
+    const char * bufEnd = p + n;
+    while (p < bufEnd)
+      {
+      const char * nl = (const char *) memchr(p, '\n', bufEnd - p);
+      if (!nl)
+        {
+        line.append(p, bufEnd);
+        pos += bufEnd - p;
+        break;
+        }
+      line.append(p, nl);
+      pos += nl - p + 1;
+      p = nl + 1;
+      if (skipFirst)
+        {
+        skipFirst = false;
+        }
+      else
+        {
+        nLines += ParseLine(line.data(), line.data() + line.size(), series, crcErrors);
+        }
+      line.clear();
+      lineStart = pos;
+      if (lineStart >= end)
+        {
+        done = true;
+        break;
+        }
+      }
+    }
+
+  data->chunkLines[chunk] = nLines;
+  fclose(fp);
+}
+
+
+//-----------------------------------------------------------------------------
+static void ComputeStatistics(const std::string & key, Series & s, double gapFactor, SeriesStatistics & st)
+{
+  st.key = key;
+  st.count = (long) s.size();
+  st.duration = 0.0;
+  st.rate = 0.0;
+  st.meanInterval = 0.0;
+  st.jitter = 0.0;
+  st.medianInterval = 0.0;
+  st.maxGap = 0.0;
+  st.gaps = 0;
+  st.skewCount = 0;
+  st.skewMean = 0.0;
+  st.skewMin = 0.0;
+  st.skewMax = 0.0;
+  st.transitJitter = 0.0;
+  st.drift = 0.0;
+
+  if (s.empty())
+    {
+    return;
+    }
+
+  st.duration = (double) (s.back().sys - s.front().sys) * 1.0e-9;
+  if (st.duration > 0.0)
+    {
+    st.rate = (double) (s.size() - 1) / st.duration;
+    }
+
+  // Inter-arrival intervals
+  if (s.size() > 1)
+    {
+    std::vector<double> intervals(s.size() - 1);
+    double sum = 0.0;
+    double sum2 = 0.0;
+    for (size_t i = 1; i < s.size(); i ++)
+      {
+      double d = (double) (s[i].sys - s[i-1].sys) * 1.0e-6;
+      intervals[i-1] = d;
+      sum  += d;
+      sum2 += d * d;
+      if (d > st.maxGap)
+        {
+        st.maxGap = d;
+        }
+      }
+    double n = (double) intervals.size();
+    st.meanInterval = sum / n;
+    st.jitter = sqrt(std::max(0.0, sum2 / n - st.meanInterval * st.meanInterval));
+
+    std::vector<double> sorted(intervals);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    st.medianInterval = sorted[sorted.size() / 2];
+    for (size_t i = 0; i < intervals.size(); i ++)
+      {
+      if (intervals[i] > gapFactor * st.medianInterval)
+        {
+        st.gaps ++;
+        }
+      }
+    }
+
+  // Skew between the system and message time stamps. The drift is the
+  // least-squares slope of the skew against the system time.
+  double t0 = (double) s.front().sys * 1.0e-9;
+  double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+  const Sample * prev = NULL;
+  for (size_t i = 0; i < s.size(); i ++)
+    {
+    if (s[i].msg == 0)
+      {
+      continue;
+      }
+    double skew = (double) (s[i].sys - s[i].msg) * 1.0e-6;
+    double t = (double) s[i].sys * 1.0e-9 - t0;
+    if (st.skewCount == 0 || skew < st.skewMin)
+      {
+      st.skewMin = skew;
+      }
+    if (st.skewCount == 0 || skew > st.skewMax)
+      {
+      st.skewMax = skew;
+      }
+    st.skewCount ++;
+    sx += t; sy += skew; sxx += t * t; sxy += t * skew;
+    if (prev)
+      {
+      double d = fabs((double) ((s[i].sys - prev->sys) - (s[i].msg - prev->msg)) * 1.0e-6);
+      st.transitJitter += (d - st.transitJitter) / 16.0;
+      }
+    prev = &s[i];
+    }
+  if (st.skewCount > 0)
+    {
+    double n = (double) st.skewCount;
+    st.skewMean = sy / n;
+    double den = n * sxx - sx * sx;
+    if (st.skewCount > 1 && den > 0.0)
+      {
+      // ms/s -> ppm
+      st.drift = (n * sxy - sx * sy) / den * 1.0e3;
+      }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+static void StatisticsThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  AnalyzerData * data = static_cast<AnalyzerData *>(info->UserData);
+
+  for (size_t i = info->ThreadID; i < data->keys.size(); i += info->NumberOfThreads)
+    {
+    ComputeStatistics(data->keys[i], *(data->merged[i]), data->gapFactor, data->stats[i]);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+static void WriteTimeSeries(const std::string & prefix, const std::string & key, const Series & s)
+{
+  std::string name = prefix;
+  for (size_t i = 0; i < key.size(); i ++)
+    {
+    char c = key[i];
+    if (c == '>' || c == ' ')
+      {
+      continue;
+      }
+    name += (isalnum((unsigned char) c) || c == '-' || c == '.') ? c : '_';
+    }
+  name += ".csv";
+
+  std::ofstream os(name.c_str());
+  if (!os.is_open())
+    {
+    std::cerr << "ERROR: cannot write " << name << std::endl;
+    return;
+    }
+
+  os << "SystemTime, MessageTime, Interval(ms), Skew(ms)" << std::endl;
+  os << std::fixed;
+  for (size_t i = 0; i < s.size(); i ++)
+    {
+    double interval = (i > 0) ? (double) (s[i].sys - s[i-1].sys) * 1.0e-6 : 0.0;
+    os << std::setprecision(9) << (double) s[i].sys * 1.0e-9 << ", "
+       << (double) s[i].msg * 1.0e-9 << ", "
+       << std::setprecision(3) << interval << ", ";
+    if (s[i].msg != 0)
+      {
+      os << (double) (s[i].sys - s[i].msg) * 1.0e-6;
+      }
+    os << std::endl;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  //------------------------------------------------------------
+  // Parse Arguments
+  //
+  AnalyzerData data;
+  data.gapFactor = 3.0;
+  int nThreads = 0;
+  std::string prefix;
+  std::vector< std::string > args;
+
+  for (int i = 1; i < argc; i ++)
+    {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      {
+      nThreads = atoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+      {
+      data.gapFactor = atof(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      {
+      prefix = argv[i+1];
+      i ++;
+      }
+    else
+      {
+      args.push_back(argv[i]);
+      }
+    }
+
+  if (args.size() != 1)
+    {
+    std::cerr << " Usage: " << argv[0] << " [-j <threads>] [-g <factor>] [-o <prefix>] <file>" << std::endl;
+    std::cerr << "    -j <threads> : Number of threads (default: number of cores)."              << std::endl;
+    std::cerr << "    -g <factor>  : Intervals longer than <factor> x median are gaps (default: 3)." << std::endl;
+    std::cerr << "    -o <prefix>  : Write the time series of each device to <prefix><key>.csv." << std::endl;
+    std::cerr << "    <file>       : Console output recorded from igtlrepeater."                << std::endl;
+    exit(0);
+    }
+
+  data.fileName = args[0];
+  std::ifstream probe(data.fileName.c_str(), std::ios::binary | std::ios::ate);
+  if (!probe.is_open())
+    {
+    std::cerr << "Cannot open " << data.fileName << std::endl;
+    exit(0);
+    }
+  data.fileSize = (long long) probe.tellg();
+  probe.close();
+
+  igtl::MultiThreader::Pointer threader = igtl::MultiThreader::New();
+  if (nThreads > 0)
+    {
+    threader->SetNumberOfThreads(nThreads);
+    }
+  data.nChunks = threader->GetNumberOfThreads();
+
+  //------------------------------------------------------------
+  // Parse the chunks in parallel
+  data.chunkSeries.resize(data.nChunks);
+  data.chunkCRCErrors.resize(data.nChunks);
+  data.chunkLines.resize(data.nChunks, 0);
+  threader->SetSingleMethod((igtl::ThreadFunctionType) &ParseThreadFunction, &data);
+  threader->SingleMethodExecute();
+
+  //------------------------------------------------------------
+  // Merge the chunks in file order into the series of the first chunk
+  long nRecords = 0;
+  long nCRCErrors = 0;
+  SeriesMap all;
+  CountMap crcErrors;
+  for (int c = 0; c < data.nChunks; c ++)
+    {
+    nRecords += data.chunkLines[c];
+    CountMap::iterator ce;
+    for (ce = data.chunkCRCErrors[c].begin(); ce != data.chunkCRCErrors[c].end(); ce ++)
+      {
+      crcErrors[ce->first] += ce->second;
+      nCRCErrors += ce->second;
+      }
+    SeriesMap::iterator it;
+    for (it = data.chunkSeries[c].begin(); it != data.chunkSeries[c].end(); it ++)
+      {
+      Series & dst = all[it->first];
+      if (dst.empty())
+        {
+        dst.swap(it->second);
+        }
+      else
+        {
+        dst.insert(dst.end(), it->second.begin(), it->second.end());
+        Series().swap(it->second);
+        }
+      }
+    }
+
+  SeriesMap::iterator it;
+  for (it = all.begin(); it != all.end(); it ++)
+    {
+    data.keys.push_back(it->first);
+    data.merged.push_back(&(it->second));
+    }
+  data.stats.resize(data.keys.size());
+
+  //------------------------------------------------------------
+  // Compute the statistics in parallel
+  threader->SetSingleMethod((igtl::ThreadFunctionType) &StatisticsThreadFunction, &data);
+  threader->SingleMethodExecute();
+
+  //------------------------------------------------------------
+  // Summary table
+  std::cout << nRecords << " records, " << data.keys.size() << " series, "
+            << data.nChunks << " threads" << std::endl;
+  std::cout << "Streamed messages forwarded with a CRC error: " << nCRCErrors << std::endl << std::endl;
+  std::cout << "Direction, Name, Type, Count, Duration(s), Rate(Hz), MeanInterval(ms), Jitter(ms), "
+            << "MedianInterval(ms), MaxGap(ms), Gaps, SkewMean(ms), SkewMin(ms), SkewMax(ms), "
+            << "TransitJitter(ms), Drift(ppm), CRCErrors" << std::endl;
+  std::cout << std::fixed;
+  for (size_t i = 0; i < data.stats.size(); i ++)
+    {
+    SeriesStatistics & st = data.stats[i];
+    std::cout << st.key << ", " << st.count << ", "
+              << std::setprecision(3) << st.duration << ", " << st.rate << ", "
+              << st.meanInterval << ", " << st.jitter << ", " << st.medianInterval << ", "
+              << st.maxGap << ", " << st.gaps << ", ";
+    if (st.skewCount > 0)
+      {
+      std::cout << st.skewMean << ", " << st.skewMin << ", " << st.skewMax << ", "
+                << st.transitJitter << ", " << std::setprecision(1) << st.drift;
+      }
+    else
+      {
+      std::cout << "-, -, -, -, -";
+      }
+    std::cout << ", " << crcErrors[st.key] << std::endl;
+
+    if (!prefix.empty())
+      {
+      WriteTimeSeries(prefix, data.keys[i], *(data.merged[i]));
+      }
+    }
+
+  return 0;
+}
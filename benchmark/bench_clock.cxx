@@ -0,0 +1,96 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+//
+// Measures the cost of taking a time stamp with igtl::Clock and with the
+// igtl::TimeStamp objects that Session::Process() used before.
+//
+//   bench_clock [<iterations>]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "clock.h"
+
+#include "igtlTimeStamp.h"
+
+static void Report(const char * name, int iterations, igtlInt64 elapsed)
+{
+  std::cout << std::setw(28) << std::left << name
+            << std::setw(10) << std::right << std::fixed << std::setprecision(1)
+            << (double) elapsed / (double) iterations << " ns/call" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 10000000;
+
+  igtl::Clock::Initialize();
+  std::cout << "Clock source: " << igtl::Clock::GetSource() << std::endl;
+
+  // The sum keeps the calls from being optimized away.
+  igtlInt64 sum = 0;
+
+  // igtl::TimeStamp allocated per call, as in Session::Process()
+  igtlInt64 start = igtl::Clock::SystemNow();
+  for (int i = 0; i < iterations; i ++)
+    {
+    igtl::TimeStamp::Pointer ts = igtl::TimeStamp::New();
+    ts->GetTime();
+    sum += ts->GetNanosecond();
+    }
+  Report("TimeStamp::New + GetTime", iterations, igtl::Clock::SystemNow() - start);
+
+  // igtl::TimeStamp reused
+  igtl::TimeStamp::Pointer ts = igtl::TimeStamp::New();
+  start = igtl::Clock::SystemNow();
+  for (int i = 0; i < iterations; i ++)
+    {
+    ts->GetTime();
+    sum += ts->GetNanosecond();
+    }
+  Report("TimeStamp::GetTime", iterations, igtl::Clock::SystemNow() - start);
+
+  start = igtl::Clock::SystemNow();
+  for (int i = 0; i < iterations; i ++)
+    {
+    sum += igtl::Clock::SystemNow();
+    }
+  Report("Clock::SystemNow", iterations, igtl::Clock::SystemNow() - start);
+
+  start = igtl::Clock::SystemNow();
+  for (int i = 0; i < iterations; i ++)
+    {
+    sum += igtl::Clock::Now();
+    }
+  Report("Clock::Now", iterations, igtl::Clock::SystemNow() - start);
+
+  start = igtl::Clock::SystemNow();
+  for (int i = 0; i < iterations; i ++)
+    {
+    sum += igtl::Clock::Ticks();
+    }
+  Report("Clock::Ticks", iterations, igtl::Clock::SystemNow() - start);
+
+  // Difference from the system clock
+  igtlInt64 offset = igtl::Clock::Now() - igtl::Clock::SystemNow();
+  std::cout << "Offset from the system clock: " << offset << " ns" << (sum == 0 ? " " : "") << std::endl;
+
+  // Difference of Ticks() from the monotonic system clock
+  igtlInt64 drift = igtl::Clock::Ticks() - igtl::Clock::SystemTicks();
+  std::cout << "Offset of Ticks from CLOCK_MONOTONIC: " << drift << " ns" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+//
+// Measures the cost of the registration stage applied to packed TRANSFORM
+// and TDATA messages.
+//
+//   bench_registration [<iterations>]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sstream>
+
+#include "clock.h"
+#include "registration.h"
+
+#include "igtlTransformMessage.h"
+#include "igtlTrackingDataMessage.h"
+
+// s on the monotonic clock
+static double Now()
+{
+  return (double) igtl::Clock::Ticks() * 1.0e-9;
+}
+
+static void Report(const char * name, int iterations, double elapsed, igtlUint64 size)
+{
+  double ns = elapsed * 1.0e9 / (double) iterations;
+  std::cout << std::setw(16) << std::left << name
+            << std::setw(10) << std::right << std::fixed << std::setprecision(1) << ns << " ns/message, "
+            << std::setw(8) << std::setprecision(3) << (double) size / ns << " bytes/ns" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  igtl::Matrix4x4 reg;
+  igtl::IdentityMatrix(reg);
+  reg[0][0] = 0.0;  reg[0][1] = -1.0; reg[0][3] = 10.0;
+  reg[1][0] = 1.0;  reg[1][1] = 0.0;  reg[1][3] = -5.0;
+
+  igtl::Matrix4x4 pose;
+  igtl::IdentityMatrix(pose);
+  pose[0][3] = 1.0; pose[1][3] = 2.0; pose[2][3] = 3.0;
+
+  // TRANSFORM
+  igtl::TransformMessage::Pointer transMsg = igtl::TransformMessage::New();
+  transMsg->SetDeviceName("Tracker");
+  transMsg->SetMatrix(pose);
+  transMsg->Pack();
+
+  double start = Now();
+  for (int i = 0; i < iterations; i ++)
+    {
+    igtl::ApplyRegistrationToTransform(reg, (unsigned char *) transMsg->GetPackPointer());
+    }
+  Report("TRANSFORM", iterations, Now() - start, transMsg->GetPackSize());
+
+  // TDATA with 1, 4, and 16 elements
+  int nElements[] = {1, 4, 16};
+  for (int k = 0; k < 3; k ++)
+    {
+    igtl::TrackingDataMessage::Pointer tdataMsg = igtl::TrackingDataMessage::New();
+    tdataMsg->SetDeviceName("Tracker");
+    for (int j = 0; j < nElements[k]; j ++)
+      {
+      std::stringstream name;
+      name << "Tool_" << j;
+      igtl::TrackingDataElement::Pointer element = igtl::TrackingDataElement::New();
+      element->SetName(name.str().c_str());
+      element->SetType(igtl::TrackingDataElement::TYPE_6D);
+      element->SetMatrix(pose);
+      tdataMsg->AddTrackingDataElement(element);
+      }
+    tdataMsg->Pack();
+
+    start = Now();
+    for (int i = 0; i < iterations; i ++)
+      {
+      igtl::ApplyRegistrationToTrackingData(reg, (unsigned char *) tdataMsg->GetPackPointer());
+      }
+    std::stringstream label;
+    label << "TDATA x" << nElements[k];
+    Report(label.str().c_str(), iterations, Now() - start, tdataMsg->GetPackSize());
+    }
+
+  return 0;
+}
@@ -0,0 +1,329 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+//
+// Measures the cost of Session::Process() (receive, CRC check, decode, log
+// formatting, pack, and forward) for each message type. The session reads
+// a pre-generated message from memory over and over and writes to a sink,
+// so no system call is involved. The log is formatted but discarded. The
+// CRC column is the cost of the CRC of the body alone.
+//
+// With <decoders> > 0, messages are forwarded as received and decoded by a
+// DecoderPool of that many threads; the time is then that of the
+// forwarding thread alone.
+//
+//   bench_session [<iterations> [<decoders>]]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <streambuf>
+
+#include "clock.h"
+#include "session.h"
+#include "transport.h"
+
+#include "igtlTransformMessage.h"
+#include "igtlPositionMessage.h"
+#include "igtlImageMessage.h"
+#include "igtlStatusMessage.h"
+#include "igtlStringMessage.h"
+#include "igtlPointMessage.h"
+#include "igtlCapabilityMessage.h"
+#include "igtlTrackingDataMessage.h"
+#include "igtl_header.h"
+#include "igtl_util.h"
+
+namespace igtl
+{
+
+// Transport that receives the same packed message over and over and
+// discards what is sent.
+class MemoryTransport : public Transport
+{
+public:
+
+  igtlTypeMacro(igtl::MemoryTransport, igtl::Transport)
+  igtlNewMacro(igtl::MemoryTransport);
+
+  void SetMessage(igtl::MessageBase * msg)
+  {
+    const unsigned char * p = (const unsigned char *) msg->GetPackPointer();
+    this->Data.assign(p, p + msg->GetPackSize());
+    this->Position = 0;
+  };
+
+  igtlUint64 GetBytesSent() { return this->BytesSent; };
+
+  virtual int Send(const void * data, igtlUint64 length)
+  {
+    (void) data;
+    this->BytesSent += length;
+    return 1;
+  };
+
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1)
+  {
+    (void) timeout;
+    (void) readFully;
+    unsigned char * p = (unsigned char *) data;
+    igtlUint64 remain = length;
+    while (remain > 0)
+      {
+      igtlUint64 n = this->Data.size() - this->Position;
+      if (n > remain)
+        {
+        n = remain;
+        }
+      memcpy(p, &(this->Data[this->Position]), n);
+      p += n;
+      remain -= n;
+      this->Position = (this->Position + n) % this->Data.size();
+      }
+    return length;
+  };
+
+  virtual void Close() {};
+
+protected:
+
+  MemoryTransport() : Position(0), BytesSent(0) {};
+  ~MemoryTransport() {};
+
+  std::vector<unsigned char> Data;
+  igtlUint64 Position;
+  igtlUint64 BytesSent;
+};
+
+}
+
+// Discards the log
+class NullBuffer : public std::streambuf
+{
+protected:
+  virtual int overflow(int c) { return c; }
+  virtual std::streamsize xsputn(const char *, std::streamsize n) { return n; }
+};
+
+// s on the monotonic clock
+static double Now()
+{
+  return (double) igtl::Clock::Ticks() * 1.0e-9;
+}
+
+static void Report(const char * name, int iterations, double elapsed, double crcElapsed, igtlUint64 size)
+{
+  double ns    = elapsed * 1.0e9 / (double) iterations;
+  double crcNs = crcElapsed * 1.0e9 / (double) iterations;
+  std::cout << std::setw(16) << std::left << name
+            << std::setw(8) << std::right << size << " bytes, "
+            << std::setw(10) << std::fixed << std::setprecision(1) << ns << " ns/message, "
+            << std::setw(8) << std::setprecision(3) << (double) size / ns << " bytes/ns, "
+            << "CRC " << std::setw(8) << std::setprecision(1) << crcNs << " ns" << std::endl;
+}
+
+static void Run(const char * name, igtl::MessageBase * msg, int iterations,
+                igtl::Logger * logger, igtl::RuleManager * rules, int decoders)
+{
+  igtl::MemoryTransport::Pointer from = igtl::MemoryTransport::New();
+  igtl::MemoryTransport::Pointer to   = igtl::MemoryTransport::New();
+  from->SetMessage(msg);
+
+  igtl::MutexLock::Pointer fromLock = igtl::MutexLock::New();
+  igtl::MutexLock::Pointer toLock   = igtl::MutexLock::New();
+
+  igtl::Session::Pointer session = igtl::Session::New();
+  session->SetSockets(from, to);
+  session->SetMutexLocks(fromLock, toLock);
+  session->SetLogger(logger);
+  session->SetRuleManager(rules);
+  session->SetName("BENCH");
+
+  igtl::DecoderPool::Pointer pool;
+  if (decoders > 0)
+    {
+    pool = igtl::DecoderPool::New();
+    pool->SetLogger(logger);
+    pool->Start(decoders);
+    session->SetDecoderPool(pool);
+    }
+  if (!session->Initialize())
+    {
+    return;
+    }
+
+  NullBuffer null;
+  std::streambuf * cout = std::cout.rdbuf(&null);
+
+  int warmup = iterations / 100 + 1;
+  for (int i = 0; i < warmup; i ++)
+    {
+    session->ProcessNext();
+    }
+
+  double start = Now();
+  for (int i = 0; i < iterations; i ++)
+    {
+    session->ProcessNext();
+    }
+  double elapsed = Now() - start;
+
+  // The output of the decoders is discarded as well.
+  if (pool.IsNotNull())
+    {
+    pool->Stop();
+    }
+  std::cout.rdbuf(cout);
+  session->FinishProcessing();
+
+  if (to->GetBytesSent() != (igtlUint64) (iterations + warmup) * msg->GetPackSize())
+    {
+    std::cerr << name << ": not all messages were forwarded." << std::endl;
+    }
+
+  unsigned char * body = (unsigned char *) msg->GetPackPointer() + IGTL_HEADER_SIZE;
+  igtlUint64 bodySize = msg->GetPackSize() - IGTL_HEADER_SIZE;
+  igtlUint64 crc = 0;
+  start = Now();
+  for (int i = 0; i < iterations; i ++)
+    {
+    crc ^= crc64(body, bodySize, 0LL);
+    }
+  double crcElapsed = Now() - start;
+  if (crc == 1)
+    {
+    std::cerr << std::endl; // Keeps the loop
+    }
+
+  Report(name, iterations, elapsed, crcElapsed, msg->GetPackSize());
+}
+
+int main(int argc, char* argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+  int decoders   = (argc > 2) ? atoi(argv[2]) : 0;
+
+  igtl::Logger::Pointer logger = igtl::Logger::New();
+  igtl::RuleManager::Pointer rules = igtl::RuleManager::New();
+  rules->Load();
+
+  igtl::Matrix4x4 pose;
+  igtl::IdentityMatrix(pose);
+  pose[0][3] = 1.0; pose[1][3] = 2.0; pose[2][3] = 3.0;
+
+  // TRANSFORM
+  igtl::TransformMessage::Pointer transMsg = igtl::TransformMessage::New();
+  transMsg->SetDeviceName("Tracker");
+  transMsg->SetMatrix(pose);
+  transMsg->Pack();
+  Run("TRANSFORM", transMsg, iterations, logger, rules, decoders);
+
+  // POSITION
+  float position[3]   = {1.0, 2.0, 3.0};
+  float quaternion[4] = {0.0, 0.0, 0.0, 1.0};
+  igtl::PositionMessage::Pointer positionMsg = igtl::PositionMessage::New();
+  positionMsg->SetDeviceName("Tracker");
+  positionMsg->SetPosition(position);
+  positionMsg->SetQuaternion(quaternion);
+  positionMsg->Pack();
+  Run("POSITION", positionMsg, iterations, logger, rules, decoders);
+
+  // STATUS
+  igtl::StatusMessage::Pointer statusMsg = igtl::StatusMessage::New();
+  statusMsg->SetDeviceName("Device");
+  statusMsg->SetCode(igtl::StatusMessage::STATUS_OK);
+  statusMsg->SetSubCode(0);
+  statusMsg->SetErrorName("OK");
+  statusMsg->SetStatusString("Running");
+  statusMsg->Pack();
+  Run("STATUS", statusMsg, iterations, logger, rules, decoders);
+
+  // STRING
+  igtl::StringMessage::Pointer stringMsg = igtl::StringMessage::New();
+  stringMsg->SetDeviceName("Device");
+  stringMsg->SetString("<Command Name=\"Start\" />");
+  stringMsg->Pack();
+  Run("STRING", stringMsg, iterations, logger, rules, decoders);
+
+  // POINT with 4 points
+  igtl::PointMessage::Pointer pointMsg = igtl::PointMessage::New();
+  pointMsg->SetDeviceName("Points");
+  for (int j = 0; j < 4; j ++)
+    {
+    igtl::PointElement::Pointer point = igtl::PointElement::New();
+    point->SetName("Point");
+    point->SetGroupName("Group");
+    point->SetRGBA(255, 0, 0, 255);
+    point->SetPosition(10.0 * j, 20.0, 30.0);
+    point->SetRadius(5.0);
+    point->SetOwner("Image");
+    pointMsg->AddPointElement(point);
+    }
+  pointMsg->Pack();
+  Run("POINT x4", pointMsg, iterations, logger, rules, decoders);
+
+  // CAPABILITY
+  igtl::CapabilityMessage::Pointer capabilMsg = igtl::CapabilityMessage::New();
+  capabilMsg->SetDeviceName("Device");
+  const char * types[] = {"TRANSFORM", "IMAGE", "STATUS", "STRING", "TDATA", "GET_TRANSFORM"};
+  capabilMsg->SetNumberOfTypes(6);
+  for (int j = 0; j < 6; j ++)
+    {
+    capabilMsg->SetType(j, types[j]);
+    }
+  capabilMsg->Pack();
+  Run("CAPABILITY", capabilMsg, iterations, logger, rules, decoders);
+
+  // TDATA with 1, 4, and 16 elements
+  int nElements[] = {1, 4, 16};
+  for (int k = 0; k < 3; k ++)
+    {
+    igtl::TrackingDataMessage::Pointer tdataMsg = igtl::TrackingDataMessage::New();
+    tdataMsg->SetDeviceName("Tracker");
+    for (int j = 0; j < nElements[k]; j ++)
+      {
+      std::stringstream name;
+      name << "Tool_" << j;
+      igtl::TrackingDataElement::Pointer element = igtl::TrackingDataElement::New();
+      element->SetName(name.str().c_str());
+      element->SetType(igtl::TrackingDataElement::TYPE_6D);
+      element->SetMatrix(pose);
+      tdataMsg->AddTrackingDataElement(element);
+      }
+    tdataMsg->Pack();
+
+    std::stringstream label;
+    label << "TDATA x" << nElements[k];
+    Run(label.str().c_str(), tdataMsg, iterations, logger, rules, decoders);
+    }
+
+  // IMAGE, 256 x 256 x 1, 8 bit
+  int size[3] = {256, 256, 1};
+  float spacing[3] = {0.5, 0.5, 1.0};
+  igtl::ImageMessage::Pointer imgMsg = igtl::ImageMessage::New();
+  imgMsg->SetDeviceName("Ultrasound");
+  imgMsg->SetDimensions(size);
+  imgMsg->SetSpacing(spacing);
+  imgMsg->SetScalarType(igtl::ImageMessage::TYPE_UINT8);
+  imgMsg->SetMatrix(pose);
+  imgMsg->AllocateScalars();
+  memset(imgMsg->GetScalarPointer(), 0x5a, imgMsg->GetImageSize());
+  imgMsg->Pack();
+  Run("IMAGE 256x256", imgMsg, iterations / 10 + 1, logger, rules, decoders);
+
+  return 0;
+}
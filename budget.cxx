@@ -0,0 +1,106 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "budget.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+MemoryBudget::MemoryBudget()
+{
+  this->Parent = NULL;
+  this->Limit  = 0;
+  this->Callback     = NULL;
+  this->CallbackData = NULL;
+  this->Usage  = 0;
+  this->Peak   = 0;
+}
+
+//-----------------------------------------------------------------------------
+MemoryBudget::~MemoryBudget()
+{
+}
+
+//-----------------------------------------------------------------------------
+void MemoryBudget::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int MemoryBudget::Fits(igtlUint64 size)
+{
+  if (this->Limit > 0 && size > this->Limit)
+    {
+    return 0;
+    }
+  return this->Parent.IsNull() || this->Parent->Fits(size);
+}
+
+//-----------------------------------------------------------------------------
+int MemoryBudget::TryCharge(igtlUint64 size)
+{
+  igtlUint64 usage = this->Usage.load();
+  do
+    {
+    if (this->Limit > 0 && usage + size > this->Limit)
+      {
+      return 0;
+      }
+    }
+  while (!this->Usage.compare_exchange_weak(usage, usage + size));
+
+  if (this->Parent.IsNotNull() && !this->Parent->TryCharge(size))
+    {
+    this->Usage -= size;
+    return 0;
+    }
+  this->UpdatePeak(usage + size);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void MemoryBudget::Charge(igtlUint64 size)
+{
+  this->UpdatePeak(this->Usage += size);
+  if (this->Parent.IsNotNull())
+    {
+    this->Parent->Charge(size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MemoryBudget::Release(igtlUint64 size)
+{
+  this->Usage -= size;
+  if (this->Parent.IsNotNull())
+    {
+    this->Parent->Release(size);
+    }
+  if (this->Callback)
+    {
+    this->Callback(this->CallbackData);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void MemoryBudget::UpdatePeak(igtlUint64 usage)
+{
+  igtlUint64 peak = this->Peak.load();
+  while (usage > peak && !this->Peak.compare_exchange_weak(peak, usage))
+    {
+    }
+}
+
+}
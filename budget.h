@@ -0,0 +1,97 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <atomic>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+
+namespace igtl
+{
+
+// MemoryBudget accounts for the bytes of the messages held by the
+// repeater: being received by a session, waiting in a send queue, or
+// delayed by an impairment emulator. A budget of a connection charges its
+// parent, the budget of all connections, as well, so that either limit
+// stops a session from receiving more messages.
+class IGTLCommon_EXPORT MemoryBudget : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::MemoryBudget, igtl::Object)
+  igtlNewMacro(igtl::MemoryBudget);
+
+public:
+
+  virtual const char * GetClassName() { return "MemoryBudget"; };
+
+  void SetParent(igtl::MemoryBudget * parent) { this->Parent = parent; };
+  igtl::MemoryBudget * GetParent() { return this->Parent; };
+
+  // Maximum # of bytes (0: no limit)
+  void       SetLimit(igtlUint64 size) { this->Limit = size; };
+  igtlUint64 GetLimit() { return this->Limit; };
+
+  // Returns 1 if 'size' bytes can ever be charged, i.e. do not exceed the
+  // limit of this budget or its parent.
+  int  Fits(igtlUint64 size);
+
+  // Charges 'size' bytes if they fit in the unused part of this budget and
+  // its parent. Returns 0 without charging otherwise.
+  int  TryCharge(igtlUint64 size);
+
+  // Charges 'size' bytes that are already held, regardless of the limits.
+  void Charge(igtlUint64 size);
+
+  void Release(igtlUint64 size);
+
+  // 'callback' is called with 'data' after bytes of this budget or of a
+  // child are released, e.g. to resume the sessions waiting for memory.
+  typedef void (*ReleaseCallback)(void * data);
+  void SetReleaseCallback(ReleaseCallback callback, void * data)
+  {
+    this->Callback     = callback;
+    this->CallbackData = data;
+  };
+
+  igtlUint64 GetUsage() { return this->Usage.load(); };
+  igtlUint64 GetPeak()  { return this->Peak.load(); };
+
+protected:
+
+  MemoryBudget();
+  ~MemoryBudget();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  void           UpdatePeak(igtlUint64 usage);
+
+protected:
+
+  igtl::MemoryBudget::Pointer Parent;
+  igtlUint64                  Limit;
+
+  ReleaseCallback             Callback;
+  void *                      CallbackData;
+
+  std::atomic<igtlUint64>     Usage;
+  std::atomic<igtlUint64>     Peak;
+
+};
+
+}
+
+#endif // BUDGET_H
@@ -0,0 +1,127 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+
+#include "cache.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+ResponseCache::ResponseCache()
+{
+  this->Freshness = 1.0;
+  this->Mutex = igtl::MutexLock::New();
+}
+
+//-----------------------------------------------------------------------------
+ResponseCache::~ResponseCache()
+{
+}
+
+//-----------------------------------------------------------------------------
+void ResponseCache::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int ResponseCache::IsCacheable(const char * type)
+{
+  return (strcmp(type, "CAPABILITY") == 0 ||
+          strcmp(type, "STATUS") == 0 ||
+          strcmp(type, "TRANSFORM") == 0);
+}
+
+//-----------------------------------------------------------------------------
+const char * ResponseCache::GetReplyType(const char * type)
+{
+  if (strncmp(type, "GET_", 4) != 0)
+    {
+    return NULL;
+    }
+  // Device types are at most 12 characters.
+  if (strcmp(type + 4, "CAPABIL") == 0)
+    {
+    return "CAPABILITY";
+    }
+  return type + 4;
+}
+
+//-----------------------------------------------------------------------------
+std::string ResponseCache::MakeKey(const char * type, const char * name)
+{
+  std::string key(type);
+  key.append(1, ' ');
+  // GET_CAPABIL usually has no device name, and the server has one list
+  // of capabilities whatever the name of its reply.
+  if (strcmp(type, "CAPABILITY") != 0)
+    {
+    key.append(name);
+    }
+  return key;
+}
+
+//-----------------------------------------------------------------------------
+void ResponseCache::Store(igtl::MessageBase * msg, const char * type, const char * name, igtlInt64 now)
+{
+  std::string key = MakeKey(type, name);
+
+  this->Mutex->Lock();
+  Entry & e = this->Entries[key];
+  e.message = msg;
+  e.time    = now;
+  this->Mutex->Unlock();
+}
+
+//-----------------------------------------------------------------------------
+void ResponseCache::Touch(const char * type, const char * name, igtlInt64 now)
+{
+  std::string key = MakeKey(type, name);
+
+  this->Mutex->Lock();
+  std::map<std::string, Entry>::iterator it = this->Entries.find(key);
+  if (it != this->Entries.end())
+    {
+    it->second.time = now;
+    }
+  this->Mutex->Unlock();
+}
+
+//-----------------------------------------------------------------------------
+igtl::MessageBase::Pointer ResponseCache::Find(const char * type, const char * name, igtlInt64 now)
+{
+  igtl::MessageBase::Pointer msg;
+
+  // An empty name asks for all devices, which the cache cannot answer.
+  if (name[0] == '\0' && strcmp(type, "CAPABILITY") != 0)
+    {
+    return msg;
+    }
+
+  std::string key = MakeKey(type, name);
+
+  this->Mutex->Lock();
+  std::map<std::string, Entry>::iterator it = this->Entries.find(key);
+  if (it != this->Entries.end() &&
+      (double) (now - it->second.time) * 1.0e-9 <= this->Freshness)
+    {
+    msg = it->second.message;
+    }
+  this->Mutex->Unlock();
+
+  return msg;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,94 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <map>
+#include <string>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMessageBase.h"
+#include "igtlMutexLock.h"
+
+namespace igtl
+{
+
+// ResponseCache keeps the latest CAPABILITY, STATUS, and TRANSFORM message
+// forwarded in one direction per device name (a single CAPABILITY message
+// regardless of the name, since it describes the host), so that GET_ queries coming
+// from the other direction can be answered by the repeater as long as the
+// latest message is not older than 'Freshness' seconds. The cached
+// messages are the packed message objects as they were forwarded, which
+// are not modified afterwards; no copy is made.
+//
+// Thread safe; one session stores and the other one looks up.
+class IGTLCommon_EXPORT ResponseCache : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::ResponseCache, igtl::Object)
+  igtlNewMacro(igtl::ResponseCache);
+
+public:
+
+  virtual const char * GetClassName() { return "ResponseCache"; };
+
+  void   SetFreshness(double s) { this->Freshness = s; };
+  double GetFreshness() { return this->Freshness; };
+
+  // Returns 1 if messages of the type are cached.
+  static int IsCacheable(const char * type);
+
+  // Returns the type of the reply to a query type 'GET_<...>', e.g.
+  // CAPABILITY for GET_CAPABIL, or NULL if 'type' is not a query.
+  static const char * GetReplyType(const char * type);
+
+  // Stores a packed message of a cacheable type. 'now' is in ns (Clock::Ticks()).
+  void Store(igtl::MessageBase * msg, const char * type, const char * name, igtlInt64 now);
+
+  // Marks the cached message as current, e.g. when an identical message
+  // was suppressed as a duplicate.
+  void Touch(const char * type, const char * name, igtlInt64 now);
+
+  // Returns the cached reply of 'type' (see GetReplyType()) for the
+  // device, or NULL if there is none or it is stale.
+  igtl::MessageBase::Pointer Find(const char * type, const char * name, igtlInt64 now);
+
+protected:
+
+  ResponseCache();
+  ~ResponseCache();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    igtl::MessageBase::Pointer message;
+    igtlInt64                  time;  // ns
+  } Entry;
+
+  static std::string MakeKey(const char * type, const char * name);
+
+protected:
+
+  double Freshness;
+
+  std::map<std::string, Entry> Entries;
+  igtl::MutexLock::Pointer Mutex;
+
+};
+
+}
+
+#endif // CACHE_H
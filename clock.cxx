@@ -0,0 +1,176 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <time.h>
+
+#include "clock.h"
+
+#include "igtlOSUtil.h"
+#include "igtlTimeStamp.h"
+
+#ifdef IGTLREPEATER_TSC_CLOCK
+#include <cpuid.h>
+#endif
+
+namespace igtl
+{
+
+std::atomic<int>          Clock::Enabled(0);
+std::atomic<unsigned int> Clock::Sequence(0);
+std::atomic<igtlUint64>   Clock::BaseTicks(0);
+std::atomic<igtlInt64>    Clock::BaseTime(0);
+std::atomic<igtlUint64>   Clock::Scale(0);
+igtlUint64                Clock::CalibrationTicks = 0;
+igtlInt64                 Clock::CalibrationTime  = 0;
+igtlUint64                Clock::TickScale        = 0;
+
+#ifdef IGTLREPEATER_TSC_CLOCK
+
+// Calibration period (ms)
+static const int CALIBRATION_PERIOD = 20;
+
+//-----------------------------------------------------------------------------
+// The TSC runs at a constant rate in all power states (CPUID 80000007H,
+// EDX bit 8); otherwise it cannot be used as a clock.
+static int HasInvariantTSC()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+    {
+    return 0;
+    }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1 << 8)) ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the TSC and 'clock' at the same moment, taking the closest of a few
+// tries so that a preemption between the reads does not skew the pair.
+static void ReadPair(clockid_t clock, igtlUint64 & ticks, igtlInt64 & ns)
+{
+  igtlUint64 best = ~(igtlUint64) 0;
+  for (int i = 0; i < 5; i ++)
+    {
+    struct timespec ts;
+    igtlUint64 before = __rdtsc();
+    clock_gettime(clock, &ts);
+    igtlUint64 after  = __rdtsc();
+    if (after - before < best)
+      {
+      best  = after - before;
+      ticks = before + (after - before) / 2;
+      ns    = (igtlInt64) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      }
+    }
+}
+
+#endif //IGTLREPEATER_TSC_CLOCK
+
+//-----------------------------------------------------------------------------
+void Clock::Initialize()
+{
+#ifdef IGTLREPEATER_TSC_CLOCK
+  if (Enabled.load() || !HasInvariantTSC())
+    {
+    return;
+    }
+
+  igtlUint64 t0, t1;
+  igtlInt64  m0, m1;
+  ReadPair(CLOCK_MONOTONIC, t0, m0);
+  igtl::Sleep(CALIBRATION_PERIOD);
+  ReadPair(CLOCK_MONOTONIC, t1, m1);
+  if (t1 <= t0 || m1 <= m0)
+    {
+    return;
+    }
+  CalibrationTicks = t0;
+  CalibrationTime  = m0;
+  TickScale = (igtlUint64) (((unsigned __int128) (m1 - m0) << SCALE_SHIFT) / (t1 - t0));
+  Scale.store(TickScale);
+
+  igtlUint64 ticks;
+  igtlInt64  ns;
+  ReadPair(CLOCK_REALTIME, ticks, ns);
+  BaseTicks.store(ticks);
+  BaseTime.store(ns);
+  Enabled.store(1);
+#endif //IGTLREPEATER_TSC_CLOCK
+}
+
+//-----------------------------------------------------------------------------
+void Clock::Synchronize()
+{
+#ifdef IGTLREPEATER_TSC_CLOCK
+  if (!Enabled.load())
+    {
+    return;
+    }
+
+  // The rate over the whole run is more accurate than the first estimate.
+  igtlUint64 t;
+  igtlInt64  m;
+  ReadPair(CLOCK_MONOTONIC, t, m);
+  igtlUint64 scale = Scale.load();
+  if (t > CalibrationTicks && m > CalibrationTime)
+    {
+    scale = (igtlUint64) (((unsigned __int128) (m - CalibrationTime) << SCALE_SHIFT) / (t - CalibrationTicks));
+    }
+
+  igtlUint64 ticks;
+  igtlInt64  ns;
+  ReadPair(CLOCK_REALTIME, ticks, ns);
+
+  unsigned int seq = Sequence.load(std::memory_order_relaxed);
+  Sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  BaseTicks.store(ticks, std::memory_order_relaxed);
+  BaseTime.store(ns, std::memory_order_relaxed);
+  Scale.store(scale, std::memory_order_relaxed);
+  Sequence.store(seq + 2, std::memory_order_release);
+#endif //IGTLREPEATER_TSC_CLOCK
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 Clock::SystemNow()
+{
+#ifdef _WIN32
+  igtl::TimeStamp::Pointer ts = igtl::TimeStamp::New();
+  ts->GetTime();
+  return (igtlInt64) ts->GetSecond() * 1000000000LL + ts->GetNanosecond();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (igtlInt64) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 Clock::SystemTicks()
+{
+#ifdef _WIN32
+  return SystemNow();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (igtlInt64) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+const char * Clock::GetSource()
+{
+  return Enabled.load() ? "tsc" : "system";
+}
+
+}
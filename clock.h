@@ -0,0 +1,119 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Time stamps in ns since the epoch for the relay path. On x86-64 with an
+// invariant TSC, Now() reads the TSC and scales it with a factor calibrated
+// against CLOCK_MONOTONIC, offset to CLOCK_REALTIME; this takes a few ns
+// instead of allocating an igtl::TimeStamp and calling GetTime(). Other
+// hosts use clock_gettime(CLOCK_REALTIME), which Linux serves from the vDSO.
+// Now() follows the system clock and may jump when it is re-anchored, so
+// intervals and deadlines are measured with Ticks() instead.
+
+#include <atomic>
+
+#include "igtlTypes.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define IGTLREPEATER_TSC_CLOCK
+#endif
+
+namespace igtl
+{
+
+class Clock
+{
+public:
+
+  // Calibrates the TSC (about 20 ms). Now() uses the system clock until
+  // Initialize() has been called.
+  static void Initialize();
+
+  // Re-anchors the TSC to CLOCK_REALTIME and refines its rate, so that the
+  // stamps follow the adjustments of the system clock. Called periodically
+  // by one thread.
+  static void Synchronize();
+
+  // ns since the epoch
+  static inline igtlInt64 Now()
+  {
+#ifdef IGTLREPEATER_TSC_CLOCK
+    if (Enabled.load(std::memory_order_relaxed))
+      {
+      // Parameters are updated by Synchronize() under a sequence lock.
+      unsigned int seq;
+      igtlInt64    ns;
+      do
+        {
+        seq = Sequence.load(std::memory_order_acquire);
+        igtlInt64  ticks = (igtlInt64) (__rdtsc() - BaseTicks.load(std::memory_order_relaxed));
+        igtlUint64 scale = Scale.load(std::memory_order_relaxed);
+        ns = BaseTime.load(std::memory_order_relaxed) + (igtlInt64) (((__int128) ticks * scale) >> SCALE_SHIFT);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        }
+      while ((seq & 1) || seq != Sequence.load(std::memory_order_relaxed));
+      return ns;
+      }
+#endif //IGTLREPEATER_TSC_CLOCK
+    return SystemNow();
+  };
+
+  // ns since the epoch from the system clock
+  static igtlInt64 SystemNow();
+
+  // ns on a monotonic clock with an arbitrary origin. Unlike Now(), it is
+  // not re-anchored by Synchronize(); the TSC is scaled with the rate of
+  // the first calibration, so the value never jumps.
+  static inline igtlInt64 Ticks()
+  {
+#ifdef IGTLREPEATER_TSC_CLOCK
+    if (Enabled.load(std::memory_order_acquire))
+      {
+      igtlInt64 ticks = (igtlInt64) (__rdtsc() - CalibrationTicks);
+      return CalibrationTime + (igtlInt64) (((__int128) ticks * TickScale) >> SCALE_SHIFT);
+      }
+#endif //IGTLREPEATER_TSC_CLOCK
+    return SystemTicks();
+  };
+
+  // ns from CLOCK_MONOTONIC
+  static igtlInt64 SystemTicks();
+
+  // "tsc" or "system"
+  static const char * GetSource();
+
+protected:
+
+  enum {
+    SCALE_SHIFT = 32  // 'Scale' is ns per tick in 32.32 fixed point
+  };
+
+  static std::atomic<int>          Enabled;
+  static std::atomic<unsigned int> Sequence;   // Odd while being updated
+  static std::atomic<igtlUint64>   BaseTicks;
+  static std::atomic<igtlInt64>    BaseTime;   // ns since the epoch at 'BaseTicks'
+  static std::atomic<igtlUint64>   Scale;
+
+  // First calibration point, for refining the rate and for Ticks()
+  static igtlUint64 CalibrationTicks;
+  static igtlInt64  CalibrationTime; // CLOCK_MONOTONIC
+  static igtlUint64 TickScale;       // 'Scale' of the first calibration
+
+};
+
+}
+
+#endif //CLOCK_H
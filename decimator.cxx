@@ -0,0 +1,291 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <vector>
+#include <algorithm>
+
+#include "decimator.h"
+
+#include "igtlTimeStamp.h"
+#include "igtl_util.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+// Box filter helpers
+//
+// The filter is split into two passes so that the inner loops run over
+// contiguous memory and can be vectorized by the compiler:
+//  1. f[1]*f[2] input rows are summed element-wise into an accumulator row.
+//  2. The accumulator row is reduced by f[0] along x (stride = # of components).
+// 'A' is an accumulator type wide enough to hold the sum of f[0]*f[1]*f[2]
+// samples of type 'T'; see BoxFilterNarrow().
+
+template <typename A>
+inline A DivideRound(A sum, A n)
+{
+  return (sum >= 0) ? (sum + n / 2) / n : (sum - n / 2) / n;
+}
+
+inline float DivideRound(float sum, float n)
+{
+  return sum / n;
+}
+
+inline double DivideRound(double sum, double n)
+{
+  return sum / n;
+}
+
+template <typename T, typename A>
+void BoxFilter(const T * src, T * dst, const int size[3], int nc,
+               const int factor[3], const int osize[3])
+{
+  const igtlUint64 rowLen   = (igtlUint64) size[0] * nc;
+  const igtlUint64 sliceLen = rowLen * size[1];
+  const igtlUint64 orowLen  = (igtlUint64) osize[0] * nc;
+  const A n = (A) ((igtlInt64) factor[0] * factor[1] * factor[2]);
+
+  std::vector<A> acc(rowLen);
+
+  for (int oz = 0; oz < osize[2]; oz ++)
+    {
+    for (int oy = 0; oy < osize[1]; oy ++)
+      {
+      std::fill(acc.begin(), acc.end(), (A) 0);
+      A * a = &acc[0];
+      for (int dz = 0; dz < factor[2]; dz ++)
+        {
+        for (int dy = 0; dy < factor[1]; dy ++)
+          {
+          const T * row = src
+            + (igtlUint64) (oz * factor[2] + dz) * sliceLen
+            + (igtlUint64) (oy * factor[1] + dy) * rowLen;
+          for (igtlUint64 i = 0; i < rowLen; i ++)
+            {
+            a[i] += (A) row[i];
+            }
+          }
+        }
+
+      T * out = dst + ((igtlUint64) oz * osize[1] + oy) * orowLen;
+      for (int ox = 0; ox < osize[0]; ox ++)
+        {
+        const A * block = a + (igtlUint64) ox * factor[0] * nc;
+        for (int c = 0; c < nc; c ++)
+          {
+          A sum = 0;
+          for (int dx = 0; dx < factor[0]; dx ++)
+            {
+            sum += block[dx * nc + c];
+            }
+          out[ox * nc + c] = (T) DivideRound(sum, n);
+          }
+        }
+      }
+    }
+}
+
+// 8- and 16-bit scalars are summed in 32 bits, which vectorizes better,
+// as long as a block cannot overflow it (e.g. up to 32^3 voxels of 16-bit
+// scalars); larger blocks are summed in 64 bits.
+template <typename T>
+void BoxFilterNarrow(const T * src, T * dst, const int size[3], int nc,
+                     const int factor[3], const int osize[3])
+{
+  // 'range' bounds |sample|; the sum plus the rounding in DivideRound()
+  // must fit in 32 bits.
+  const igtlInt64 range = ((igtlInt64) 1 << (8 * sizeof(T))) - 1;
+  igtlInt64 n = (igtlInt64) factor[0] * factor[1] * factor[2];
+  if (n * range + n / 2 <= (igtlInt64) 0x7FFFFFFF)
+    {
+    BoxFilter<T, igtlInt32>(src, dst, size, nc, factor, osize);
+    }
+  else
+    {
+    BoxFilter<T, igtlInt64>(src, dst, size, nc, factor, osize);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+ImageDecimator::ImageDecimator()
+{
+  this->FrameInterval    = 1;
+  this->MaximumFrameRate = 0.0;
+  this->DownsampleFactor = 1;
+}
+
+//-----------------------------------------------------------------------------
+ImageDecimator::~ImageDecimator()
+{
+}
+
+//-----------------------------------------------------------------------------
+void ImageDecimator::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int ImageDecimator::IsEnabled()
+{
+  return (this->FrameInterval > 1 || this->MaximumFrameRate > 0.0 || this->DownsampleFactor > 1);
+}
+
+//-----------------------------------------------------------------------------
+int ImageDecimator::AcceptFrame(const char * deviceName, double time)
+{
+  FrameState & state = this->States[deviceName];
+  igtlUint64 count = state.count ++;
+
+  if (count % this->FrameInterval != 0)
+    {
+    return 0;
+    }
+
+  if (this->MaximumFrameRate > 0.0 && count > 0)
+    {
+    // Accept if the clock went backward, so that the stream never stalls.
+    double elapsed = time - state.lastTime;
+    if (elapsed >= 0.0 && elapsed < 1.0 / this->MaximumFrameRate)
+      {
+      return 0;
+      }
+    }
+
+  state.lastTime = time;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+ImageMessage::Pointer ImageDecimator::Downsample(ImageMessage * src)
+{
+  ImageMessage::Pointer dst;
+
+  if (this->DownsampleFactor <= 1)
+    {
+    return dst;
+    }
+
+  int   size[3];
+  float spacing[3];
+  int   svsize[3];
+  int   svoffset[3];
+  src->GetDimensions(size);
+  src->GetSpacing(spacing);
+  src->GetSubVolume(svsize, svoffset);
+
+  // Only full volumes are downsampled.
+  if (svsize[0] != size[0] || svsize[1] != size[1] || svsize[2] != size[2])
+    {
+    return dst;
+    }
+
+  // The scalars are kept in the byte order of the sender; multi-byte
+  // scalars can be averaged only if it matches the host.
+  int scalarType = src->GetScalarType();
+  int hostEndian = igtl_is_little_endian() ? ImageMessage::ENDIAN_LITTLE : ImageMessage::ENDIAN_BIG;
+  if (src->GetScalarSize() > 1 && src->GetEndian() != hostEndian)
+    {
+    return dst;
+    }
+
+  // Axes shorter than the factor are not downsampled (e.g. z for 2D images).
+  int factor[3];
+  int osize[3];
+  float ospacing[3];
+  for (int i = 0; i < 3; i ++)
+    {
+    factor[i]   = (size[i] >= this->DownsampleFactor) ? this->DownsampleFactor : 1;
+    osize[i]    = size[i] / factor[i];
+    ospacing[i] = spacing[i] * (float) factor[i];
+    }
+
+  if (factor[0] == 1 && factor[1] == 1 && factor[2] == 1)
+    {
+    return dst;
+    }
+
+  // The origin in the matrix is the center of the volume. Since the
+  // trailing voxels that do not fill a whole block are discarded, the
+  // center moves by (osize*factor - size)/2 voxels along each axis.
+  igtl::Matrix4x4 matrix;
+  src->GetMatrix(matrix);
+  for (int i = 0; i < 3; i ++)
+    {
+    float shift = (float) (osize[i] * factor[i] - size[i]) * 0.5f * spacing[i];
+    for (int j = 0; j < 3; j ++)
+      {
+      matrix[j][3] += matrix[j][i] * shift;
+      }
+    }
+
+  dst = ImageMessage::New();
+  dst->SetDeviceName(src->GetDeviceName());
+  dst->SetDimensions(osize);
+  dst->SetSpacing(ospacing);
+  dst->SetScalarType(scalarType);
+  dst->SetEndian(src->GetEndian());
+  dst->SetNumComponents(src->GetNumComponents());
+  dst->SetCoordinateSystem(src->GetCoordinateSystem());
+  dst->SetMatrix(matrix);
+  int zero[3] = {0, 0, 0};
+  dst->SetSubVolume(osize, zero);
+
+  igtl::TimeStamp::Pointer ts = igtl::TimeStamp::New();
+  src->GetTimeStamp(ts);
+  dst->SetTimeStamp(ts);
+
+  dst->AllocateScalars();
+
+  int nc = src->GetNumComponents();
+  const void * in = src->GetScalarPointer();
+  void * out = dst->GetScalarPointer();
+
+  switch (scalarType)
+    {
+    case ImageMessage::TYPE_INT8:
+      BoxFilterNarrow<igtlInt8>((const igtlInt8 *) in, (igtlInt8 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_UINT8:
+      BoxFilterNarrow<igtlUint8>((const igtlUint8 *) in, (igtlUint8 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_INT16:
+      BoxFilterNarrow<igtlInt16>((const igtlInt16 *) in, (igtlInt16 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_UINT16:
+      BoxFilterNarrow<igtlUint16>((const igtlUint16 *) in, (igtlUint16 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_INT32:
+      BoxFilter<igtlInt32, igtlInt64>((const igtlInt32 *) in, (igtlInt32 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_UINT32:
+      BoxFilter<igtlUint32, igtlInt64>((const igtlUint32 *) in, (igtlUint32 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_FLOAT32:
+      BoxFilter<igtlFloat32, igtlFloat32>((const igtlFloat32 *) in, (igtlFloat32 *) out, size, nc, factor, osize);
+      break;
+    case ImageMessage::TYPE_FLOAT64:
+      BoxFilter<igtlFloat64, igtlFloat64>((const igtlFloat64 *) in, (igtlFloat64 *) out, size, nc, factor, osize);
+      break;
+    default:
+      return ImageMessage::Pointer();
+    }
+
+  dst->Pack();
+  return dst;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,99 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <map>
+#include <string>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlImageMessage.h"
+
+namespace igtl
+{
+
+// ImageDecimator reduces the rate and the resolution of IMAGE messages
+// forwarded to a subscriber. The frame rate is reduced by keeping every
+// Nth frame and/or by capping the rate per device name. The resolution is
+// reduced by an integer box filter along each axis.
+class IGTLCommon_EXPORT ImageDecimator : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::ImageDecimator, igtl::Object)
+  igtlNewMacro(igtl::ImageDecimator);
+
+public:
+
+  virtual const char * GetClassName() { return "ImageDecimator"; };
+
+  // Keep every Nth frame (1: keep all).
+  void SetFrameInterval(int n) { this->FrameInterval = (n > 0) ? n : 1; };
+  int  GetFrameInterval() { return this->FrameInterval; };
+
+  // Maximum frame rate per device name in frames/s (0: no limit).
+  void   SetMaximumFrameRate(double fps) { this->MaximumFrameRate = (fps > 0.0) ? fps : 0.0; };
+  double GetMaximumFrameRate() { return this->MaximumFrameRate; };
+
+  // Integer downsampling factor (1: no downsampling), up to
+  // MAXIMUM_DOWNSAMPLE_FACTOR so that the sum of a block of 32-bit
+  // scalars fits in 64 bits.
+  enum {
+    MAXIMUM_DOWNSAMPLE_FACTOR = 1024
+  };
+  void SetDownsampleFactor(int f)
+  {
+    this->DownsampleFactor = (f < 1) ? 1 : (f > MAXIMUM_DOWNSAMPLE_FACTOR) ? (int) MAXIMUM_DOWNSAMPLE_FACTOR : f;
+  };
+  int  GetDownsampleFactor() { return this->DownsampleFactor; };
+
+  // Returns 1 if any of the stages is enabled.
+  int  IsEnabled();
+
+  // Returns 1 if the frame from 'deviceName' received at 'time' (in seconds)
+  // should be forwarded, 0 if it should be dropped.
+  int  AcceptFrame(const char * deviceName, double time);
+
+  // Creates a downsampled copy of 'src', packed and ready to send.
+  // Returns a NULL pointer if downsampling is disabled or not applicable
+  // to the image (e.g. sub-volume or foreign byte order); in that case
+  // the original message should be forwarded unchanged.
+  ImageMessage::Pointer Downsample(ImageMessage * src);
+
+protected:
+
+  ImageDecimator();
+  ~ImageDecimator();
+
+  void           PrintSelf(std::ostream& os) const;
+
+protected:
+
+  typedef struct {
+    igtlUint64 count;
+    double     lastTime;
+  } FrameState;
+
+  int    FrameInterval;
+  double MaximumFrameRate;
+  int    DownsampleFactor;
+
+  std::map<std::string, FrameState> States;
+
+};
+
+}
+
+#endif // DECIMATOR_H
@@ -0,0 +1,175 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <sstream>
+
+#include "decoder.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+LogChannel::LogChannel()
+{
+}
+
+//-----------------------------------------------------------------------------
+LogChannel::~LogChannel()
+{
+}
+
+//-----------------------------------------------------------------------------
+void LogChannel::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+DecoderPool::DecoderPool()
+{
+  this->logger         = NULL;
+  this->MaximumPending = 4096;
+  this->Discarded      = 0;
+  this->Ready          = igtl::ConditionVariable::New();
+  this->Running        = 0;
+  this->Threader       = igtl::MultiThreader::New();
+}
+
+//-----------------------------------------------------------------------------
+DecoderPool::~DecoderPool()
+{
+  this->Stop();
+}
+
+//-----------------------------------------------------------------------------
+void DecoderPool::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int DecoderPool::Start(int n)
+{
+  if (this->Running)
+    {
+    return 0;
+    }
+
+  if (n <= 0)
+    {
+    n = igtl::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+
+  this->Running = 1;
+  for (int i = 0; i < n; i ++)
+    {
+    this->ThreadIDs.push_back(this->Threader->SpawnThread((igtl::ThreadFunctionType) &DecoderPool::DecoderThreadFunction, this));
+    }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void DecoderPool::Stop()
+{
+  this->Mutex.Lock();
+  if (!this->Running)
+    {
+    this->Mutex.Unlock();
+    return;
+    }
+  this->Running = 0;
+  this->Ready->Broadcast();
+  this->Mutex.Unlock();
+
+  // The decoders run the queued jobs before they exit.
+  for (size_t i = 0; i < this->ThreadIDs.size(); i ++)
+    {
+    this->Threader->TerminateThread(this->ThreadIDs[i]);
+    }
+  this->ThreadIDs.clear();
+}
+
+//-----------------------------------------------------------------------------
+void DecoderPool::Submit(igtl::LogChannel * channel, igtl::DecodeJob * job)
+{
+  // Reserve the place of the output in the channel.
+  Task task;
+  task.Channel = channel;
+  task.Job     = job;
+  channel->Lock.Lock();
+  channel->Slots.push_back(LogChannel::Slot());
+  task.Slot = &(channel->Slots.back());
+  task.Slot->Done = 0;
+  channel->Lock.Unlock();
+
+  this->Mutex.Lock();
+  if (this->Tasks.size() >= (size_t) this->MaximumPending)
+    {
+    job->Discard();
+    this->Discarded ++;
+    }
+  this->Tasks.push_back(task);
+  this->Ready->Signal();
+  this->Mutex.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+void DecoderPool::DecoderThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  DecoderPool * pool = static_cast<DecoderPool *>(info->UserData);
+
+  pool->Mutex.Lock();
+  while (1)
+    {
+    if (pool->Tasks.empty())
+      {
+      if (!pool->Running)
+        {
+        break;
+        }
+      pool->Ready->Wait(&(pool->Mutex));
+      continue;
+      }
+    Task task = pool->Tasks.front();
+    pool->Tasks.pop_front();
+    pool->Mutex.Unlock();
+
+    std::stringstream ss;
+    task.Job->Run(ss);
+    delete task.Job;
+
+    // Print the lines of the channel that are complete and no longer wait
+    // for an earlier job.
+    igtl::LogChannel * channel = task.Channel;
+    channel->Lock.Lock();
+    task.Slot->Text = ss.str();
+    task.Slot->Done = 1;
+    while (!channel->Slots.empty() && channel->Slots.front().Done)
+      {
+      if (pool->logger.IsNotNull() && !channel->Slots.front().Text.empty())
+        {
+        pool->logger->Print(channel->Slots.front().Text);
+        }
+      channel->Slots.pop_front();
+      }
+    channel->Lock.Unlock();
+    task.Channel = NULL;
+
+    pool->Mutex.Lock();
+    }
+  pool->Mutex.Unlock();
+}
+
+}
@@ -0,0 +1,144 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+#include "logger.h"
+
+namespace igtl
+{
+
+// The log output of one message, written by a decoder thread.
+class DecodeJob
+{
+public:
+
+  virtual ~DecodeJob() {};
+
+  // Writes the log lines to 'os'.
+  virtual void Run(std::ostream & os) = 0;
+
+  // Called instead of Run() being given a decoded message when the
+  // decoders are behind; the job should drop its message and log less.
+  virtual void Discard() = 0;
+};
+
+
+// LogChannel keeps the jobs of one session so that their lines are
+// printed in the order they were submitted, whichever thread runs them.
+class IGTLCommon_EXPORT LogChannel : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::LogChannel, igtl::Object)
+  igtlNewMacro(igtl::LogChannel);
+
+public:
+
+  virtual const char * GetClassName() { return "LogChannel"; };
+
+protected:
+
+  LogChannel();
+  ~LogChannel();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  friend class DecoderPool;
+
+  typedef struct {
+    std::string Text;
+    int         Done;
+  } Slot;
+
+  igtl::SimpleMutexLock Lock;
+  std::deque<Slot>      Slots;  // Elements stay in place while others are added or removed at the ends
+
+};
+
+
+// DecoderPool runs the decode jobs of all sessions on a fixed set of
+// threads, so that decoding and formatting the log does not delay
+// forwarding. Jobs of one channel run in parallel; their output is
+// printed in order by the thread that completes the oldest one.
+class IGTLCommon_EXPORT DecoderPool : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::DecoderPool, igtl::Object)
+  igtlNewMacro(igtl::DecoderPool);
+
+public:
+
+  virtual const char * GetClassName() { return "DecoderPool"; };
+
+  void SetLogger(igtl::Logger * logger) { this->logger = logger; };
+
+  // Jobs waiting beyond 'n' are discarded (see DecodeJob::Discard()).
+  void SetMaximumPending(int n) { this->MaximumPending = n; };
+
+  // Starts 'n' threads (0: one per core).
+  int  Start(int n);
+  void Stop();
+
+  // Queues 'job', which is deleted after it has run.
+  void Submit(igtl::LogChannel * channel, igtl::DecodeJob * job);
+
+  igtlUint64 GetDiscarded() { return this->Discarded; };
+
+protected:
+
+  DecoderPool();
+  ~DecoderPool();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  static void    DecoderThreadFunction(void * ptr);
+
+  typedef struct {
+    igtl::LogChannel::Pointer Channel;
+    LogChannel::Slot *        Slot;
+    igtl::DecodeJob *         Job;
+  } Task;
+
+protected:
+
+  igtl::Logger::Pointer        logger;
+
+  int                          MaximumPending;
+  igtlUint64                   Discarded;
+
+  igtl::SimpleMutexLock        Mutex;
+  igtl::ConditionVariable::Pointer Ready;
+  std::deque<Task>             Tasks;
+
+  int                          Running;
+  igtl::MultiThreader::Pointer Threader;
+  std::vector<int>             ThreadIDs;
+
+};
+
+}
+
+#endif // DECODER_H
@@ -0,0 +1,177 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+
+#include "dedup.h"
+#include "wire.h"
+
+namespace igtl
+{
+
+static const igtlUint64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const igtlUint64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const igtlUint64 PRIME64_3 = 0x165667B19E3779F9ULL;
+static const igtlUint64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const igtlUint64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline igtlUint64 RotateLeft(igtlUint64 x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, independent of the host byte order
+static inline igtlUint64 Load64(const unsigned char * p)
+{
+  return (igtlUint64) p[0] | ((igtlUint64) p[1] << 8) | ((igtlUint64) p[2] << 16) | ((igtlUint64) p[3] << 24) |
+    ((igtlUint64) p[4] << 32) | ((igtlUint64) p[5] << 40) | ((igtlUint64) p[6] << 48) | ((igtlUint64) p[7] << 56);
+}
+
+static inline igtlUint64 Load32(const unsigned char * p)
+{
+  return (igtlUint64) p[0] | ((igtlUint64) p[1] << 8) | ((igtlUint64) p[2] << 16) | ((igtlUint64) p[3] << 24);
+}
+
+static inline igtlUint64 Round(igtlUint64 acc, igtlUint64 input)
+{
+  acc += input * PRIME64_2;
+  acc  = RotateLeft(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline igtlUint64 MergeRound(igtlUint64 acc, igtlUint64 val)
+{
+  acc ^= Round(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 Hash64(const void * data, igtlUint64 length, igtlUint64 seed)
+{
+  const unsigned char * p   = (const unsigned char *) data;
+  const unsigned char * end = p + length;
+  igtlUint64 h;
+
+  if (length >= 32)
+    {
+    // Four independent lanes over 32-byte stripes
+    const unsigned char * limit = end - 32;
+    igtlUint64 v1 = seed + PRIME64_1 + PRIME64_2;
+    igtlUint64 v2 = seed + PRIME64_2;
+    igtlUint64 v3 = seed;
+    igtlUint64 v4 = seed - PRIME64_1;
+    do
+      {
+      v1 = Round(v1, Load64(p));
+      v2 = Round(v2, Load64(p + 8));
+      v3 = Round(v3, Load64(p + 16));
+      v4 = Round(v4, Load64(p + 24));
+      p += 32;
+      }
+    while (p <= limit);
+
+    h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+    h = MergeRound(h, v1);
+    h = MergeRound(h, v2);
+    h = MergeRound(h, v3);
+    h = MergeRound(h, v4);
+    }
+  else
+    {
+    h = seed + PRIME64_5;
+    }
+
+  h += length;
+
+  while (p + 8 <= end)
+    {
+    h ^= Round(0, Load64(p));
+    h  = RotateLeft(h, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+    }
+  if (p + 4 <= end)
+    {
+    h ^= Load32(p) * PRIME64_1;
+    h  = RotateLeft(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+    }
+  while (p < end)
+    {
+    h ^= (*p) * PRIME64_5;
+    h  = RotateLeft(h, 11) * PRIME64_1;
+    p ++;
+    }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+//-----------------------------------------------------------------------------
+DuplicateFilter::DuplicateFilter()
+{
+  this->KeepAliveInterval = 1.0;
+  this->Suppressed = 0;
+}
+
+//-----------------------------------------------------------------------------
+DuplicateFilter::~DuplicateFilter()
+{
+}
+
+//-----------------------------------------------------------------------------
+void DuplicateFilter::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int DuplicateFilter::IsDuplicate(const char * type, const char * name, int headerVersion,
+                                 const void * body, igtlUint64 size, igtlInt64 now)
+{
+  // The extended header carries a message ID that changes with every message.
+  const unsigned char * p = (const unsigned char *) body;
+  if (headerVersion >= 2 && size >= 12)
+    {
+    igtlUint64 extSize = GetUint16BE(p);
+    if (extSize >= 12 && extSize <= size)
+      {
+      p    += extSize;
+      size -= extSize;
+      }
+    }
+  igtlUint64 hash = Hash64(p, size, 0);
+
+  this->Key.assign(type);
+  this->Key.append(1, ' ');
+  this->Key.append(name);
+
+  Entry & e = this->Entries[this->Key];
+  if (e.seen && e.hash == hash && e.size == size &&
+      (double) (now - e.lastForwarded) * 1.0e-9 < this->KeepAliveInterval)
+    {
+    this->Suppressed ++;
+    return 1;
+    }
+
+  e.hash = hash;
+  e.size = size;
+  e.lastForwarded = now;
+  e.seen = 1;
+  return 0;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,86 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string>
+#include <unordered_map>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlTypes.h"
+
+namespace igtl
+{
+
+// 64-bit hash of a byte array (the XXH64 algorithm).
+igtlUint64 Hash64(const void * data, igtlUint64 length, igtlUint64 seed);
+
+// DuplicateFilter detects messages whose body is identical to the body of
+// the last message forwarded with the same type and device name, e.g. a
+// STATUS or the TRANSFORM of a tool that is not moving. Only a hash of the
+// body is kept per (type, device name). A repeat is still forwarded once
+// every 'KeepAliveInterval' seconds so that the receiver sees the device
+// is alive.
+//
+// Not thread safe; each session has its own filter.
+class IGTLCommon_EXPORT DuplicateFilter : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::DuplicateFilter, igtl::Object)
+  igtlNewMacro(igtl::DuplicateFilter);
+
+public:
+
+  virtual const char * GetClassName() { return "DuplicateFilter"; };
+
+  void   SetKeepAliveInterval(double s) { this->KeepAliveInterval = s; };
+  double GetKeepAliveInterval() { return this->KeepAliveInterval; };
+
+  // Returns 1 if the message is a repeat to be suppressed. 'body' is the raw
+  // body as received; with a version 2 header ('headerVersion' >= 2), the
+  // extended header (message ID) is not compared. 'now' is in ns (Clock::Ticks()).
+  int IsDuplicate(const char * type, const char * name, int headerVersion,
+                  const void * body, igtlUint64 size, igtlInt64 now);
+
+  igtlUint64 GetNumberOfSuppressed() { return this->Suppressed; };
+
+protected:
+
+  DuplicateFilter();
+  ~DuplicateFilter();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    igtlUint64 hash;
+    igtlUint64 size;
+    igtlInt64  lastForwarded; // ns
+    int        seen;
+  } Entry;
+
+protected:
+
+  double KeepAliveInterval;
+  igtlUint64 Suppressed;
+
+  std::unordered_map<std::string, Entry> Entries;
+  std::string Key;
+
+};
+
+}
+
+#endif // DEDUP_H
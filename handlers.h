@@ -0,0 +1,331 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Per-message-type traits used by Session to generate the message
+// handlers. A specialization of MessageTraits<> provides:
+//
+//   static const char * Type();                 // Device type on the wire
+//   enum { Priority = SendQueue::PRIORITY_* };  // Priority lane
+//   static void Format(TMessage * msg, std::ostream & os);
+//                                               // Log line of a decoded message
+//
+// To handle a new message type, add a specialization here and the message
+// class to the list in Session::BuildHandlers() (session.cxx).
+
+#include <string.h>
+#include <ostream>
+#include <iomanip>
+
+#include "igtlMath.h"
+#include "igtlMessageHeader.h"
+#include "igtlTransformMessage.h"
+#include "igtlPositionMessage.h"
+#include "igtlImageMessage.h"
+#include "igtlStatusMessage.h"
+
+#if OpenIGTLink_PROTOCOL_VERSION >= 2
+#include "igtlPointMessage.h"
+#include "igtlTrajectoryMessage.h"
+#include "igtlStringMessage.h"
+#include "igtlBindMessage.h"
+#include "igtlCapabilityMessage.h"
+#include "igtlTrackingDataMessage.h"
+#endif // OpenIGTLink_PROTOCOL_VERSION >= 2
+
+#include "sendqueue.h"
+
+namespace igtl
+{
+
+template <class TMessage> struct MessageTraits;
+
+// Matrix in the log, column by column
+inline void FormatMatrix(igtl::Matrix4x4 & matrix, std::ostream & os)
+{
+  os << "Matrix=("
+     << matrix[0][0] << ", " << matrix[1][0] << ", " << matrix[2][0] << ", " << matrix[3][0] << ", "
+     << matrix[0][1] << ", " << matrix[1][1] << ", " << matrix[2][1] << ", " << matrix[3][1] << ", "
+     << matrix[0][2] << ", " << matrix[1][2] << ", " << matrix[2][2] << ", " << matrix[3][2] << ", "
+     << matrix[0][3] << ", " << matrix[1][3] << ", " << matrix[2][3] << ", " << matrix[3][3] << ")";
+}
+
+// Format() of a message passed as igtl::MessageBase
+template <class TMessage>
+void FormatMessage(igtl::MessageBase * msg, std::ostream & os)
+{
+  MessageTraits<TMessage>::Format(static_cast<TMessage *>(msg), os);
+}
+
+// Format() of a message forwarded as received, i.e. still packed. The
+// message is decoded from a copy, since Unpack() converts the buffer in
+// place while it may still be being sent.
+template <class TMessage>
+void DecodeMessage(igtl::MessageBase * packed, std::ostream & os)
+{
+  igtl::MessageHeader::Pointer header = igtl::MessageHeader::New();
+  header->InitPack();
+  memcpy(header->GetPackPointer(), packed->GetPackPointer(), IGTL_HEADER_SIZE);
+  header->Unpack();
+
+  typename TMessage::Pointer msg = TMessage::New();
+  msg->SetMessageHeader(header);
+  msg->AllocatePack();
+  memcpy(msg->GetPackBodyPointer(), packed->GetPackBodyPointer(), msg->GetPackBodySize());
+
+  int c = msg->Unpack(1);
+  if (!(c & igtl::MessageHeader::UNPACK_BODY)) // if CRC check is not OK
+    {
+    os << "Invalid " << MessageTraits<TMessage>::Type() << " message.";
+    return;
+    }
+  MessageTraits<TMessage>::Format(msg, os);
+}
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::TransformMessage>
+{
+  static const char * Type() { return "TRANSFORM"; }
+  enum { Priority = SendQueue::PRIORITY_POSE };
+
+  static void Format(igtl::TransformMessage * msg, std::ostream & os)
+  {
+    igtl::Matrix4x4 matrix;
+    msg->GetMatrix(matrix);
+    FormatMatrix(matrix, os);
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::PositionMessage>
+{
+  static const char * Type() { return "POSITION"; }
+  enum { Priority = SendQueue::PRIORITY_POSE };
+
+  static void Format(igtl::PositionMessage * msg, std::ostream & os)
+  {
+    float position[3];
+    float quaternion[4];
+    msg->GetPosition(position);
+    msg->GetQuaternion(quaternion);
+    os << "position=(" << position[0] << ", " << position[1] << ", " << position[2] << "),"
+       << "quaternion=(" << quaternion[0] << ", " << quaternion[1] << ", " << quaternion[2] << ", " << quaternion[3] << ")";
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::ImageMessage>
+{
+  static const char * Type() { return "IMAGE"; }
+  enum { Priority = SendQueue::PRIORITY_BULK };
+
+  static void Format(igtl::ImageMessage * msg, std::ostream & os)
+  {
+    int   size[3];          // image dimension
+    float spacing[3];       // spacing (mm/pixel)
+    int   svsize[3];        // sub-volume size
+    int   svoffset[3];      // sub-volume offset
+    msg->GetDimensions(size);
+    msg->GetSpacing(spacing);
+    msg->GetSubVolume(svsize, svoffset);
+    os << "Endian=" << msg->GetEndian() << ", "
+       << "Dimensions=("
+       << size[0] << ", " << size[1] << ", " << size[2] << "), "
+       << "Spacing=(" << spacing[0] << ", " << spacing[1] << ", " << spacing[2] << "), "
+       << "SubVolumeDimension=(" << svsize[0] << ", " << svsize[1] << ", " << svsize[2] << "), "
+       << "SubVolumeOffset=(" << svoffset[0] << ", " << svoffset[1] << ", " << svoffset[2] << ")";
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::StatusMessage>
+{
+  static const char * Type() { return "STATUS"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::StatusMessage * msg, std::ostream & os)
+  {
+    os << "Code=" << msg->GetCode() << ", "
+       << "SubCode=" << msg->GetSubCode() << ", "
+       << "ErrorName=" << msg->GetErrorName() << ", "
+       << "Status=" << msg->GetStatusString();
+  }
+};
+
+#if OpenIGTLink_PROTOCOL_VERSION >= 2
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::PointMessage>
+{
+  static const char * Type() { return "POINT"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::PointMessage * msg, std::ostream & os)
+  {
+    int nElements = msg->GetNumberOfPointElement();
+    for (int i = 0; i < nElements; i ++)
+      {
+      igtl::PointElement::Pointer pointElement;
+      msg->GetPointElement(i, pointElement);
+
+      igtlUint8 rgba[4];
+      pointElement->GetRGBA(rgba);
+
+      igtlFloat32 pos[3];
+      pointElement->GetPosition(pos);
+
+      os << "Element=" << i << ", "
+         << "Name=" << pointElement->GetName() << ", "
+         << "GroupName=" << pointElement->GetGroupName() << ", "
+         << "RGBA=( " << (int)rgba[0] << ", " << (int)rgba[1] << ", " << (int)rgba[2] << ", " << (int)rgba[3] << "), "
+         << "Position=(" << std::fixed << pos[0] << ", " << pos[1] << ", " << pos[2] << "), "
+         << "Radius=" << std::fixed << pointElement->GetRadius() << ", "
+         << "Owner=" << pointElement->GetOwner() << ", ";
+      }
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::TrajectoryMessage>
+{
+  static const char * Type() { return "TRAJ"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::TrajectoryMessage * msg, std::ostream & os)
+  {
+    int nElements = msg->GetNumberOfTrajectoryElement();
+    for (int i = 0; i < nElements; i ++)
+      {
+      igtl::TrajectoryElement::Pointer trajectoryElement;
+      msg->GetTrajectoryElement(i, trajectoryElement);
+
+      igtlUint8 rgba[4];
+      trajectoryElement->GetRGBA(rgba);
+
+      igtlFloat32 entry[3];
+      igtlFloat32 target[3];
+      trajectoryElement->GetEntryPosition(entry);
+      trajectoryElement->GetTargetPosition(target);
+
+      os << "Element #" << i << ", "
+         << "Name=" << trajectoryElement->GetName() << ", "
+         << "GroupName=" << trajectoryElement->GetGroupName() << ", "
+         << "RGBA=( " << (int)rgba[0] << ", " << (int)rgba[1] << ", " << (int)rgba[2] << ", " << (int)rgba[3] << " )" << ", "
+         << "EntryPt=( " << std::fixed << entry[0] << ", " << entry[1] << ", " << entry[2] << " )" << ", "
+         << "TargetPt=( " << std::fixed << target[0] << ", " << target[1] << ", " << target[2] << " )" << ", "
+         << "Radius=" << std::fixed << trajectoryElement->GetRadius() << ", "
+         << "Owner=" << trajectoryElement->GetOwner() << ", ";
+      }
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::StringMessage>
+{
+  static const char * Type() { return "STRING"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::StringMessage * msg, std::ostream & os)
+  {
+    os << "Encoding=" << msg->GetEncoding() << ", "
+       << "String=" << msg->GetString();
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::BindMessage>
+{
+  static const char * Type() { return "BIND"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::BindMessage * msg, std::ostream & os)
+  {
+    int n = msg->GetNumberOfChildMessages();
+    for (int i = 0; i < n; i ++)
+      {
+      if (strcmp(msg->GetChildMessageType(i), "STRING") == 0)
+        {
+        igtl::StringMessage::Pointer stringMsg;
+        stringMsg = igtl::StringMessage::New();
+        msg->GetChildMessage(i, stringMsg);
+        stringMsg->Unpack(0);
+        os << "MessageType=STRING,"
+           << "MessageNname=" << stringMsg->GetDeviceName() << ", "
+           << "Encoding=" << stringMsg->GetEncoding() << ", "
+           << "String=" << stringMsg->GetString() << ", ";
+        }
+      else if (strcmp(msg->GetChildMessageType(i), "TRANSFORM") == 0)
+        {
+        igtl::TransformMessage::Pointer transMsg;
+        transMsg = igtl::TransformMessage::New();
+        msg->GetChildMessage(i, transMsg);
+        transMsg->Unpack(0);
+        os << "MessageType=TRANSFORM,"
+           << "MessageName=" << transMsg->GetDeviceName() << ", ";
+        igtl::Matrix4x4 matrix;
+        transMsg->GetMatrix(matrix);
+        FormatMatrix(matrix, os);
+        os << ",";
+        }
+      }
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::CapabilityMessage>
+{
+  static const char * Type() { return "CAPABILITY"; }
+  enum { Priority = SendQueue::PRIORITY_CONTROL };
+
+  static void Format(igtl::CapabilityMessage * msg, std::ostream & os)
+  {
+    int nTypes = msg->GetNumberOfTypes();
+    for (int i = 0; i < nTypes; i ++)
+      {
+      os << "ID=" << i << ", "
+         << "TYPE=" << msg->GetType(i) << ", ";
+      }
+  }
+};
+
+//-----------------------------------------------------------------------------
+template <> struct MessageTraits<igtl::TrackingDataMessage>
+{
+  static const char * Type() { return "TDATA"; }
+  enum { Priority = SendQueue::PRIORITY_POSE };
+
+  static void Format(igtl::TrackingDataMessage * msg, std::ostream & os)
+  {
+    int nElements = msg->GetNumberOfTrackingDataElements();
+    for (int i = 0; i < nElements; i ++)
+      {
+      igtl::TrackingDataElement::Pointer trackingElement;
+      msg->GetTrackingDataElement(i, trackingElement);
+
+      igtl::Matrix4x4 matrix;
+      trackingElement->GetMatrix(matrix);
+
+      os << "ElementID=" << i << ", "
+         << "Name=" << trackingElement->GetName() << ", "
+         << "Type=" << (int) trackingElement->GetType() << ", ";
+      FormatMatrix(matrix, os);
+      os << ",";
+      }
+  }
+};
+#endif // OpenIGTLink_PROTOCOL_VERSION >= 2
+
+}
+
+#endif // HANDLERS_H
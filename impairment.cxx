@@ -0,0 +1,434 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <sstream>
+
+#include "impairment.h"
+
+#include "clock.h"
+
+
+namespace igtl
+{
+
+// Timer wheel resolution and size (1 ms x 4096 slots; later rounds wrap)
+static const igtlInt64 TICK       = 1000000;
+static const int       WHEEL_SIZE = 4096;
+
+// Shape of the pareto jitter
+static const double    PARETO_ALPHA = 3.0;
+
+//-----------------------------------------------------------------------------
+ImpairmentEmulator::ImpairmentEmulator()
+{
+  this->Delay              = 0;
+  this->Jitter             = 0;
+  this->Distribution       = DIST_UNIFORM;
+  this->Rate               = 0.0;
+  this->DropProbability    = 0.0;
+  this->ReorderProbability = 0.0;
+  this->Limit              = 10000;
+
+  this->transport = NULL;
+  this->lock      = NULL;
+  this->queue     = NULL;
+
+  this->memoryBudget = NULL;
+  this->HeldBytes    = 0;
+
+  this->Wheel.resize(WHEEL_SIZE);
+  this->CurrentTick = 0;
+  this->WakeTick    = 0;
+  this->Pending     = 0;
+  this->LastDue     = 0;
+  this->LinkFree    = 0;
+  this->StartTime   = 0;
+  this->Dropped     = 0;
+  this->Reordered   = 0;
+  this->Closed      = 0;
+
+  this->Running  = 0;
+  this->Threader = igtl::MultiThreader::New();
+  this->ThreadID = -1;
+}
+
+//-----------------------------------------------------------------------------
+ImpairmentEmulator::~ImpairmentEmulator()
+{
+  this->Stop();
+}
+
+//-----------------------------------------------------------------------------
+void ImpairmentEmulator::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int ImpairmentEmulator::Configure(const char * spec)
+{
+  std::stringstream ss(spec);
+  std::string token;
+  while (std::getline(ss, token, ','))
+    {
+    size_t eq = token.find('=');
+    if (eq == std::string::npos)
+      {
+      std::cerr << "ERROR: invalid impairment parameter: " << token << std::endl;
+      return 0;
+      }
+    std::string key   = token.substr(0, eq);
+    std::string value = token.substr(eq + 1);
+    char * end;
+    double v = strtod(value.c_str(), &end);
+    bool number = (!value.empty() && *end == '\0');
+
+    if (key == "dist")
+      {
+      if (value == "uniform")
+        {
+        this->Distribution = DIST_UNIFORM;
+        }
+      else if (value == "normal")
+        {
+        this->Distribution = DIST_NORMAL;
+        }
+      else if (value == "pareto")
+        {
+        this->Distribution = DIST_PARETO;
+        }
+      else
+        {
+        std::cerr << "ERROR: unknown jitter distribution: " << value << std::endl;
+        return 0;
+        }
+      }
+    else if (!number || v < 0.0)
+      {
+      std::cerr << "ERROR: invalid impairment parameter: " << token << std::endl;
+      return 0;
+      }
+    else if (key == "delay")
+      {
+      this->Delay = (igtlInt64) (v * 1.0e6);
+      }
+    else if (key == "jitter")
+      {
+      this->Jitter = (igtlInt64) (v * 1.0e6);
+      }
+    else if (key == "rate")
+      {
+      this->Rate = v * 1000.0 / 8.0;
+      }
+    else if (key == "drop" && v <= 1.0)
+      {
+      this->DropProbability = v;
+      }
+    else if (key == "reorder" && v <= 1.0)
+      {
+      this->ReorderProbability = v;
+      }
+    else if (key == "limit")
+      {
+      this->Limit = (int) v;
+      }
+    else if (key == "seed")
+      {
+      this->Random.seed((unsigned int) v);
+      }
+    else
+      {
+      std::cerr << "ERROR: invalid impairment parameter: " << token << std::endl;
+      return 0;
+      }
+    }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 ImpairmentEmulator::Now()
+{
+  return igtl::Clock::Ticks() - this->StartTime;
+}
+
+//-----------------------------------------------------------------------------
+int ImpairmentEmulator::Start()
+{
+  if (!this->transport && this->queue.IsNull())
+    {
+    std::cerr << "ERROR: no output" << std::endl;
+    return 0;
+    }
+  if (this->Running)
+    {
+    return 0;
+    }
+  this->StartTime   = 0;
+  this->StartTime   = this->Now();
+  this->CurrentTick = 0;
+  this->Running = 1;
+  this->ThreadID = this->Threader->SpawnThread((igtl::ThreadFunctionType) &ImpairmentEmulator::TimerThreadFunction, this);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void ImpairmentEmulator::Stop()
+{
+  this->Mutex.lock();
+  if (!this->Running)
+    {
+    this->Mutex.unlock();
+    return;
+    }
+  this->Running = 0;
+  this->Ready.notify_all();
+  this->Mutex.unlock();
+
+  this->Threader->TerminateThread(this->ThreadID);
+  this->ThreadID = -1;
+
+  for (int i = 0; i < WHEEL_SIZE; i ++)
+    {
+    this->Wheel[i].clear();
+    }
+  this->Pending = 0;
+  if (this->memoryBudget.IsNotNull())
+    {
+    this->memoryBudget->Release(this->HeldBytes);
+    }
+  this->HeldBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 ImpairmentEmulator::SampleDelay()
+{
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  double jitter = 0.0;
+  if (this->Jitter > 0)
+    {
+    switch (this->Distribution)
+      {
+      case DIST_NORMAL:
+        {
+        std::normal_distribution<double> normal(0.0, 1.0);
+        jitter = normal(this->Random) * this->Jitter;
+        break;
+        }
+      case DIST_PARETO:
+        jitter = (pow(1.0 - uniform(this->Random), -1.0 / PARETO_ALPHA) - 1.0) * this->Jitter;
+        break;
+      default:
+        jitter = (2.0 * uniform(this->Random) - 1.0) * this->Jitter;
+        break;
+      }
+    }
+  igtlInt64 delay = this->Delay + (igtlInt64) jitter;
+  return (delay > 0) ? delay : 0;
+}
+
+//-----------------------------------------------------------------------------
+int ImpairmentEmulator::Send(igtl::MessageBase * msg, int priority)
+{
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  igtlInt64 now = this->Now();
+
+  this->Mutex.lock();
+  if (this->Closed || !this->Running)
+    {
+    this->Mutex.unlock();
+    return 0;
+    }
+
+  if ((this->DropProbability > 0.0 && uniform(this->Random) < this->DropProbability) ||
+      this->Pending >= this->Limit)
+    {
+    this->Dropped ++;
+    this->Mutex.unlock();
+    return 1;
+    }
+
+  if (this->ReorderProbability > 0.0 && uniform(this->Random) < this->ReorderProbability)
+    {
+    this->Reordered ++;
+    this->Mutex.unlock();
+    return this->Output(msg, priority);
+    }
+
+  // The message is transmitted after the previous one at the capped rate
+  // and then delayed.
+  igtlInt64 start = (now > this->LinkFree) ? now : this->LinkFree;
+  this->LinkFree = start;
+  if (this->Rate > 0.0)
+    {
+    this->LinkFree += (igtlInt64) ((double) msg->GetPackSize() * 1.0e9 / this->Rate);
+    }
+  igtlInt64 due = this->LinkFree + this->SampleDelay();
+  if (due < this->LastDue)
+    {
+    due = this->LastDue;
+    }
+  this->LastDue = due;
+
+  Timer timer;
+  timer.msg      = msg;
+  timer.priority = priority;
+  timer.tick     = due / TICK;
+  if (timer.tick <= this->CurrentTick)
+    {
+    timer.tick = this->CurrentTick + 1;
+    }
+  this->Wheel[timer.tick % WHEEL_SIZE].push_back(timer);
+  this->Pending ++;
+  this->HeldBytes += msg->GetPackSize();
+  if (this->memoryBudget.IsNotNull())
+    {
+    this->memoryBudget->Charge(msg->GetPackSize());
+    }
+  // The timer thread is woken only if the message is due before it would
+  // wake anyway.
+  if (timer.tick < this->WakeTick)
+    {
+    this->Ready.notify_one();
+    }
+  this->Mutex.unlock();
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int ImpairmentEmulator::Output(igtl::MessageBase * msg, int priority)
+{
+  int r;
+  if (this->queue.IsNotNull())
+    {
+    r = this->queue->Send(msg, priority);
+    }
+  else
+    {
+    this->lock->Lock();
+    r = this->transport->Send(msg->GetPackPointer(), msg->GetPackSize());
+    this->lock->Unlock();
+    }
+  if (!r)
+    {
+    this->Mutex.lock();
+    this->Closed = 1;
+    this->Mutex.unlock();
+    }
+  return r;
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 ImpairmentEmulator::NextDueTick()
+{
+  // Called with 'Mutex' held. Timers of later rounds are found when the
+  // wheel comes around.
+  for (igtlInt64 tick = this->CurrentTick + 1; tick <= this->CurrentTick + WHEEL_SIZE; tick ++)
+    {
+    const std::vector<Timer> & slot = this->Wheel[tick % WHEEL_SIZE];
+    for (size_t i = 0; i < slot.size(); i ++)
+      {
+      if (slot[i].tick == tick)
+        {
+        return tick;
+        }
+      }
+    }
+  return this->CurrentTick + WHEEL_SIZE;
+}
+
+//-----------------------------------------------------------------------------
+void ImpairmentEmulator::TimerThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  ImpairmentEmulator * em = static_cast<ImpairmentEmulator *>(info->UserData);
+
+  std::vector<Timer> due;
+
+  std::unique_lock<std::mutex> guard(em->Mutex);
+  while (em->Running)
+    {
+    if (em->Pending == 0)
+      {
+      em->WakeTick = std::numeric_limits<igtlInt64>::max();
+      em->Ready.wait(guard);
+      // Nothing was scheduled while idle; skip the empty slots.
+      igtlInt64 idle = em->Now() / TICK - 1;
+      if (em->Pending == 0 && idle > em->CurrentTick)
+        {
+        em->CurrentTick = idle;
+        }
+      continue;
+      }
+
+    igtlInt64 nowTick = em->Now() / TICK;
+    while (em->CurrentTick < nowTick)
+      {
+      em->CurrentTick ++;
+      std::vector<Timer> & slot = em->Wheel[em->CurrentTick % WHEEL_SIZE];
+      size_t kept = 0;
+      for (size_t i = 0; i < slot.size(); i ++)
+        {
+        if (slot[i].tick <= em->CurrentTick)
+          {
+          due.push_back(slot[i]);
+          }
+        else
+          {
+          slot[kept ++] = slot[i];
+          }
+        }
+      slot.resize(kept);
+      }
+
+    if (due.empty())
+      {
+      // Sleep until the next timer is due or an earlier one is scheduled.
+      em->WakeTick = em->NextDueTick();
+      igtlInt64 wait = em->WakeTick * TICK - em->Now();
+      if (wait > 0)
+        {
+        em->Ready.wait_for(guard, std::chrono::nanoseconds(wait));
+        }
+      continue;
+      }
+
+    em->Pending -= (int) due.size();
+    guard.unlock();
+    igtlUint64 sent = 0;
+    for (size_t i = 0; i < due.size(); i ++)
+      {
+      em->Output(due[i].msg, due[i].priority);
+      sent += due[i].msg->GetPackSize();
+      }
+    due.clear();
+    guard.lock();
+    // Released after the output, which charges its own budget if queued.
+    if (em->HeldBytes >= sent)
+      {
+      em->HeldBytes -= sent;
+      if (em->memoryBudget.IsNotNull())
+        {
+        em->memoryBudget->Release(sent);
+        }
+      }
+    }
+}
+
+} // End of igtl namespace
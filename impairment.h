@@ -0,0 +1,163 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMessageBase.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "transport.h"
+#include "sendqueue.h"
+#include "budget.h"
+
+namespace igtl
+{
+
+// ImpairmentEmulator emulates a bad network for the messages of one
+// direction: a fixed delay plus jitter, a bandwidth cap, and random drops
+// and reordering, similar to netem but without root access. Each message
+// is scheduled on a timer wheel with 1 ms slots and sent to the output
+// when it is due, so that many delayed messages cost one slot entry each.
+//
+// The parameters are given as a comma-separated list, e.g.
+//   "delay=80,jitter=20,dist=normal,rate=2000,drop=0.01,reorder=0.005"
+//
+//   delay=<ms>     Fixed delay
+//   jitter=<ms>    Jitter added to the delay
+//   dist=<name>    Jitter distribution: uniform (+/- jitter; default),
+//                  normal (standard deviation jitter), or pareto (extra
+//                  delay with a heavy tail; scale jitter)
+//   rate=<kbit/s>  Bandwidth cap (0: no cap)
+//   drop=<p>       Probability of dropping a message
+//   reorder=<p>    Probability of sending a message at once, ahead of the
+//                  delayed ones. Otherwise the order is kept.
+//   limit=<n>      # of messages held before new ones are dropped
+//                  (default: 10000)
+//   seed=<n>       Seed of the random numbers
+//
+class IGTLCommon_EXPORT ImpairmentEmulator : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::ImpairmentEmulator, igtl::Object)
+  igtlNewMacro(igtl::ImpairmentEmulator);
+
+  enum {
+    DIST_UNIFORM,
+    DIST_NORMAL,
+    DIST_PARETO
+  };
+
+public:
+
+  virtual const char * GetClassName() { return "ImpairmentEmulator"; };
+
+  // Parses the parameters. Returns 0 if 'spec' is invalid.
+  int  Configure(const char * spec);
+
+  // Messages are sent through 'queue' if not NULL; otherwise to
+  // 'transport' while holding 'lock'.
+  void SetOutput(igtl::Transport * transport, igtl::MutexLock * lock, igtl::SendQueue * queue)
+  {
+    this->transport = transport;
+    this->lock      = lock;
+    this->queue     = queue;
+  };
+
+  // Delayed messages are charged to 'budget' until they are sent.
+  void SetMemoryBudget(igtl::MemoryBudget * budget) { this->memoryBudget = budget; };
+
+  int  Start();
+  void Stop();
+
+  // Schedules a packed message. The message must not be modified
+  // afterwards. Returns 0 if the output has been closed.
+  int  Send(igtl::MessageBase * msg, int priority = -1);
+
+  igtlUint64 GetDropped()   { return this->Dropped; };
+  igtlUint64 GetReordered() { return this->Reordered; };
+
+protected:
+
+  ImpairmentEmulator();
+  ~ImpairmentEmulator();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    igtl::MessageBase::Pointer msg;
+    int                        priority;
+    igtlInt64                  tick;     // Due time in ticks
+  } Timer;
+
+  igtlInt64      Now();                  // ns since Start()
+  igtlInt64      NextDueTick();
+  igtlInt64      SampleDelay();          // ns
+  int            Output(igtl::MessageBase * msg, int priority);
+
+  static void    TimerThreadFunction(void * ptr);
+
+protected:
+
+  // Parameters
+  igtlInt64      Delay;                  // ns
+  igtlInt64      Jitter;                 // ns
+  int            Distribution;
+  double         Rate;                   // bytes/s (0: no cap)
+  double         DropProbability;
+  double         ReorderProbability;
+  int            Limit;
+
+  igtl::Transport::Pointer transport;
+  igtl::MutexLock::Pointer lock;
+  igtl::SendQueue::Pointer queue;
+
+  igtl::MemoryBudget::Pointer memoryBudget;
+  igtlUint64     HeldBytes;              // Bytes of the scheduled messages
+
+  std::mt19937   Random;
+
+  // Timer wheel; slot i holds the timers due at ticks equal to i modulo
+  // the wheel size, including those of later rounds. The standard
+  // condition variable is used for its timed wait.
+  std::mutex              Mutex;
+  std::condition_variable Ready;
+  std::vector< std::vector<Timer> > Wheel;
+  igtlInt64      CurrentTick;            // Ticks up to this one have been sent
+  igtlInt64      WakeTick;               // The timer thread sleeps until this tick
+  int            Pending;
+  igtlInt64      LastDue;                // ns; keeps the order
+  igtlInt64      LinkFree;               // ns; end of the transmission of the last message
+
+  igtlInt64      StartTime;              // ns
+  igtlUint64     Dropped;
+  igtlUint64     Reordered;
+  int            Closed;
+
+  int                          Running;
+  igtl::MultiThreader::Pointer Threader;
+  int                          ThreadID;
+
+};
+
+}
+
+#endif // IMPAIRMENT_H
@@ -16,6 +16,7 @@
 
 
 #include <string.h>
+#include <algorithm>
 
 #include "logger.h"
 
@@ -29,20 +30,122 @@ namespace igtl
 Logger::Logger()
 {
   this->Mutex = igtl::MutexLock::New();
+  this->Ready = igtl::ConditionVariable::New();
+  this->MaximumBufferSize = 64 * 1024 * 1024;
+  this->DroppedBytes = 0;
+  this->DroppedLines = 0;
+  this->Running  = 0;
+  this->Threader = igtl::MultiThreader::New();
+  this->ThreadID = -1;
 }
 
 //-----------------------------------------------------------------------------
 Logger::~Logger()
 {
+  this->Stop();
 }
 
 void Logger::Print(const std::string& msg)
 {
+  this->BufferLock.Lock();
+  if (this->Running)
+    {
+    if (this->Buffer.size() + msg.size() > this->MaximumBufferSize)
+      {
+      this->DroppedBytes += msg.size();
+      this->DroppedLines += (igtlUint64) std::count(msg.begin(), msg.end(), '\n');
+      }
+    else
+      {
+      if (this->Buffer.empty())
+        {
+        this->Ready->Signal();
+        }
+      this->Buffer.append(msg);
+      }
+    this->BufferLock.Unlock();
+    return;
+    }
+  this->BufferLock.Unlock();
+
   this->Mutex->Lock();
   std::cout << msg;
   this->Mutex->Unlock();
 }
 
+//-----------------------------------------------------------------------------
+int Logger::Start()
+{
+  if (this->Running)
+    {
+    return 0;
+    }
+  this->Running = 1;
+  this->ThreadID = this->Threader->SpawnThread((igtl::ThreadFunctionType) &Logger::WriterThreadFunction, this);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void Logger::Stop()
+{
+  this->BufferLock.Lock();
+  if (!this->Running)
+    {
+    this->BufferLock.Unlock();
+    return;
+    }
+  this->Running = 0;
+  this->Ready->Signal();
+  this->BufferLock.Unlock();
+
+  // The writer flushes the buffer before it exits.
+  this->Threader->TerminateThread(this->ThreadID);
+  this->ThreadID = -1;
+}
+
+//-----------------------------------------------------------------------------
+void Logger::WriterThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  Logger * logger = static_cast<Logger *>(info->UserData);
+
+  std::string out;
+
+  logger->BufferLock.Lock();
+  while (1)
+    {
+    if (logger->Buffer.empty())
+      {
+      if (!logger->Running)
+        {
+        break;
+        }
+      logger->Ready->Wait(&(logger->BufferLock));
+      continue;
+      }
+    out.swap(logger->Buffer);
+    igtlUint64 dropped = logger->DroppedBytes;
+    igtlUint64 droppedLines = logger->DroppedLines;
+    logger->DroppedBytes = 0;
+    logger->DroppedLines = 0;
+    logger->BufferLock.Unlock();
+
+    logger->Mutex->Lock();
+    std::cout << out;
+    if (dropped > 0)
+      {
+      std::cout << "# LOG dropped " << droppedLines << " lines (" << dropped << " bytes)" << std::endl;
+      }
+    std::cout.flush();
+    logger->Mutex->Unlock();
+    out.clear();
+
+    logger->BufferLock.Lock();
+    }
+  logger->BufferLock.Unlock();
+}
+
 //-----------------------------------------------------------------------------
 void Logger::PrintSelf(std::ostream& os) const
 {
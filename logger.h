@@ -20,10 +20,17 @@
 #include "igtlMultiThreader.h"
 #include "igtlImageMessage.h"
 #include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
 
 namespace igtl
 {
 
+// Logger prints the log to the standard output. By default Print() writes
+// at once. After Start(), Print() appends to a buffer that a writer thread
+// flushes, so that the sessions do not wait for the console; if the writer
+// falls behind by more than 'MaximumBufferSize' bytes, new messages are
+// dropped whole and counted. A message should therefore hold complete
+// lines, so that a drop never merges or truncates a line.
 class IGTLCommon_EXPORT Logger : public Object
 {
 public:
@@ -39,6 +46,11 @@ public:
 
   void Print(const std::string& msg);
 
+  // Starts / stops the writer thread. Stop() flushes the buffer.
+  int  Start();
+  void Stop();
+
+  void SetMaximumBufferSize(size_t size) { this->MaximumBufferSize = size; };
 protected:
 
   Logger();
@@ -46,9 +58,22 @@ protected:
 
   void           PrintSelf(std::ostream& os) const;
 
+  static void    WriterThreadFunction(void * ptr);
+
 protected:
 
   igtl::MutexLock::Pointer Mutex;
+
+  // Asynchronous mode
+  igtl::SimpleMutexLock        BufferLock;
+  igtl::ConditionVariable::Pointer Ready;
+  std::string                  Buffer;
+  size_t                       MaximumBufferSize;
+  igtlUint64                   DroppedBytes;   // Since the last report
+  igtlUint64                   DroppedLines;   // Since the last report
+  int                          Running;
+  igtl::MultiThreader::Pointer Threader;
+  int                          ThreadID;
 };
 
 }
@@ -28,81 +28,824 @@
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include <math.h>
 #include <cstdlib>
 #include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "session.h"
+#include "transport.h"
+#include "queuetransport.h"
+#ifdef IGTLREPEATER_SHARED_MEMORY
+#include "shmtransport.h"
+#endif
+#ifdef IGTLREPEATER_UNIX_SOCKET
+#include "unixtransport.h"
+#endif
+
+#include "router.h"
+#include "clock.h"
+#include "budget.h"
+#include "decoder.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
 
-#include "igtlServerSocket.h"
-#include "igtlClientSocket.h"
 #include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
 #include "igtlOSUtil.h"
 
-int ServerSession(igtl::Socket* serverSocket, const char* dest_hostname, int dest_port, std::vector< std::string > blacklist);
+typedef struct {
+  std::vector< std::string > blacklist;
+  std::string configFile; // Rule file reloaded while running
+  int    imageInterval;   // Keep every Nth IMAGE frame sent to the client
+  double imageRate;       // Maximum IMAGE frame rate sent to the client (0: no limit)
+  int    imageFactor;     // Downsampling factor for IMAGE messages sent to the client
+  igtlUint64 streamThreshold; // Body size above which messages are streamed (0: disabled)
+  std::string sharedMemory; // Name of the shared memory for a local client (empty: TCP)
+  double monitorPeriod;   // Period of the source monitor summary in seconds (0: disabled)
+  double stallThreshold;  // # of expected periods without a message to report a stall
+  int    workers;         // # of worker threads (0: one per core; -1: a thread per session)
+  double keepAlive;       // Suppress repeated messages; forward a copy every <keepAlive> s (0: disabled)
+  double cacheFreshness;  // Answer GET_ queries from replies up to <cacheFreshness> s old (0: disabled)
+  int    starvationLimit; // # of higher-priority messages sent before a waiting lower one (0: no priority lanes)
+  std::string unixSocket; // Socket file for a local client (empty: TCP)
+  std::string destUnixSocket; // Socket file of the destination (empty: TCP)
+  std::vector< std::string > stages; // Rule files of additional relay stages
+  int    tapPort;         // Port # for monitor clients receiving a mirrored copy (0: disabled)
+  std::string tapDirection; // Direction(s) mirrored to the tap: "both", "c2s", or "s2c"
+  std::string impairUp;   // Network impairment parameters for C->S (empty: none)
+  std::string impairDown; // Network impairment parameters for S->C (empty: none)
+  std::vector< std::pair< std::string, int > > upstreams; // Additional upstream servers (host, port)
+  igtl::Router::Pointer router; // Routes to the upstream servers (1, 2, ...; 0: <dest_hostname>)
+  std::vector< std::string > mappings; // Additional "<port> <dest_hostname> <dest_port>" mappings
+  std::string mapFile;    // File listing additional mappings
+  double summaryPeriod;   // Period of the traffic summary replacing the per-message log in seconds (0: disabled)
+  igtlUint64 memoryLimit; // Bytes of messages held per connection (0: no limit)
+  igtlUint64 totalMemoryLimit; // Bytes of messages held for all connections (0: no limit)
+  int    memoryDrop;      // Drop messages instead of pausing reads when a memory limit is reached
+  int    decoders;        // # of threads decoding and logging forwarded messages (0: none; decoded before forwarding)
+} RepeaterOptions;
+
+// rules[0] is for the repeater itself; rules[k] (k > 0) for relay stage k.
+typedef std::vector< igtl::RuleManager::Pointer > RuleManagerList;
+
+// Objects relaying one client connection to the server(s)
+typedef struct {
+  igtl::Transport::Pointer                         clientTransport;
+  std::vector< igtl::Transport::Pointer >          upstreams;
+  std::vector< igtl::QueueTransport::Pointer >     links;
+  std::vector< igtl::Session::Pointer >            sessions;
+  std::vector< igtl::SendQueue::Pointer >          queues;
+  std::vector< igtl::ImpairmentEmulator::Pointer > impairments;
+  std::vector< std::string >                       impairmentNames;
+  igtl::MemoryBudget::Pointer                      memory;
+  std::string                                      label;
+} Relay;
+
+// Relay of a client connection being set up by a thread of its own, so
+// that connecting to the server(s) does not hold up the accept loop.
+typedef struct {
+  igtl::Transport::Pointer       transport;    // Connection from the client
+  std::string                    hostname;
+  int                            destPort;
+  std::string                    label;
+  const RepeaterOptions *        options;
+  igtl::Logger *                 logger;
+  RuleManagerList *              rules;
+  igtl::WorkerPool *             pool;
+  igtl::TrafficTap *             tap;
+  igtl::SourceMonitor *          monitor;
+  igtl::TrafficSummary *         summary;
+  igtl::DecoderPool *            decoders;
+  igtl::MemoryBudget *           memory;
+  int                            threadID;
+  igtl::SimpleMutexLock          lock;
+  int                            done;         // Under 'lock'
+  Relay *                        relay;        // Result; NULL if a server cannot be reached
+} RelaySetup;
+
+// A port of this host relayed to a destination
+typedef struct {
+  int                            port;
+  std::string                    hostname;
+  int                            destPort;
+  std::string                    label;        // Prepended to the directions in the log
+  igtl::SocketTransport::Pointer listener;     // Server socket
+  igtl::SocketTransport::Pointer socket;       // Connection from the client
+  RelaySetup *                   setup;        // Non-NULL: connecting to the server(s)
+  Relay *                        relay;        // NULL: waiting for a client
+} Mapping;
+
+// Connects to the server(s) and starts relaying the client connection
+// 'serverSocket'. 'label' is prepended to the directions in the log.
+// Returns NULL if a server cannot be reached.
+Relay * StartRelay(igtl::Transport* serverSocket, const char* dest_hostname, int dest_port, const RepeaterOptions& options,
+                   const std::string& label, igtl::Logger* logger, RuleManagerList& rules, igtl::WorkerPool* pool,
+                   igtl::TrafficTap* tap, igtl::SourceMonitor* monitor, igtl::TrafficSummary* summary,
+                   igtl::DecoderPool* decoders, igtl::MemoryBudget* memory);
+int  IsRelayActive(Relay* relay);
+void StopRelay(Relay* relay);
+
+// Runs StartRelay() for a RelaySetup.
+static void RelaySetupThreadFunction(void * ptr);
+
+// Relays one client connection until it is closed.
+int ServerSession(igtl::Transport* serverSocket, const char* dest_hostname, int dest_port, const RepeaterOptions& options,
+                  igtl::Logger* logger, RuleManagerList& rules, igtl::WorkerPool* pool, igtl::TrafficTap* tap,
+                  igtl::SourceMonitor* monitor, igtl::TrafficSummary* summary, igtl::DecoderPool* decoders,
+                  igtl::MemoryBudget* memory);
+
+static igtl::Transport::Pointer ConnectToServer(const char* hostname, int port)
+{
+  igtl::SocketTransport::Pointer transport = igtl::SocketTransport::New();
+  if (!transport->Connect(hostname, port))
+    {
+    return NULL;
+    }
+  return transport.GetPointer();
+}
+
+// Release callback of the memory budget of all connections
+static void ResumeMemoryWaiters(void* pool)
+{
+  static_cast<igtl::WorkerPool*>(pool)->ReleaseMemory();
+}
+
+static void CheckRules(RuleManagerList& rules)
+{
+  for (size_t k = 0; k < rules.size(); k ++)
+    {
+    rules[k]->CheckForUpdate();
+    }
+}
+
+static void CheckMonitor(igtl::SourceMonitor* monitor, igtl::TrafficSummary* summary)
+{
+  // Also keeps the time stamps in step with the system clock.
+  igtl::Clock::Synchronize();
+  if (monitor)
+    {
+    monitor->Check(igtl::Clock::Ticks());
+    }
+  if (summary)
+    {
+    summary->Check(igtl::Clock::Ticks());
+    }
+}
+
+// Parses "<port> <dest_hostname> <dest_port>" and appends it to 'mappings'.
+// Returns 0 if the line is invalid.
+static int ParseMapping(const std::string& line, std::vector< Mapping >& mappings)
+{
+  std::istringstream is(line);
+  Mapping m;
+  std::string rest;
+  if (!(is >> m.port >> m.hostname >> m.destPort) || (is >> rest) ||
+      m.port <= 0 || m.destPort <= 0)
+    {
+    return 0;
+    }
+  for (size_t i = 0; i < mappings.size(); i ++)
+    {
+    if (mappings[i].port == m.port)
+      {
+      return 0;
+      }
+    }
+  m.setup = NULL;
+  m.relay = NULL;
+  mappings.push_back(m);
+  return 1;
+}
+
+// Reads one mapping per line; '#' starts a comment.
+static int LoadMappings(const char* fileName, std::vector< Mapping >& mappings)
+{
+  std::ifstream file(fileName);
+  if (!file)
+    {
+    std::cerr << "Cannot open the mapping file: " << fileName << std::endl;
+    return 0;
+    }
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line))
+    {
+    lineNumber ++;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      {
+      line.erase(comment);
+      }
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      {
+      continue;
+      }
+    if (!ParseMapping(line, mappings))
+      {
+      std::cerr << "Invalid mapping at " << fileName << ":" << lineNumber << ": " << line << std::endl;
+      return 0;
+      }
+    }
+  return 1;
+}
+
+// Waits up to 'msec' for clients on the mappings without an active relay.
+// The indices of the mappings with a pending connection are put in 'ready'.
+static void WaitForClients(std::vector< Mapping >& mappings, int msec, std::vector< int >& ready)
+{
+  ready.clear();
+#ifndef _WIN32
+  std::vector< struct pollfd > fds;
+  std::vector< int > polled;
+  for (size_t i = 0; i < mappings.size(); i ++)
+    {
+    if (mappings[i].relay == NULL && mappings[i].setup == NULL)
+      {
+      struct pollfd pfd;
+      pfd.fd      = mappings[i].listener->GetDescriptor();
+      pfd.events  = POLLIN;
+      pfd.revents = 0;
+      fds.push_back(pfd);
+      polled.push_back((int) i);
+      }
+    }
+  if (fds.empty())
+    {
+    igtl::Sleep(msec);
+    return;
+    }
+  if (poll(&fds[0], (nfds_t) fds.size(), msec) <= 0)
+    {
+    return;
+    }
+  for (size_t i = 0; i < fds.size(); i ++)
+    {
+    if (fds[i].revents & POLLIN)
+      {
+      ready.push_back(polled[i]);
+      }
+    }
+#else
+  // No poll() for the server sockets; each one is checked in turn.
+  int idle = 1;
+  for (size_t i = 0; i < mappings.size(); i ++)
+    {
+    if (mappings[i].relay == NULL && mappings[i].setup == NULL)
+      {
+      ready.push_back((int) i);
+      idle = 0;
+      }
+    }
+  if (idle)
+    {
+    igtl::Sleep(msec);
+    }
+#endif
+}
 
 int main(int argc, char* argv[])
 {
   //------------------------------------------------------------
   // Parse Arguments
   //
-  std::vector< std::string > blacklist;
+  RepeaterOptions options;
+  options.imageInterval = 1;
+  options.imageRate     = 0.0;
+  options.imageFactor   = 1;
+  options.streamThreshold = 0;
+  options.monitorPeriod  = 0.0;
+  options.stallThreshold = 5.0;
+  options.workers        = -1;
+  options.starvationLimit = 0;
+  options.keepAlive       = 0.0;
+  options.cacheFreshness  = 0.0;
+  options.tapPort         = 0;
+  options.tapDirection    = "both";
+  options.summaryPeriod   = 0.0;
+  options.memoryLimit     = 256 * 1024 * 1024;
+  options.totalMemoryLimit = 1024 * 1024 * 1024;
+  options.memoryDrop      = 0;
+  options.decoders        = 0;
+  options.router          = igtl::Router::New();
+  bool validRoutes        = true;
   std::vector< std::string > args;
 
   for (int i = 1; i < argc; i ++)
     {
-    if (strcmp(argv[i], "-b") == 0)
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      {
+      options.blacklist.push_back(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      {
+      options.configFile = argv[i+1];
+      i ++;
+      }
+    else if (strcmp(argv[i], "-ik") == 0 && i + 1 < argc)
+      {
+      options.imageInterval = std::stoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-ir") == 0 && i + 1 < argc)
+      {
+      options.imageRate = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-id") == 0 && i + 1 < argc)
       {
-      blacklist.push_back(argv[i+1]);
+      options.imageFactor = std::stoi(argv[i+1]);
       i ++;
       }
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      {
+      options.streamThreshold = std::stoull(argv[i+1]);
+      i ++;
+      }
+#ifdef IGTLREPEATER_SHARED_MEMORY
+    else if (strcmp(argv[i], "-shm") == 0 && i + 1 < argc)
+      {
+      options.sharedMemory = argv[i+1];
+      i ++;
+      }
+#endif
+#ifdef IGTLREPEATER_UNIX_SOCKET
+    else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+      {
+      options.unixSocket = argv[i+1];
+      i ++;
+      }
+    else if (strcmp(argv[i], "-du") == 0 && i + 1 < argc)
+      {
+      options.destUnixSocket = argv[i+1];
+      i ++;
+      }
+#endif
+    else if (strcmp(argv[i], "-stage") == 0 && i + 1 < argc)
+      {
+      options.stages.push_back(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      {
+      options.monitorPeriod = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-sum") == 0 && i + 1 < argc)
+      {
+      options.summaryPeriod = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-mem") == 0 && i + 1 < argc)
+      {
+      options.memoryLimit = std::stoull(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-memall") == 0 && i + 1 < argc)
+      {
+      options.totalMemoryLimit = std::stoull(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-memdrop") == 0)
+      {
+      options.memoryDrop = 1;
+      }
+    else if (strcmp(argv[i], "-ms") == 0 && i + 1 < argc)
+      {
+      options.stallThreshold = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      {
+      options.workers = std::stoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-dec") == 0 && i + 1 < argc)
+      {
+      options.decoders = std::stoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+      {
+      options.starvationLimit = std::stoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-dup") == 0 && i + 1 < argc)
+      {
+      options.keepAlive = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-gc") == 0 && i + 1 < argc)
+      {
+      options.cacheFreshness = std::stod(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-tap") == 0 && i + 1 < argc)
+      {
+      options.tapPort = std::stoi(argv[i+1]);
+      i ++;
+      }
+    else if (strcmp(argv[i], "-tapdir") == 0 && i + 1 < argc)
+      {
+      options.tapDirection = argv[i+1];
+      i ++;
+      }
+    else if (strcmp(argv[i], "-route") == 0 && i + 3 < argc)
+      {
+      // -route type|device <name> <host>:<port>
+      std::string dest = argv[i+3];
+      size_t colon = dest.rfind(':');
+      int kind = (strcmp(argv[i+1], "device") == 0) ? igtl::Router::ROUTE_DEVICE : igtl::Router::ROUTE_TYPE;
+      if ((strcmp(argv[i+1], "type") != 0 && strcmp(argv[i+1], "device") != 0) ||
+          colon == std::string::npos || colon == 0 || colon + 1 == dest.size())
+        {
+        validRoutes = false;
+        }
+      else
+        {
+        std::pair< std::string, int > upstream(dest.substr(0, colon), atoi(dest.c_str() + colon + 1));
+        size_t n = 0;
+        while (n < options.upstreams.size() && options.upstreams[n] != upstream)
+          {
+          n ++;
+          }
+        if (n == options.upstreams.size())
+          {
+          options.upstreams.push_back(upstream);
+          }
+        if (!options.router->AddRoute(kind, argv[i+2], (int) n + 1))
+          {
+          validRoutes = false;
+          }
+        }
+      i += 3;
+      }
+    else if (strcmp(argv[i], "-map") == 0 && i + 3 < argc)
+      {
+      options.mappings.push_back(std::string(argv[i+1]) + " " + argv[i+2] + " " + argv[i+3]);
+      i += 3;
+      }
+    else if (strcmp(argv[i], "-mapfile") == 0 && i + 1 < argc)
+      {
+      options.mapFile = argv[i+1];
+      i ++;
+      }
+    else if (strcmp(argv[i], "-impair") == 0 && i + 2 < argc)
+      {
+      if (strcmp(argv[i+1], "s2c") != 0)
+        {
+        options.impairUp = argv[i+2];
+        }
+      if (strcmp(argv[i+1], "c2s") != 0)
+        {
+        options.impairDown = argv[i+2];
+        }
+      i += 2;
+      }
     else
       {
       args.push_back(argv[i]);
       }
     }
 
-  if (args.size() != 3)
+  // The destination is given by <dest_hostname> <dest_port> unless -du is
+  // given; the local port by <port> unless -shm or -u is given. With -map
+  // or -mapfile, the positional mapping may be omitted.
+  bool tcpDest  = options.destUnixSocket.empty();
+  bool tcpLocal = options.sharedMemory.empty() && options.unixSocket.empty();
+  bool mapped   = !options.mappings.empty() || !options.mapFile.empty();
+  bool validTap = (options.tapDirection == "both" || options.tapDirection == "c2s" || options.tapDirection == "s2c");
+  bool validArgs = (args.size() == (size_t) ((tcpDest ? 2 : 0) + (tcpLocal ? 1 : 0))) ||
+                   (args.empty() && mapped && tcpDest && tcpLocal);
+  if (!validArgs || !validTap || !validRoutes || (mapped && !(tcpDest && tcpLocal)))
     {
     // If not correct, print usage
-    std::cerr << " Usage: " << argv[0] << "[{-b <btype>}...] <dest_hostname> <dest_port> <port>"    << std::endl;
+    std::cerr << " Usage: " << argv[0] << "[{-b <btype>}...] [-c <file>] [-ik <n>] [-ir <fps>] [-id <factor>] [-s <bytes>] [-shm <name>] [-u <path>] [-du <path>] [{-stage <file>}...] [-m <period> [-ms <n>]] [-sum <period>] [-mem <bytes>] [-memall <bytes>] [-memdrop] [-w <n>] [-q <n>] [-dup <sec>] [-gc <sec>] [-tap <port> [-tapdir <dir>]] [{-impair <dir> <params>}...] [{-route type|device <name> <host>:<port>}...] [{-map <port> <dest_hostname> <dest_port>}...] [-mapfile <file>] [<dest_hostname> <dest_port> <port>]"    << std::endl;
     std::cerr << "    <btype>         : A message type to be blocked."                        << std::endl;
+    std::cerr << "    -c <file>       : Rule file, reloaded when modified or on SIGHUP."     << std::endl;
+    std::cerr << "    -ik <n>         : Forward every <n>th IMAGE frame to the client."       << std::endl;
+    std::cerr << "    -ir <fps>       : Maximum IMAGE frame rate per device to the client."   << std::endl;
+    std::cerr << "    -id <factor>    : Downsample IMAGE messages to the client by <factor> (up to 1024)." << std::endl;
+    std::cerr << "    -s <bytes>      : Stream messages with a body larger than <bytes> in chunks." << std::endl;
+    std::cerr << "                    Their CRC is checked only after forwarding; errors are logged as 'CRC error after forwarding'." << std::endl;
+#ifdef IGTLREPEATER_SHARED_MEMORY
+    std::cerr << "    -shm <name>     : Accept a local client through shared memory <name> instead of <port>." << std::endl;
+#endif
+#ifdef IGTLREPEATER_UNIX_SOCKET
+    std::cerr << "    -u <path>       : Accept a local client on Unix-domain socket <path> instead of <port>." << std::endl;
+    std::cerr << "    -du <path>      : Connect to the destination on Unix-domain socket <path> instead of <dest_hostname> <dest_port>." << std::endl;
+#endif
+    std::cerr << "    -stage <file>   : Add a relay stage with rule file <file>, chained in this process toward the server." << std::endl;
+    std::cerr << "    -m <period>     : Monitor jitter and clock skew of each source; summary every <period> s." << std::endl;
+    std::cerr << "    -ms <n>         : Report a stall after no message for <n> expected periods (default: 5)." << std::endl;
+    std::cerr << "    -sum <period>   : Print a table of the traffic every <period> s instead of a line per message." << std::endl;
+    std::cerr << "    -mem <bytes>    : Pause reading a connection holding <bytes> of messages (default: 256 MiB; 0: no limit)." << std::endl;
+    std::cerr << "    -memall <bytes> : Pause reading when all connections hold <bytes> of messages (default: 1 GiB; 0: no limit)." << std::endl;
+    std::cerr << "    -memdrop        : Drop messages instead of pausing when a memory limit is reached." << std::endl;
+    std::cerr << "    -w <n>          : Process sessions with <n> worker threads (0: one per core; default -1: a thread per session); up to <n> more start while workers are blocked." << std::endl;
+    std::cerr << "    -dec <n>        : Forward messages before decoding them; decode and log with <n> threads." << std::endl;
+    std::cerr << "    -q <n>          : Send pose/control messages ahead of images; a waiting image after <n> of them (default: 0, in order)." << std::endl;
+    std::cerr << "    -dup <sec>      : Suppress unchanged repeated messages; forward one every <sec> s as a keep-alive." << std::endl;
+    std::cerr << "    -gc <sec>       : Answer GET_CAPABIL/STATUS/TRANSFORM from server replies up to <sec> s old." << std::endl;
+    std::cerr << "    -tap <port>     : Mirror forwarded messages to monitor clients connected to <port>." << std::endl;
+    std::cerr << "    -tapdir <dir>   : Direction mirrored to the tap: both, c2s, or s2c (default: both)." << std::endl;
+    std::cerr << "    -impair <dir> <params> : Emulate a bad network in direction both, c2s, or s2c;" << std::endl;
+    std::cerr << "                    <params> as in delay=<ms>,jitter=<ms>,dist=normal,rate=<kbit/s>,drop=<p>,reorder=<p>" << std::endl;
+    std::cerr << "    -route type|device <name> <host>:<port> : Send client messages of type/device <name> to another server." << std::endl;
+    std::cerr << "    -map <port> <dest_hostname> <dest_port> : Also relay <port> of this host to <dest_hostname>:<dest_port>." << std::endl;
+    std::cerr << "    -mapfile <file> : Also relay the mappings in <file>, one '<port> <dest_hostname> <dest_port>' per line." << std::endl;
     std::cerr << "    <dest_hostname> : IP or hostname of the destination host"                    << std::endl;
     std::cerr << "    <dest_port>     : Port # of the destination host (18944 in Slicer default)"   << std::endl;
     std::cerr << "    <port>          : Port # of this host (18944 in default)"   << std::endl;
     exit(0);
     }
 
-  std::string  dest_hostname = args[0];
-  int    dest_port     = std::stoi(args[1]);
-  int    port          = std::stoi(args[2]);
+#if defined(IGTLREPEATER_SHARED_MEMORY) || defined(IGTLREPEATER_UNIX_SOCKET)
+  std::string  dest_hostname = (tcpDest && !args.empty()) ? args[0] : "";
+  int    dest_port     = (tcpDest && !args.empty()) ? std::stoi(args[1]) : 0;
+#endif
+  int    port          = (tcpLocal && !args.empty()) ? std::stoi(args[args.size() - 1]) : 0;
+
+  // Time stamps of the messages are taken from the TSC if possible.
+  igtl::Clock::Initialize();
+
+  // Messages are written to the console by a thread of the logger.
+  igtl::Logger::Pointer logger = igtl::Logger::New();
+  logger->Start();
+
+  // Filter rules can be reloaded without restarting the repeater.
+  RuleManagerList rules;
+  rules.push_back(igtl::RuleManager::New());
+  rules[0]->SetLogger(logger);
+  rules[0]->SetBaseBlackList(options.blacklist);
+  rules[0]->SetFileName(options.configFile.c_str());
+  for (size_t k = 0; k < options.stages.size(); k ++)
+    {
+    rules.push_back(igtl::RuleManager::New());
+    rules.back()->SetLogger(logger);
+    rules.back()->SetFileName(options.stages[k].c_str());
+    }
+  for (size_t k = 0; k < rules.size(); k ++)
+    {
+    if (!rules[k]->Load())
+      {
+      std::cerr << "Cannot load the rule file." << std::endl;
+      exit(0);
+      }
+    }
+  igtl::RuleManager::InstallSignalHandler();
+
+  // Checks the impairment parameters before accepting a client.
+  const std::string * impairments[2] = { &options.impairUp, &options.impairDown };
+  for (int i = 0; i < 2; i ++)
+    {
+    if (!impairments[i]->empty() &&
+        !igtl::ImpairmentEmulator::New()->Configure(impairments[i]->c_str()))
+      {
+      std::cerr << "Invalid impairment parameters." << std::endl;
+      exit(0);
+      }
+    }
+
+  // Streamed messages are forwarded while they are received and cannot be
+  // held by the emulator.
+  if (options.streamThreshold > 0 && (!options.impairUp.empty() || !options.impairDown.empty()))
+    {
+    std::cerr << "-s cannot be used with -impair." << std::endl;
+    exit(0);
+    }
+
+  // Sessions share a fixed set of worker threads.
+  igtl::WorkerPool::Pointer pool;
+  if (options.workers >= 0)
+    {
+    pool = igtl::WorkerPool::New();
+    if (!pool->Start(options.workers))
+      {
+      pool = NULL;
+      }
+    }
+
+  // Messages are decoded and logged after they have been forwarded.
+  igtl::DecoderPool::Pointer decoders;
+  if (options.decoders > 0)
+    {
+    decoders = igtl::DecoderPool::New();
+    decoders->SetLogger(logger);
+    decoders->Start(options.decoders);
+    }
+
+  // Monitor clients receive a copy of the traffic without joining the chain.
+  igtl::TrafficTap::Pointer tap;
+  if (options.tapPort > 0)
+    {
+    tap = igtl::TrafficTap::New();
+    if (!tap->Start(options.tapPort))
+      {
+      std::cerr << "Cannot create a tap socket." << std::endl;
+      exit(0);
+      }
+    }
+
+  // Jitter and clock skew of the sources of all connections
+  igtl::SourceMonitor::Pointer monitor;
+  if (options.monitorPeriod > 0.0)
+    {
+    monitor = igtl::SourceMonitor::New();
+    monitor->SetLogger(logger);
+    monitor->SetSummaryPeriod(options.monitorPeriod);
+    monitor->SetStallThreshold(options.stallThreshold);
+    }
+
+  // Per-message log lines replaced by a periodic table
+  igtl::TrafficSummary::Pointer summary;
+  if (options.summaryPeriod > 0.0)
+    {
+    summary = igtl::TrafficSummary::New();
+    summary->SetLogger(logger);
+    summary->SetPeriod(options.summaryPeriod);
+    }
 
-  // Start a server to wait for connection from the client.
-  igtl::ServerSocket::Pointer serverSocket;
-  serverSocket = igtl::ServerSocket::New();
-  int r = serverSocket->CreateServer(port);
+  // Messages held by all connections
+  igtl::MemoryBudget::Pointer memory = igtl::MemoryBudget::New();
+  memory->SetLimit(options.totalMemoryLimit);
+  if (pool.IsNotNull())
+    {
+    // Sessions of the pool waiting for memory are resumed when it is released.
+    memory->SetReleaseCallback(&ResumeMemoryWaiters, pool.GetPointer());
+    }
 
-  if (r < 0)
+#ifdef IGTLREPEATER_SHARED_MEMORY
+  // A client on the same host attaches to the shared memory.
+  if (!options.sharedMemory.empty())
     {
-    std::cerr << "Cannot create a server socket." << std::endl;
+    const igtlUint64 ringSize = 32 * 1024 * 1024;
+    while (1)
+      {
+      igtl::SharedMemoryTransport::Pointer shm = igtl::SharedMemoryTransport::New();
+      if (!shm->Create(options.sharedMemory.c_str(), ringSize))
+        {
+        std::cerr << "Cannot create a shared memory." << std::endl;
+        exit(0);
+        }
+      while (!shm->WaitForAttach(1000))
+        {
+        CheckRules(rules);
+        CheckMonitor(monitor, summary);
+        }
+      ServerSession(shm, dest_hostname.c_str(), dest_port, options, logger, rules, pool, tap, monitor, summary, decoders, memory);
+      std::cerr << "Closing the shared memory." << std::endl;
+      shm->Close();
+      }
+    }
+#endif
+
+#ifdef IGTLREPEATER_UNIX_SOCKET
+  // A client on the same host connects to the socket file.
+  if (!options.unixSocket.empty())
+    {
+    igtl::UnixSocketTransport::Pointer listener = igtl::UnixSocketTransport::New();
+    if (!listener->Listen(options.unixSocket.c_str()))
+      {
+      std::cerr << "Cannot create a Unix-domain socket." << std::endl;
+      exit(0);
+      }
+    while (1)
+      {
+      igtl::UnixSocketTransport::Pointer transport = listener->Accept(1000);
+      CheckRules(rules);
+      CheckMonitor(monitor, summary);
+      if (transport.IsNotNull())
+        {
+        ServerSession(transport, dest_hostname.c_str(), dest_port, options, logger, rules, pool, tap, monitor, summary, decoders, memory);
+        std::cerr << "Closing the Unix-domain socket." << std::endl;
+        transport->Close();
+        }
+      }
+    }
+#endif
+
+  // Ports of this host relayed to the destinations
+  std::vector< Mapping > mappings;
+  if (!args.empty() && !ParseMapping(args[2] + " " + args[0] + " " + args[1], mappings))
+    {
+    std::cerr << "Invalid port: " << port << std::endl;
+    exit(0);
+    }
+  for (size_t i = 0; i < options.mappings.size(); i ++)
+    {
+    if (!ParseMapping(options.mappings[i], mappings))
+      {
+      std::cerr << "Invalid mapping: " << options.mappings[i] << std::endl;
+      exit(0);
+      }
+    }
+  if (!options.mapFile.empty() && !LoadMappings(options.mapFile.c_str(), mappings))
+    {
+    exit(0);
+    }
+  if (mappings.empty())
+    {
+    std::cerr << "No mapping is given." << std::endl;
     exit(0);
     }
 
-  igtl::Socket::Pointer socket;
+  for (size_t i = 0; i < mappings.size(); i ++)
+    {
+    // Start a server to wait for connection from the client.
+    mappings[i].listener = igtl::SocketTransport::New();
+    if (!mappings[i].listener->Listen(mappings[i].port))
+      {
+      std::cerr << "Cannot create a server socket on port " << mappings[i].port << "." << std::endl;
+      exit(0);
+      }
 
+    // The directions in the log show the port if there are several mappings.
+    if (mappings.size() > 1)
+      {
+      std::stringstream label;
+      label << mappings[i].port << ":";
+      mappings[i].label = label.str();
+      }
+    }
+
+  // This thread accepts the clients of all mappings, which share the worker
+  // threads, the logger, the monitor, and the tap. The relays are set up by
+  // threads of their own.
+  igtl::MultiThreader::Pointer threader = igtl::MultiThreader::New();
+  std::vector< int > ready;
   while (1)
     {
     //------------------------------------------------------------
     // Waiting for Connection
-    socket = serverSocket->WaitForConnection(1000);
+    WaitForClients(mappings, 500, ready);
+    CheckRules(rules);
+    CheckMonitor(monitor, summary);
 
-    if (socket.IsNotNull()) // if client connected
+    for (size_t i = 0; i < ready.size(); i ++)
       {
-      ServerSession(socket, dest_hostname.c_str(), dest_port, blacklist);
-      //------------------------------------------------------------
-      // Close connection (The example code never reaches to this section ...)
-      std::cerr << "Closing the server socket." << std::endl;
-      socket->CloseSocket();
+      Mapping & m = mappings[ready[i]];
+      igtl::SocketTransport::Pointer transport = m.listener->Accept(1);
+      if (transport.IsNotNull()) // if client connected
+        {
+        RelaySetup * setup = new RelaySetup;
+        setup->transport = transport.GetPointer();
+        setup->hostname  = m.hostname;
+        setup->destPort  = m.destPort;
+        setup->label     = m.label;
+        setup->options   = &options;
+        setup->logger    = logger;
+        setup->rules     = &rules;
+        setup->pool      = pool;
+        setup->tap       = tap;
+        setup->monitor   = monitor;
+        setup->summary   = summary;
+        setup->decoders  = decoders;
+        setup->memory    = memory;
+        setup->done      = 0;
+        setup->relay     = NULL;
+        m.socket = transport;
+        m.setup  = setup;
+        setup->threadID = threader->SpawnThread((igtl::ThreadFunctionType) &RelaySetupThreadFunction, setup);
+        }
+      }
+
+    for (size_t i = 0; i < mappings.size(); i ++)
+      {
+      Mapping & m = mappings[i];
+      if (m.setup)
+        {
+        m.setup->lock.Lock();
+        int done = m.setup->done;
+        m.setup->lock.Unlock();
+        if (!done)
+          {
+          continue;
+          }
+        threader->TerminateThread(m.setup->threadID);
+        m.relay = m.setup->relay;
+        delete m.setup;
+        m.setup = NULL;
+        if (!m.relay)
+          {
+          m.socket->Close();
+          m.socket = NULL;
+          }
+        }
+      if (m.relay && !IsRelayActive(m.relay))
+        {
+        StopRelay(m.relay);
+        m.relay = NULL;
+        std::cerr << "Closing the server socket." << std::endl;
+        m.socket->Close();
+        m.socket = NULL;
+        }
       }
     }
 
@@ -110,59 +853,430 @@ int main(int argc, char* argv[])
 
 }
 
-int ServerSession(igtl::Socket* serverSocket, const char* dest_hostname, int dest_port, std::vector< std::string > blacklist)
+Relay * StartRelay(igtl::Transport* serverSocket, const char* dest_hostname, int dest_port, const RepeaterOptions& options,
+                   const std::string& label, igtl::Logger* logger, RuleManagerList& rules, igtl::WorkerPool* pool,
+                   igtl::TrafficTap* tap, igtl::SourceMonitor* monitor, igtl::TrafficSummary* summary,
+                   igtl::DecoderPool* decoders, igtl::MemoryBudget* memory)
 {
   //------------------------------------------------------------
   // Establish Connection
 
-  igtl::ClientSocket::Pointer clientSocket;
-  clientSocket = igtl::ClientSocket::New();
-  int r = clientSocket->ConnectToServer(dest_hostname, dest_port);
+  igtl::Transport::Pointer clientTransport;
+#ifdef IGTLREPEATER_UNIX_SOCKET
+  if (!options.destUnixSocket.empty())
+    {
+    igtl::UnixSocketTransport::Pointer transport = igtl::UnixSocketTransport::New();
+    if (!transport->Connect(options.destUnixSocket.c_str()))
+      {
+      std::cerr << "Cannot connect to the server." << std::endl;
+      return NULL;
+      }
+    clientTransport = transport.GetPointer();
+    }
+  else
+#endif
+    {
+    clientTransport = ConnectToServer(dest_hostname, dest_port);
+    if (clientTransport.IsNull())
+      {
+      std::cerr << "Cannot connect to the server." << std::endl;
+      return NULL;
+      }
+    }
+
+  // Additional servers receive the messages routed to them.
+  std::vector< igtl::Transport::Pointer > upstreams;
+  for (size_t i = 0; i < options.upstreams.size(); i ++)
+    {
+    igtl::Transport::Pointer upstream = ConnectToServer(options.upstreams[i].first.c_str(), options.upstreams[i].second);
+    if (upstream.IsNull())
+      {
+      std::cerr << "Cannot connect to the server " << options.upstreams[i].first << ":"
+                << options.upstreams[i].second << "." << std::endl;
+      for (size_t j = 0; j < upstreams.size(); j ++)
+        {
+        upstreams[j]->Close();
+        }
+      clientTransport->Close();
+      return NULL;
+      }
+    upstreams.push_back(upstream);
+    }
 
-  if (r != 0)
+  // Relay stages run in this process from the client side (stage 0, the
+  // repeater itself) to the server side, each with its own rules. Adjacent
+  // stages are connected by in-process queues.
+  //
+  //   client -- [stage 0] == [stage 1] == ... == [stage N] -- server
+  //
+  int nStages = (int) rules.size();
+  std::vector< igtl::Transport::Pointer > clientEnds(nStages);
+  std::vector< igtl::Transport::Pointer > serverEnds(nStages);
+  std::vector< igtl::QueueTransport::Pointer > links;
+  clientEnds[0] = serverSocket;
+  serverEnds[nStages - 1] = clientTransport;
+  for (int k = 0; k < nStages - 1; k ++)
     {
-    std::cerr << "Cannot connect to the server." << std::endl;
-    return 0;
+    igtl::QueueTransport::Pointer a;
+    igtl::QueueTransport::Pointer b;
+    igtl::QueueTransport::CreatePair(a, b);
+    serverEnds[k]     = a.GetPointer();
+    clientEnds[k + 1] = b.GetPointer();
+    links.push_back(a);
+    links.push_back(b);
     }
 
-  igtl::Session::Pointer sessionUp = igtl::Session::New();
-  igtl::Session::Pointer sessionDown = igtl::Session::New();
-  igtl::MutexLock::Pointer clientLock = igtl::MutexLock::New();
-  igtl::MutexLock::Pointer serverLock = igtl::MutexLock::New();
+  std::vector< igtl::Session::Pointer > sessionsUp(nStages);
+  std::vector< igtl::Session::Pointer > sessionsDown(nStages);
+  std::vector< igtl::MutexLock::Pointer > clientLocks(nStages);
+  std::vector< igtl::MutexLock::Pointer > serverLocks(nStages);
+  for (int k = 0; k < nStages; k ++)
+    {
+    igtl::MutexLock::Pointer clientLock = igtl::MutexLock::New();
+    igtl::MutexLock::Pointer serverLock = igtl::MutexLock::New();
+    clientLocks[k] = clientLock;
+    serverLocks[k] = serverLock;
 
-  igtl::Logger::Pointer logger = igtl::Logger::New();
+    std::stringstream suffix;
+    if (k > 0)
+      {
+      suffix << "/" << k;
+      }
 
-  // Note that 'clientSocket' is connected to the server host,
-  // and 'serverSocket' is waiting for connection from the client host.
-  sessionDown->SetSockets(clientSocket, serverSocket);
-  sessionDown->SetMutexLocks(clientLock, serverLock);
-  sessionDown->SetBlackList(blacklist);
-  sessionDown->SetLogger(logger);
-  sessionDown->SetName("S->C");
+    // Note that 'serverEnds' are toward the server host,
+    // and 'clientEnds' are toward the client host.
+    sessionsDown[k] = igtl::Session::New();
+    sessionsDown[k]->SetSockets(serverEnds[k], clientEnds[k]);
+    sessionsDown[k]->SetMutexLocks(serverLock, clientLock);
+    sessionsDown[k]->SetRuleManager(rules[k]);
+    sessionsDown[k]->SetLogger(logger);
+    sessionsDown[k]->SetStreamingThreshold(options.streamThreshold);
+    sessionsDown[k]->SetName((label + "S->C" + suffix.str()).c_str());
 
-  sessionUp->SetSockets(serverSocket, clientSocket);
-  sessionUp->SetMutexLocks(serverLock, clientLock);
-  sessionUp->SetBlackList(blacklist);
-  sessionUp->SetLogger(logger);
-  sessionUp->SetName("C->S");
+    sessionsUp[k] = igtl::Session::New();
+    sessionsUp[k]->SetSockets(clientEnds[k], serverEnds[k]);
+    sessionsUp[k]->SetMutexLocks(clientLock, serverLock);
+    sessionsUp[k]->SetRuleManager(rules[k]);
+    sessionsUp[k]->SetLogger(logger);
+    sessionsUp[k]->SetStreamingThreshold(options.streamThreshold);
+    sessionsUp[k]->SetName((label + "C->S" + suffix.str()).c_str());
+    }
 
-  sessionUp->Start();
-  sessionDown->Start();
+  // The last stage routes the messages to the servers. The replies from
+  // the additional servers are merged with those from the default server
+  // in the order they arrive.
+  igtl::Session::Pointer sessionRoute = sessionsUp[nStages - 1];
+  std::vector< igtl::Session::Pointer > sessionsReply;
+  std::vector< igtl::MutexLock::Pointer > upstreamLocks;
+  for (size_t i = 0; i < upstreams.size(); i ++)
+    {
+    upstreamLocks.push_back(igtl::MutexLock::New());
 
-  // Monitor
-  while(sessionUp->IsActive() && sessionDown->IsActive())
+    std::stringstream name;
+    name << label << "S" << i + 1 << "->C";
+    if (nStages > 1)
+      {
+      name << "/" << nStages - 1;
+      }
+
+    igtl::Session::Pointer session = igtl::Session::New();
+    session->SetSockets(upstreams[i], clientEnds[nStages - 1]);
+    session->SetMutexLocks(upstreamLocks[i], clientLocks[nStages - 1]);
+    session->SetRuleManager(rules[nStages - 1]);
+    session->SetLogger(logger);
+    session->SetStreamingThreshold(options.streamThreshold);
+    session->SetName(name.str().c_str());
+    sessionsReply.push_back(session);
+    }
+  if (!upstreams.empty())
     {
-    igtl::Sleep(500);
+    sessionRoute->SetRouter(options.router);
     }
 
-  sessionUp->Stop();
-  sessionDown->Stop();
+  // The options below apply to the stage next to the client, except for
+  // the queues sending to the servers. Replies from the additional servers
+  // are treated the same as those from the default server.
+  igtl::Session::Pointer sessionUp = sessionsUp[0];
+  igtl::Session::Pointer sessionDown = sessionsDown[0];
+  std::vector< igtl::Session::Pointer > sessionsToClient(1, sessionDown);
+  if (nStages == 1)
+    {
+    sessionsToClient.insert(sessionsToClient.end(), sessionsReply.begin(), sessionsReply.end());
+    }
+
+  // Images sent to the client can be decimated to save bandwidth.
+  for (size_t i = 0; i < sessionsToClient.size(); i ++)
+    {
+    igtl::ImageDecimator::Pointer decimator = igtl::ImageDecimator::New();
+    decimator->SetFrameInterval(options.imageInterval);
+    decimator->SetMaximumFrameRate(options.imageRate);
+    decimator->SetDownsampleFactor(options.imageFactor);
+    sessionsToClient[i]->SetImageDecimator(decimator);
+    }
+
+  // Jitter and clock skew of the sources in both directions
+  if (monitor)
+    {
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      sessionsToClient[i]->SetSourceMonitor(monitor);
+      }
+    sessionUp->SetSourceMonitor(monitor);
+    }
+
+  // Pose and control messages overtake queued bulk messages.
+  igtl::SendQueue::Pointer downQueue;
+  igtl::SendQueue::Pointer upQueue;
+  if (options.starvationLimit > 0)
+    {
+    downQueue = igtl::SendQueue::New();
+    downQueue->SetTransport(serverSocket);
+    downQueue->SetStarvationLimit(options.starvationLimit);
+    downQueue->Start();
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      sessionsToClient[i]->SetSendQueue(downQueue);
+      }
+
+    upQueue = igtl::SendQueue::New();
+    upQueue->SetTransport(clientTransport);
+    upQueue->SetStarvationLimit(options.starvationLimit);
+    upQueue->Start();
+    sessionRoute->SetSendQueue(upQueue);
+    }
+
+  Relay * relay = new Relay;
+  relay->label = label;
+  relay->clientTransport = clientTransport;
+  relay->upstreams = upstreams;
+  relay->links = links;
+  if (options.starvationLimit > 0)
+    {
+    relay->queues.push_back(downQueue);
+    relay->queues.push_back(upQueue);
+    }
+
+  // A bad network is emulated where the messages leave the repeater.
+  igtl::ImpairmentEmulator::Pointer downImpairment;
+  igtl::ImpairmentEmulator::Pointer upImpairment;
+  if (!options.impairDown.empty())
+    {
+    downImpairment = igtl::ImpairmentEmulator::New();
+    downImpairment->Configure(options.impairDown.c_str());
+    downImpairment->SetOutput(serverSocket, clientLocks[0], downQueue);
+    downImpairment->Start();
+    relay->impairments.push_back(downImpairment);
+    relay->impairmentNames.push_back(label + "S->C");
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      sessionsToClient[i]->SetImpairmentEmulator(downImpairment);
+      }
+    }
+  if (!options.impairUp.empty())
+    {
+    upImpairment = igtl::ImpairmentEmulator::New();
+    upImpairment->Configure(options.impairUp.c_str());
+    upImpairment->SetOutput(clientTransport, serverLocks[nStages - 1], upQueue);
+    upImpairment->Start();
+    relay->impairments.push_back(upImpairment);
+    relay->impairmentNames.push_back(label + "C->S");
+    sessionRoute->SetImpairmentEmulator(upImpairment);
+    }
+
+  // Each additional server has its own queue and emulator.
+  for (size_t i = 0; i < upstreams.size(); i ++)
+    {
+    igtl::SendQueue::Pointer queue;
+    if (options.starvationLimit > 0)
+      {
+      queue = igtl::SendQueue::New();
+      queue->SetTransport(upstreams[i]);
+      queue->SetStarvationLimit(options.starvationLimit);
+      queue->Start();
+      relay->queues.push_back(queue);
+      }
+    igtl::ImpairmentEmulator::Pointer emulator;
+    if (!options.impairUp.empty())
+      {
+      emulator = igtl::ImpairmentEmulator::New();
+      emulator->Configure(options.impairUp.c_str());
+      emulator->SetOutput(upstreams[i], upstreamLocks[i], queue);
+      emulator->Start();
+      relay->impairments.push_back(emulator);
+      std::stringstream name;
+      name << label << "C->S" << i + 1;
+      relay->impairmentNames.push_back(name.str());
+      }
+    sessionRoute->AddDestination(upstreams[i], upstreamLocks[i], queue, emulator);
+    }
+
+  // Unchanged repeats of a message are suppressed in both directions.
+  if (options.keepAlive > 0.0)
+    {
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      igtl::DuplicateFilter::Pointer downFilter = igtl::DuplicateFilter::New();
+      downFilter->SetKeepAliveInterval(options.keepAlive);
+      sessionsToClient[i]->SetDuplicateFilter(downFilter);
+      }
+
+    igtl::DuplicateFilter::Pointer upFilter = igtl::DuplicateFilter::New();
+    upFilter->SetKeepAliveInterval(options.keepAlive);
+    sessionUp->SetDuplicateFilter(upFilter);
+    }
+
+  // Replies from the server answer later queries from the client.
+  if (options.cacheFreshness > 0.0)
+    {
+    igtl::ResponseCache::Pointer cache = igtl::ResponseCache::New();
+    cache->SetFreshness(options.cacheFreshness);
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      sessionsToClient[i]->SetResponseCache(cache);
+      }
+    sessionUp->SetQueryCache(cache, downQueue);
+    }
+
+  // The tap sees the messages as they leave the repeater.
+  if (tap && options.tapDirection != "c2s")
+    {
+    for (size_t i = 0; i < sessionsToClient.size(); i ++)
+      {
+      sessionsToClient[i]->SetTrafficTap(tap);
+      }
+    }
+  if (tap && options.tapDirection != "s2c")
+    {
+    sessionRoute->SetTrafficTap(tap);
+    }
+
+  // Messages held by this connection count toward both limits.
+  relay->memory = igtl::MemoryBudget::New();
+  relay->memory->SetLimit(options.memoryLimit);
+  relay->memory->SetParent(memory);
+  for (size_t i = 0; i < relay->queues.size(); i ++)
+    {
+    relay->queues[i]->SetMemoryBudget(relay->memory);
+    }
+  for (size_t i = 0; i < relay->impairments.size(); i ++)
+    {
+    relay->impairments[i]->SetMemoryBudget(relay->memory);
+    }
+
+  std::vector< igtl::Session::Pointer > & sessions = relay->sessions;
+  for (int k = 0; k < nStages; k ++)
+    {
+    sessions.push_back(sessionsUp[k]);
+    sessions.push_back(sessionsDown[k]);
+    }
+  sessions.insert(sessions.end(), sessionsReply.begin(), sessionsReply.end());
+
+  // Sessions reading from an in-process queue have no descriptor to poll
+  // and run on their own threads.
+  for (size_t i = 0; i < sessions.size(); i ++)
+    {
+    sessions[i]->SetWorkerPool(pool);
+    sessions[i]->SetTrafficSummary(summary);
+    sessions[i]->SetDecoderPool(decoders);
+    sessions[i]->SetMemoryBudget(relay->memory, options.memoryDrop);
+    sessions[i]->Start();
+    }
+
+  return relay;
+}
 
-  std::cerr << "Closing the client socket." << std::endl;
-  clientSocket->CloseSocket();
 
+int IsRelayActive(Relay* relay)
+{
+  for (size_t i = 0; i < relay->sessions.size(); i ++)
+    {
+    if (!relay->sessions[i]->IsActive())
+      {
+      return 0;
+      }
+    }
   return 1;
+}
+
 
+static void RelaySetupThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  RelaySetup * setup = static_cast<RelaySetup *>(info->UserData);
+
+  // The relay runs as soon as it is started; the accept loop only takes
+  // it over to stop it when it ends.
+  Relay * relay = StartRelay(setup->transport, setup->hostname.c_str(), setup->destPort, *setup->options,
+                             setup->label, setup->logger, *setup->rules, setup->pool, setup->tap,
+                             setup->monitor, setup->summary, setup->decoders, setup->memory);
+  setup->lock.Lock();
+  setup->relay = relay;
+  setup->done  = 1;
+  setup->lock.Unlock();
 }
 
 
+void StopRelay(Relay* relay)
+{
+  for (size_t i = 0; i < relay->sessions.size(); i ++)
+    {
+    relay->sessions[i]->Stop();
+    }
+
+  std::cerr << "Closing the client socket." << std::endl;
+  relay->clientTransport->Close();
+  for (size_t i = 0; i < relay->upstreams.size(); i ++)
+    {
+    relay->upstreams[i]->Close();
+    }
+
+  // Wakes the stages waiting on each other.
+  for (size_t i = 0; i < relay->links.size(); i ++)
+    {
+    relay->links[i]->Close();
+    }
+
+  for (size_t i = 0; i < relay->queues.size(); i ++)
+    {
+    relay->queues[i]->Stop();
+    }
+
+  for (size_t i = 0; i < relay->impairments.size(); i ++)
+    {
+    std::cerr << relay->impairmentNames[i] << " impairment: Dropped=" << relay->impairments[i]->GetDropped()
+              << ", Reordered=" << relay->impairments[i]->GetReordered() << std::endl;
+    relay->impairments[i]->Stop();
+    }
+
+  std::cerr << relay->label << "Memory: Peak=" << relay->memory->GetPeak() << " bytes, All connections: Usage="
+            << relay->memory->GetParent()->GetUsage() << " bytes, Peak=" << relay->memory->GetParent()->GetPeak()
+            << " bytes" << std::endl;
+
+  delete relay;
+}
+
+
+int ServerSession(igtl::Transport* serverSocket, const char* dest_hostname, int dest_port, const RepeaterOptions& options,
+                  igtl::Logger* logger, RuleManagerList& rules, igtl::WorkerPool* pool, igtl::TrafficTap* tap,
+                  igtl::SourceMonitor* monitor, igtl::TrafficSummary* summary, igtl::DecoderPool* decoders,
+                  igtl::MemoryBudget* memory)
+{
+  Relay * relay = StartRelay(serverSocket, dest_hostname, dest_port, options, "", logger, rules, pool, tap, monitor, summary, decoders, memory);
+  if (!relay)
+    {
+    return 0;
+    }
+
+  // Monitor
+  while (IsRelayActive(relay))
+    {
+    igtl::Sleep(500);
+    CheckRules(rules);
+    CheckMonitor(monitor, summary);
+    }
+
+  StopRelay(relay);
+  return 1;
+
+}
@@ -0,0 +1,250 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <math.h>
+#include <sstream>
+#include <iomanip>
+
+#include "monitor.h"
+
+namespace igtl
+{
+
+// Weight of a new sample in the exponentially weighted averages
+static const double EWMA_WEIGHT = 1.0 / 16.0;
+
+//-----------------------------------------------------------------------------
+SourceMonitor::SourceMonitor()
+{
+  this->SummaryPeriod  = 0.0;
+  this->StallThreshold = 5.0;
+  this->LastSummary    = 0;
+  this->Mutex  = igtl::MutexLock::New();
+  this->logger = NULL;
+}
+
+//-----------------------------------------------------------------------------
+SourceMonitor::~SourceMonitor()
+{
+}
+
+//-----------------------------------------------------------------------------
+void SourceMonitor::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+std::string SourceMonitor::MakeKey(const char * direction, const char * name, const char * type)
+{
+  std::string key(direction);
+  key.append(", ");
+  key.append(name);
+  key.append(", ");
+  key.append(type);
+  return key;
+}
+
+//-----------------------------------------------------------------------------
+void SourceMonitor::Update(const char * direction, const char * name, const char * type,
+                           igtlInt64 ticks, igtlInt64 sysTime, igtlInt64 msgTime)
+{
+  std::string key = MakeKey(direction, name, type);
+
+  std::stringstream alert;
+
+  this->Mutex->Lock();
+
+  SourceStatistics & s = this->Sources[key];
+  if (s.count == 0)
+    {
+    s.firstSys = ticks;
+    }
+  else
+    {
+    double d = (double) (ticks - s.lastSys) * 1.0e-9;
+    if (s.count == 1)
+      {
+      s.interval = d;
+      }
+    else
+      {
+      double diff = d - s.interval;
+      s.interval    += EWMA_WEIGHT * diff;
+      s.intervalVar  = (1.0 - EWMA_WEIGHT) * (s.intervalVar + EWMA_WEIGHT * diff * diff);
+      }
+
+    if (msgTime != 0 && s.lastMsg != 0)
+      {
+      double transit = fabs(d - (double) (msgTime - s.lastMsg) * 1.0e-9);
+      s.transitJitter += (transit - s.transitJitter) / 16.0;
+      }
+
+    if (s.stalled)
+      {
+      s.stalled = 0;
+      alert << "# RESUMED " << key << ": arrival gap "
+            << std::fixed << std::setprecision(1) << d * 1.0e3 << " ms";
+      if (msgTime != 0 && s.lastMsg != 0)
+        {
+        double source = (double) (msgTime - s.lastMsg) * 1.0e-9;
+        alert << ", source gap " << source * 1.0e3 << " ms ("
+              << ((source > 0.5 * d) ? "source stalled" : "network delay") << ")";
+        }
+      alert << std::endl;
+      }
+    }
+
+  if (msgTime != 0)
+    {
+    // Skew and drift. The time is relative to the first message to keep
+    // the precision of the least-squares fit.
+    double t    = (double) (ticks - s.firstSys) * 1.0e-9;
+    double skew = (double) (sysTime - msgTime) * 1.0e-9;
+    s.skew = (s.nSkew == 0) ? skew : s.skew + EWMA_WEIGHT * (skew - s.skew);
+
+    s.nSkew ++;
+    double dt = t - s.meanT;
+    s.meanT    += dt / (double) s.nSkew;
+    s.meanSkew += (skew - s.meanSkew) / (double) s.nSkew;
+    s.varT     += dt * (t - s.meanT);
+    s.covTSkew += dt * (skew - s.meanSkew);
+    }
+
+  s.count ++;
+  s.periodCount ++;
+  s.lastSys = ticks;
+  s.lastMsg = msgTime;
+
+  this->Mutex->Unlock();
+
+  if (alert.tellp() > 0 && this->logger.IsNotNull())
+    {
+    this->logger->Print(alert.str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+void SourceMonitor::UpdateShaped(const char * direction, const char * name, const char * type, int dropped)
+{
+  std::string key = MakeKey(direction, name, type);
+
+  this->Mutex->Lock();
+  SourceStatistics & s = this->Sources[key];
+  if (dropped)
+    {
+    s.periodDropped ++;
+    }
+  else
+    {
+    s.periodDelayed ++;
+    }
+  this->Mutex->Unlock();
+}
+
+//-----------------------------------------------------------------------------
+void SourceMonitor::Check(igtlInt64 now)
+{
+  std::stringstream alert;
+
+  this->Mutex->Lock();
+
+  std::map<std::string, SourceStatistics>::iterator it;
+  for (it = this->Sources.begin(); it != this->Sources.end(); it ++)
+    {
+    SourceStatistics & s = it->second;
+    if (s.stalled || s.count < 2 || s.interval <= 0.0)
+      {
+      continue;
+      }
+    double silence = (double) (now - s.lastSys) * 1.0e-9;
+    if (silence > this->StallThreshold * s.interval)
+      {
+      s.stalled = 1;
+      alert << "# STALL " << it->first << ": no message for "
+            << std::fixed << std::setprecision(1) << silence * 1.0e3 << " ms (expected period "
+            << s.interval * 1.0e3 << " ms)" << std::endl;
+      }
+    }
+
+  this->Mutex->Unlock();
+
+  if (alert.tellp() > 0 && this->logger.IsNotNull())
+    {
+    this->logger->Print(alert.str());
+    }
+
+  if (this->SummaryPeriod > 0.0)
+    {
+    if (this->LastSummary == 0)
+      {
+      this->LastSummary = now;
+      }
+    double period = (double) (now - this->LastSummary) * 1.0e-9;
+    if (period >= this->SummaryPeriod)
+      {
+      this->PrintSummary(period);
+      this->LastSummary = now;
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void SourceMonitor::PrintSummary(double period)
+{
+  std::stringstream ss;
+  ss << std::fixed;
+
+  this->Mutex->Lock();
+
+  std::map<std::string, SourceStatistics>::iterator it;
+  for (it = this->Sources.begin(); it != this->Sources.end(); it ++)
+    {
+    SourceStatistics & s = it->second;
+    ss << "# MONITOR " << it->first << ", "
+       << std::setprecision(1) << "Rate=" << (double) s.periodCount / period << " Hz, "
+       << std::setprecision(3) << "Interval=" << s.interval * 1.0e3 << " ms, "
+       << "Jitter=" << sqrt(s.intervalVar) * 1.0e3 << " ms";
+    if (s.nSkew > 0)
+      {
+      ss << ", Skew=" << s.skew * 1.0e3 << " ms"
+         << ", TransitJitter=" << s.transitJitter * 1.0e3 << " ms";
+      if (s.nSkew > 1 && s.varT > 0.0)
+        {
+        ss << ", Drift=" << std::setprecision(1) << s.covTSkew / s.varT * 1.0e6 << " ppm";
+        }
+      }
+    if (s.periodDropped > 0 || s.periodDelayed > 0)
+      {
+      ss << ", Dropped=" << s.periodDropped << ", Delayed=" << s.periodDelayed;
+      }
+    if (s.stalled)
+      {
+      ss << ", STALLED";
+      }
+    ss << std::endl;
+    s.periodCount   = 0;
+    s.periodDropped = 0;
+    s.periodDelayed = 0;
+    }
+
+  this->Mutex->Unlock();
+
+  if (this->logger.IsNotNull())
+    {
+    this->logger->Print(ss.str());
+    }
+}
+
+} // End of igtl namespace
@@ -0,0 +1,118 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <map>
+#include <string>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "logger.h"
+
+namespace igtl
+{
+
+// SourceMonitor keeps running statistics of the message stream from each
+// source (direction, device name, device type) with constant memory per
+// source: rate, inter-arrival jitter, skew between the sender clock
+// (message time stamp) and the relay clock (system time stamp), and drift.
+// A source is reported as stalled if no message arrives for a given number
+// of expected periods. When it resumes, the gap in the message time stamps
+// is compared with the gap in arrival time to tell a stalled source from a
+// delay in the network.
+class IGTLCommon_EXPORT SourceMonitor : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::SourceMonitor, igtl::Object)
+  igtlNewMacro(igtl::SourceMonitor);
+
+public:
+
+  virtual const char * GetClassName() { return "SourceMonitor"; };
+
+  void SetLogger(igtl::Logger * logger) { this->logger = logger; };
+
+  // Period of the summary in seconds (0: no summary).
+  void   SetSummaryPeriod(double s) { this->SummaryPeriod = s; };
+  double GetSummaryPeriod() { return this->SummaryPeriod; };
+
+  // A source is stalled after no message for 'n' expected periods.
+  void   SetStallThreshold(double n) { this->StallThreshold = n; };
+  double GetStallThreshold() { return this->StallThreshold; };
+
+  // Called for every message. Times are in nanoseconds: 'ticks' from
+  // Clock::Ticks() for the intervals, 'sysTime' and 'msgTime' since the
+  // epoch for the skew; 'msgTime' is 0 if the sender does not set the
+  // time stamp.
+  void Update(const char * direction, const char * name, const char * type,
+              igtlInt64 ticks, igtlInt64 sysTime, igtlInt64 msgTime);
+
+  // Called for every message delayed or dropped by a rate limit.
+  void UpdateShaped(const char * direction, const char * name, const char * type, int dropped);
+
+  // Called periodically with Clock::Ticks(); detects stalls and prints the
+  // summary when due.
+  void Check(igtlInt64 now);
+
+protected:
+
+  SourceMonitor();
+  ~SourceMonitor();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    igtlUint64 count;          // Total # of messages
+    igtlUint64 periodCount;    // # of messages since the last summary
+    igtlInt64  firstSys;       // ns; Clock::Ticks()
+    igtlInt64  lastSys;        // ns; Clock::Ticks()
+    igtlInt64  lastMsg;        // ns
+    double     interval;       // s; EWMA of the inter-arrival interval
+    double     intervalVar;    // s^2; EW variance of the interval
+    double     transitJitter;  // s; RFC 3550 inter-arrival jitter
+    double     skew;           // s; EWMA of (system - message) time stamp
+    // Running least-squares fit of skew against time for the drift
+    igtlUint64 nSkew;
+    double     meanT;
+    double     meanSkew;
+    double     varT;
+    double     covTSkew;
+    int        stalled;
+    igtlUint64 periodDropped;  // # of messages dropped by a rate limit since the last summary
+    igtlUint64 periodDelayed;  // # of messages delayed by a rate limit since the last summary
+  } SourceStatistics;
+
+  static std::string MakeKey(const char * direction, const char * name, const char * type);
+
+  void           PrintSummary(double period);
+
+protected:
+
+  double SummaryPeriod;
+  double StallThreshold;
+  igtlInt64 LastSummary;
+
+  std::map<std::string, SourceStatistics> Sources;
+
+  igtl::MutexLock::Pointer Mutex;
+  igtl::Logger::Pointer logger;
+
+};
+
+}
+
+#endif // MONITOR_H
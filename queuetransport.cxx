@@ -0,0 +1,210 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+
+#include "queuetransport.h"
+
+namespace igtl
+{
+
+// # of recycled buffers kept per channel
+static const size_t MAX_FREE_BUFFERS = 64;
+
+//-----------------------------------------------------------------------------
+QueueChannel::QueueChannel()
+{
+  this->DataReady   = igtl::ConditionVariable::New();
+  this->SpaceReady  = igtl::ConditionVariable::New();
+  this->Offset      = 0;
+  this->QueuedBytes = 0;
+  this->Capacity    = 0;
+  this->Closed      = 0;
+}
+
+//-----------------------------------------------------------------------------
+QueueChannel::~QueueChannel()
+{
+  for (size_t i = 0; i < this->Buffers.size(); i ++)
+    {
+    delete this->Buffers[i];
+    }
+  for (size_t i = 0; i < this->FreeBuffers.size(); i ++)
+    {
+    delete this->FreeBuffers[i];
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+QueueTransport::~QueueTransport()
+{
+  this->Close();
+}
+
+//-----------------------------------------------------------------------------
+void QueueTransport::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+void QueueTransport::CreatePair(QueueTransport::Pointer & a, QueueTransport::Pointer & b,
+                                igtlUint64 capacity)
+{
+  QueueChannel::Pointer ab = QueueChannel::New();
+  QueueChannel::Pointer ba = QueueChannel::New();
+  ab->Capacity = capacity;
+  ba->Capacity = capacity;
+
+  a = QueueTransport::New();
+  b = QueueTransport::New();
+  a->Outbound = ab;
+  a->Inbound  = ba;
+  b->Outbound = ba;
+  b->Inbound  = ab;
+}
+
+//-----------------------------------------------------------------------------
+int QueueTransport::Send(const void * data, igtlUint64 length)
+{
+  QueueChannel * ch = this->Outbound;
+  if (!ch)
+    {
+    return 0;
+    }
+
+  ch->Lock.Lock();
+  // A message larger than the capacity is accepted once the queue is empty.
+  while (!ch->Closed && ch->QueuedBytes > 0 && ch->QueuedBytes + length > ch->Capacity)
+    {
+    ch->SpaceReady->Wait(&ch->Lock);
+    }
+  if (ch->Closed)
+    {
+    ch->Lock.Unlock();
+    return 0;
+    }
+
+  QueueChannel::Buffer * buffer;
+  if (!ch->FreeBuffers.empty())
+    {
+    buffer = ch->FreeBuffers.back();
+    ch->FreeBuffers.pop_back();
+    }
+  else
+    {
+    buffer = new QueueChannel::Buffer;
+    }
+  ch->Lock.Unlock();
+
+  // Copy outside the lock so that the other end can keep reading.
+  buffer->resize((size_t) length);
+  if (length > 0)
+    {
+    memcpy(&(*buffer)[0], data, (size_t) length);
+    }
+
+  ch->Lock.Lock();
+  ch->Buffers.push_back(buffer);
+  ch->QueuedBytes += length;
+  ch->DataReady->Signal();
+  ch->Lock.Unlock();
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 QueueTransport::Receive(void * data, igtlUint64 length, bool & timeout, int readFully)
+{
+  timeout = false;
+  QueueChannel * ch = this->Inbound;
+  if (!ch)
+    {
+    return 0;
+    }
+
+  unsigned char * p = (unsigned char *) data;
+  igtlUint64 received = 0;
+
+  ch->Lock.Lock();
+  while (received < length)
+    {
+    while (ch->Buffers.empty() && !ch->Closed)
+      {
+      ch->DataReady->Wait(&ch->Lock);
+      }
+    if (ch->Buffers.empty())
+      {
+      // Closed and drained
+      ch->Lock.Unlock();
+      return 0;
+      }
+
+    QueueChannel::Buffer * buffer = ch->Buffers.front();
+    igtlUint64 n = buffer->size() - ch->Offset;
+    if (n > length - received)
+      {
+      n = length - received;
+      }
+    if (n > 0)
+      {
+      memcpy(p + received, &(*buffer)[(size_t) ch->Offset], (size_t) n);
+      }
+    received += n;
+    ch->Offset += n;
+    ch->QueuedBytes -= n;
+
+    if (ch->Offset == buffer->size())
+      {
+      ch->Buffers.pop_front();
+      ch->Offset = 0;
+      if (ch->FreeBuffers.size() < MAX_FREE_BUFFERS)
+        {
+        ch->FreeBuffers.push_back(buffer);
+        }
+      else
+        {
+        delete buffer;
+        }
+      ch->SpaceReady->Broadcast();
+      }
+
+    if (!readFully)
+      {
+      break;
+      }
+    }
+  ch->Lock.Unlock();
+  return received;
+}
+
+//-----------------------------------------------------------------------------
+void QueueTransport::Close()
+{
+  QueueChannel * channels[2] = { this->Inbound, this->Outbound };
+  for (int i = 0; i < 2; i ++)
+    {
+    QueueChannel * ch = channels[i];
+    if (!ch)
+      {
+      continue;
+      }
+    ch->Lock.Lock();
+    ch->Closed = 1;
+    ch->DataReady->Broadcast();
+    ch->SpaceReady->Broadcast();
+    ch->Lock.Unlock();
+    }
+}
+
+} // End of igtl namespace
@@ -0,0 +1,106 @@
+#ifndef QUEUETRANSPORT_H
+#define QUEUETRANSPORT_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <deque>
+#include <vector>
+
+#include "transport.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+
+namespace igtl
+{
+
+// One direction of a QueueTransport pair: a FIFO of buffers shared by
+// the sending and the receiving end.
+class IGTLCommon_EXPORT QueueChannel : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::QueueChannel, igtl::Object)
+  igtlNewMacro(igtl::QueueChannel);
+
+  typedef std::vector<unsigned char> Buffer;
+
+  igtl::SimpleMutexLock             Lock;
+  igtl::ConditionVariable::Pointer  DataReady;
+  igtl::ConditionVariable::Pointer  SpaceReady;
+  std::deque<Buffer *>              Buffers;
+  std::vector<Buffer *>             FreeBuffers;  // Recycled buffers
+  igtlUint64                        Offset;       // Bytes read from Buffers.front()
+  igtlUint64                        QueuedBytes;
+  igtlUint64                        Capacity;
+  int                               Closed;
+
+protected:
+
+  QueueChannel();
+  ~QueueChannel();
+
+};
+
+
+// QueueTransport connects two sessions in the same process, e.g. relay
+// stages chained in one repeater. Each Send() is handed to the other end
+// as one buffer through a queue protected by a mutex; nothing goes
+// through the kernel. Buffers are recycled, so a steady stream does not
+// allocate. Send() blocks while the queue holds more than the capacity.
+//
+//   QueueTransport::Pointer a, b;
+//   QueueTransport::CreatePair(a, b);
+//   a->Send(...);   // received by b
+//   b->Send(...);   // received by a
+//
+class IGTLCommon_EXPORT QueueTransport : public Transport
+{
+public:
+
+  igtlTypeMacro(igtl::QueueTransport, igtl::Transport)
+  igtlNewMacro(igtl::QueueTransport);
+
+public:
+
+  virtual const char * GetClassName() { return "QueueTransport"; };
+
+  // Creates two connected ends. Each direction holds up to 'capacity'
+  // bytes before Send() blocks.
+  static void CreatePair(QueueTransport::Pointer & a, QueueTransport::Pointer & b,
+                         igtlUint64 capacity = 32 * 1024 * 1024);
+
+  virtual int        Send(const void * data, igtlUint64 length);
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1);
+
+  // Closes both directions. The other end receives 0 once the queued data
+  // has been read.
+  virtual void       Close();
+
+protected:
+
+  QueueTransport() {};
+  ~QueueTransport();
+
+  void           PrintSelf(std::ostream& os) const;
+
+protected:
+
+  QueueChannel::Pointer  Inbound;
+  QueueChannel::Pointer  Outbound;
+
+};
+
+}
+
+#endif // QUEUETRANSPORT_H
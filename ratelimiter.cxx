@@ -0,0 +1,119 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "ratelimiter.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+RateLimiter::RateLimiter()
+{
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::~RateLimiter()
+{
+}
+
+//-----------------------------------------------------------------------------
+void RateLimiter::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::Bucket & RateLimiter::Refill(const std::string & key, const RuleSet::RateLimit * limit, igtlInt64 now)
+{
+  std::unordered_map<std::string, Bucket>::iterator it = this->Buckets.find(key);
+  if (it == this->Buckets.end())
+    {
+    Bucket & b = this->Buckets[key];
+    b.tokens = limit->Burst;
+    b.last   = now;
+    return b;
+    }
+
+  Bucket & b = it->second;
+  if (now > b.last)
+    {
+    b.tokens += (double) (now - b.last) * 1.0e-9 * limit->Rate;
+    if (b.tokens > limit->Burst)
+      {
+      b.tokens = limit->Burst;
+      }
+    b.last = now;
+    }
+  return b;
+}
+
+//-----------------------------------------------------------------------------
+igtlInt64 RateLimiter::Admit(const RuleSet * rules, const char * name, const char * type, igtlInt64 now)
+{
+  if (!rules->HasRateLimits())
+    {
+    return 0;
+    }
+
+  const RuleSet::RateLimit * limits[2];
+  Bucket * buckets[2];
+  int n = 0;
+
+  const RuleSet::RateLimit * limit = rules->FindTypeLimit(type);
+  if (limit)
+    {
+    // Keys of the two kinds cannot collide: a type has no spaces.
+    this->Key.assign(type);
+    limits[n]  = limit;
+    buckets[n] = &this->Refill(this->Key, limit, now);
+    n ++;
+    }
+  limit = rules->FindDeviceLimit(name);
+  if (limit)
+    {
+    this->Key.assign(1, ' ');
+    this->Key.append(name);
+    limits[n]  = limit;
+    buckets[n] = &this->Refill(this->Key, limit, now);
+    n ++;
+    }
+
+  // A message is dropped without taking a token from the other bucket.
+  for (int i = 0; i < n; i ++)
+    {
+    if (!limits[i]->Delay && buckets[i]->tokens < 1.0)
+      {
+      return DROP;
+      }
+    }
+
+  // A delayed message takes its token in advance, so the next message
+  // waits for its own token after this one.
+  igtlInt64 wait = 0;
+  for (int i = 0; i < n; i ++)
+    {
+    buckets[i]->tokens -= 1.0;
+    if (buckets[i]->tokens < 0.0)
+      {
+      igtlInt64 w = (igtlInt64) (-buckets[i]->tokens / limits[i]->Rate * 1.0e9);
+      if (w > wait)
+        {
+        wait = w;
+        }
+      }
+    }
+
+  return wait;
+}
+
+} // End of igtl namespace
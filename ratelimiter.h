@@ -0,0 +1,78 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string>
+#include <unordered_map>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "rules.h"
+
+namespace igtl
+{
+
+// RateLimiter shapes the messages of one direction with the token buckets
+// defined by the 'limit' rules. There is one bucket per limited message
+// type and one per limited device name; a message is forwarded if every
+// bucket that applies to it has a token. The rates are taken from the
+// current rule set for each message, so a reload takes effect immediately
+// while the bucket levels are kept.
+//
+// Not thread safe; each session has its own limiter.
+class IGTLCommon_EXPORT RateLimiter : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::RateLimiter, igtl::Object)
+  igtlNewMacro(igtl::RateLimiter);
+
+  enum {
+    DROP = -1
+  };
+
+public:
+
+  virtual const char * GetClassName() { return "RateLimiter"; };
+
+  // Returns 0 if the message can be forwarded now, the time in ns to wait
+  // before forwarding it, or DROP. 'now' is in ns (Clock::Ticks()).
+  igtlInt64 Admit(const RuleSet * rules, const char * name, const char * type, igtlInt64 now);
+
+protected:
+
+  RateLimiter();
+  ~RateLimiter();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    double    tokens;
+    igtlInt64 last;    // ns
+  } Bucket;
+
+  // Refills the bucket up to 'now' and returns it.
+  Bucket &       Refill(const std::string & key, const RuleSet::RateLimit * limit, igtlInt64 now);
+
+protected:
+
+  std::unordered_map<std::string, Bucket> Buckets;
+  std::string Key;
+
+};
+
+}
+
+#endif // RATELIMITER_H
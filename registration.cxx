@@ -0,0 +1,161 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <vector>
+
+#include "registration.h"
+#include "wire.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+// Sizes defined by the OpenIGTLink protocol
+static const int TRANSFORM_BODY_SIZE    = 48;   // 12 x float32
+static const int TDATA_ELEMENT_SIZE     = 70;   // name(20) + type(1) + reserved(1) + 12 x float32
+static const int TDATA_TRANSFORM_OFFSET = 22;
+
+// Number of elements converted at a time; keeps the SoA buffers on the stack.
+static const int BATCH_SIZE = 64;
+
+
+//-----------------------------------------------------------------------------
+void ComposeRegistration(igtl::Matrix4x4 & current, const igtl::Matrix4x4 & next)
+{
+  igtl::Matrix4x4 result;
+  for (int i = 0; i < 4; i ++)
+    {
+    for (int j = 0; j < 4; j ++)
+      {
+      result[i][j] = next[i][0] * current[0][j] + next[i][1] * current[1][j]
+                   + next[i][2] * current[2][j] + next[i][3] * current[3][j];
+      }
+    }
+  memcpy(current, result, sizeof(igtl::Matrix4x4));
+}
+
+//-----------------------------------------------------------------------------
+void ApplyRegistrationBatch(const igtl::Matrix4x4 & reg, float * const in[12], float * const out[12], int n)
+{
+  // Rotation columns: c'_k = R * c_k (k = 0, 1, 2)
+  for (int k = 0; k < 3; k ++)
+    {
+    const float * x = in[k * 3];
+    const float * y = in[k * 3 + 1];
+    const float * z = in[k * 3 + 2];
+    for (int r = 0; r < 3; r ++)
+      {
+      const float a = reg[r][0];
+      const float b = reg[r][1];
+      const float c = reg[r][2];
+      float * o = out[k * 3 + r];
+      for (int i = 0; i < n; i ++)
+        {
+        o[i] = a * x[i] + b * y[i] + c * z[i];
+        }
+      }
+    }
+
+  // Translation: t' = R * t + t_R
+  const float * x = in[9];
+  const float * y = in[10];
+  const float * z = in[11];
+  for (int r = 0; r < 3; r ++)
+    {
+    const float a = reg[r][0];
+    const float b = reg[r][1];
+    const float c = reg[r][2];
+    const float d = reg[r][3];
+    float * o = out[9 + r];
+    for (int i = 0; i < n; i ++)
+      {
+      o[i] = a * x[i] + b * y[i] + c * z[i] + d;
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Applies 'reg' to 'n' 12-float transforms located at 'data' + i * 'stride'.
+static void ApplyRegistrationStrided(const igtl::Matrix4x4 & reg, unsigned char * data, int stride, int n)
+{
+  float inBuf[12][BATCH_SIZE];
+  float outBuf[12][BATCH_SIZE];
+  float * in[12];
+  float * out[12];
+  for (int k = 0; k < 12; k ++)
+    {
+    in[k]  = inBuf[k];
+    out[k] = outBuf[k];
+    }
+
+  for (int base = 0; base < n; base += BATCH_SIZE)
+    {
+    int m = (n - base < BATCH_SIZE) ? (n - base) : BATCH_SIZE;
+
+    // Gather (AoS, big endian) -> SoA (host order)
+    for (int i = 0; i < m; i ++)
+      {
+      const unsigned char * p = data + (igtlUint64) (base + i) * stride;
+      for (int k = 0; k < 12; k ++)
+        {
+        inBuf[k][i] = GetFloat32BE(p + k * 4);
+        }
+      }
+
+    ApplyRegistrationBatch(reg, in, out, m);
+
+    // Scatter back
+    for (int i = 0; i < m; i ++)
+      {
+      unsigned char * p = data + (igtlUint64) (base + i) * stride;
+      for (int k = 0; k < 12; k ++)
+        {
+        SetFloat32BE(p + k * 4, outBuf[k][i]);
+        }
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+int ApplyRegistrationToTransform(const igtl::Matrix4x4 & reg, unsigned char * pack)
+{
+  unsigned char * content;
+  igtlUint64 contentSize;
+  if (!GetPackedContent(pack, &content, &contentSize) || contentSize < TRANSFORM_BODY_SIZE)
+    {
+    return 0;
+    }
+
+  ApplyRegistrationStrided(reg, content, TRANSFORM_BODY_SIZE, 1);
+  UpdatePackedCRC(pack);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int ApplyRegistrationToTrackingData(const igtl::Matrix4x4 & reg, unsigned char * pack)
+{
+  unsigned char * content;
+  igtlUint64 contentSize;
+  if (!GetPackedContent(pack, &content, &contentSize) || contentSize % TDATA_ELEMENT_SIZE != 0)
+    {
+    return 0;
+    }
+
+  int n = (int) (contentSize / TDATA_ELEMENT_SIZE);
+  ApplyRegistrationStrided(reg, content + TDATA_TRANSFORM_OFFSET, TDATA_ELEMENT_SIZE, n);
+  UpdatePackedCRC(pack);
+  return 1;
+}
+
+} // End of igtl namespace
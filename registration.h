@@ -0,0 +1,48 @@
+#ifndef REGISTRATION_H
+#define REGISTRATION_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "igtlWin32Header.h"
+#include "igtlTypes.h"
+#include "igtlMath.h"
+
+namespace igtl
+{
+
+// Functions to re-express poses in another coordinate frame by applying a
+// 4x4 registration matrix R (M' = R * M). They operate directly on packed
+// (network byte order) messages, so that the message does not need to be
+// unpacked and packed again; the CRC in the header is updated in place.
+//
+// 'pack' points to the beginning of the packed message (header + body),
+// e.g. MessageBase::GetPackPointer().
+//
+// Return 1 if the message has been updated, 0 if the body is malformed.
+
+// Composes 'next' after 'current' (current = next * current), so that a
+// chain of registrations can be applied with a single matrix.
+void ComposeRegistration(igtl::Matrix4x4 & current, const igtl::Matrix4x4 & next);
+
+int  ApplyRegistrationToTransform(const igtl::Matrix4x4 & reg, unsigned char * pack);
+int  ApplyRegistrationToTrackingData(const igtl::Matrix4x4 & reg, unsigned char * pack);
+
+// Applies 'reg' to 'n' poses stored as structure of arrays: in[k][i] is
+// the k-th of the 12 transform elements (IGTL order: R11 R21 R31 R12 ...
+// TX TY TZ) of the i-th pose. The loops run along 'i' and are vectorized.
+void ApplyRegistrationBatch(const igtl::Matrix4x4 & reg, float * const in[12], float * const out[12], int n);
+
+}
+
+#endif // REGISTRATION_H
@@ -0,0 +1,55 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "router.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+void Router::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int Router::AddRoute(int kind, const char * key, int upstream)
+{
+  std::unordered_map<std::string, int> & table =
+    (kind == ROUTE_DEVICE) ? this->Devices : this->Types;
+  return table.insert(std::make_pair(std::string(key), upstream)).second ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+int Router::Find(const char * type, const char * name) const
+{
+  if (!this->Devices.empty())
+    {
+    std::unordered_map<std::string, int>::const_iterator it = this->Devices.find(name);
+    if (it != this->Devices.end())
+      {
+      return it->second;
+      }
+    }
+  if (!this->Types.empty())
+    {
+    std::unordered_map<std::string, int>::const_iterator it = this->Types.find(type);
+    if (it != this->Types.end())
+      {
+      return it->second;
+      }
+    }
+  return 0;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,72 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string>
+#include <unordered_map>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+
+namespace igtl
+{
+
+// Router maps a message to one of several upstream servers by its device
+// name or, if the name has no route, by its device type. Upstream 0 is the
+// default. Lookups are hash table lookups.
+//
+// The table is built before the sessions start and is read-only afterwards.
+class IGTLCommon_EXPORT Router : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::Router, igtl::Object)
+  igtlNewMacro(igtl::Router);
+
+  enum {
+    ROUTE_TYPE,
+    ROUTE_DEVICE
+  };
+
+public:
+
+  virtual const char * GetClassName() { return "Router"; };
+
+  // Routes the messages with device type / device name 'key' to
+  // 'upstream'. Returns 0 if 'key' already has a route.
+  int  AddRoute(int kind, const char * key, int upstream);
+
+  // Returns the upstream for a message.
+  int  Find(const char * type, const char * name) const;
+
+  int  IsEmpty() const { return this->Types.empty() && this->Devices.empty(); };
+
+protected:
+
+  Router() {};
+  ~Router() {};
+
+  void           PrintSelf(std::ostream& os) const;
+
+protected:
+
+  std::unordered_map<std::string, int> Types;
+  std::unordered_map<std::string, int> Devices;
+
+};
+
+}
+
+#endif // ROUTER_H
@@ -0,0 +1,408 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "rules.h"
+#include "registration.h"
+
+namespace igtl
+{
+
+volatile sig_atomic_t RuleManager::ReloadRequested = 0;
+
+//-----------------------------------------------------------------------------
+int RuleSet::IsBlocked(const char * type) const
+{
+  std::vector<std::string>::const_iterator it;
+  for (it = this->BlockedTypes.begin(); it != this->BlockedTypes.end(); it ++)
+    {
+    if (strcmp(type, (*it).c_str()) == 0)
+      {
+      return 1;
+      }
+    }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+const RuleSet::Registration * RuleSet::FindRegistration(const char * deviceName) const
+{
+  if (this->Registrations.empty())
+    {
+    return NULL;
+    }
+
+  RegistrationMap::const_iterator it = this->Registrations.find(deviceName);
+  if (it == this->Registrations.end())
+    {
+    it = this->Registrations.find("*");
+    if (it == this->Registrations.end())
+      {
+      return NULL;
+      }
+    }
+  return &(it->second);
+}
+
+//-----------------------------------------------------------------------------
+const RuleSet::RateLimit * RuleSet::FindTypeLimit(const char * type) const
+{
+  if (this->TypeLimits.empty())
+    {
+    return NULL;
+    }
+  RateLimitMap::const_iterator it = this->TypeLimits.find(type);
+  return (it == this->TypeLimits.end()) ? NULL : &(it->second);
+}
+
+//-----------------------------------------------------------------------------
+const RuleSet::RateLimit * RuleSet::FindDeviceLimit(const char * deviceName) const
+{
+  if (this->DeviceLimits.empty())
+    {
+    return NULL;
+    }
+  RateLimitMap::const_iterator it = this->DeviceLimits.find(deviceName);
+  return (it == this->DeviceLimits.end()) ? NULL : &(it->second);
+}
+
+
+//-----------------------------------------------------------------------------
+RuleManager::RuleManager()
+{
+  this->FileModifiedTime = 0;
+  this->Version = 0;
+  this->GlobalEpoch.store(1);
+  for (int i = 0; i < MAX_READERS; i ++)
+    {
+    this->ReaderEpoch[i].store(0);
+    this->ReaderInUse[i].store(0);
+    }
+  this->Current.store(new RuleSet());
+  this->WriterLock = igtl::MutexLock::New();
+  this->logger = NULL;
+}
+
+//-----------------------------------------------------------------------------
+RuleManager::~RuleManager()
+{
+  // No reader may be active at this point.
+  delete this->Current.load();
+  for (size_t i = 0; i < this->Retired.size(); i ++)
+    {
+    delete this->Retired[i].first;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void RuleManager::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int RuleManager::Load()
+{
+  RuleSet * rules = new RuleSet();
+  rules->BlockedTypes = this->BaseBlackList;
+
+  if (!this->FileName.empty())
+    {
+    this->FileModifiedTime = this->GetFileModifiedTime();
+    if (!this->ParseFile(rules))
+      {
+      delete rules;
+      return 0;
+      }
+    }
+
+  this->Publish(rules);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int RuleManager::CheckForUpdate()
+{
+  int r = 0;
+
+  if (!this->FileName.empty())
+    {
+    if (ReloadRequested || this->GetFileModifiedTime() != this->FileModifiedTime)
+      {
+      ReloadRequested = 0;
+      r = this->Load();
+      }
+    }
+
+  this->WriterLock->Lock();
+  this->Reclaim();
+  this->WriterLock->Unlock();
+
+  return r;
+}
+
+//-----------------------------------------------------------------------------
+void RuleManager::RequestReload()
+{
+  ReloadRequested = 1;
+}
+
+//-----------------------------------------------------------------------------
+#ifndef _WIN32
+static void SignalHandlerHUP(int)
+{
+  RuleManager::RequestReload();
+}
+#endif
+
+void RuleManager::InstallSignalHandler()
+{
+#ifndef _WIN32
+  signal(SIGHUP, SignalHandlerHUP);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+int RuleManager::RegisterReader()
+{
+  for (int i = 0; i < MAX_READERS; i ++)
+    {
+    int expected = 0;
+    if (this->ReaderInUse[i].compare_exchange_strong(expected, 1))
+      {
+      this->ReaderEpoch[i].store(0);
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+void RuleManager::UnregisterReader(int slot)
+{
+  if (slot >= 0 && slot < MAX_READERS)
+    {
+    this->ReaderEpoch[slot].store(0);
+    this->ReaderInUse[slot].store(0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+int RuleManager::ParseFile(RuleSet * rules)
+{
+  std::ifstream file(this->FileName.c_str());
+  if (!file.is_open())
+    {
+    std::cerr << "ERROR: cannot open the configuration file: " << this->FileName << std::endl;
+    return 0;
+    }
+
+  // Each line is '<directive> <arguments...>'; '#' starts a comment.
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line))
+    {
+    lineNumber ++;
+    std::string::size_type comment = line.find('#');
+    if (comment != std::string::npos)
+      {
+      line.erase(comment);
+      }
+
+    std::istringstream ls(line);
+    std::string directive;
+    if (!(ls >> directive))
+      {
+      continue;
+      }
+
+    if (directive == "block")
+      {
+      std::string type;
+      if (!(ls >> type))
+        {
+        std::cerr << "ERROR: " << this->FileName << ":" << lineNumber << ": missing message type." << std::endl;
+        return 0;
+        }
+      rules->BlockedTypes.push_back(type);
+      }
+    else if (directive == "transform")
+      {
+      // transform <device> r11 r12 r13 tx r21 r22 r23 ty r31 r32 r33 tz [0 0 0 1]
+      std::string device;
+      std::vector<float> values;
+      float v;
+      ls >> device;
+      while (ls >> v)
+        {
+        values.push_back(v);
+        }
+      if (device.empty() || (values.size() != 12 && values.size() != 16))
+        {
+        std::cerr << "ERROR: " << this->FileName << ":" << lineNumber << ": 'transform' needs a device name and 12 or 16 values." << std::endl;
+        return 0;
+        }
+      igtl::Matrix4x4 matrix;
+      igtl::IdentityMatrix(matrix);
+      for (size_t i = 0; i < values.size(); i ++)
+        {
+        matrix[i / 4][i % 4] = values[i];
+        }
+
+      // Repeated lines for the same device form a chain, applied in order.
+      RuleSet::RegistrationMap::iterator it = rules->Registrations.find(device);
+      if (it == rules->Registrations.end())
+        {
+        RuleSet::Registration & reg = rules->Registrations[device];
+        memcpy(reg.Matrix, matrix, sizeof(igtl::Matrix4x4));
+        }
+      else
+        {
+        ComposeRegistration(it->second.Matrix, matrix);
+        }
+      }
+    else if (directive == "limit")
+      {
+      // limit type|device <name> <rate> [<burst>] [drop|delay]
+      std::string scope;
+      std::string name;
+      RuleSet::RateLimit limit;
+      limit.Rate  = 0.0;
+      limit.Burst = 1.0;
+      limit.Delay = 0;
+      ls >> scope >> name >> limit.Rate;
+      if ((scope != "type" && scope != "device") || name.empty() || !(limit.Rate > 0.0))
+        {
+        std::cerr << "ERROR: " << this->FileName << ":" << lineNumber << ": 'limit' needs 'type' or 'device', a name, and a rate." << std::endl;
+        return 0;
+        }
+      std::string arg;
+      while (ls >> arg)
+        {
+        if (arg == "drop")
+          {
+          limit.Delay = 0;
+          }
+        else if (arg == "delay")
+          {
+          limit.Delay = 1;
+          }
+        else
+          {
+          limit.Burst = atof(arg.c_str());
+          if (limit.Burst < 1.0)
+            {
+            std::cerr << "ERROR: " << this->FileName << ":" << lineNumber << ": burst must be 1 or more." << std::endl;
+            return 0;
+            }
+          }
+        }
+      if (scope == "type")
+        {
+        rules->TypeLimits[name] = limit;
+        }
+      else
+        {
+        rules->DeviceLimits[name] = limit;
+        }
+      }
+    else
+      {
+      std::cerr << "ERROR: " << this->FileName << ":" << lineNumber << ": unknown directive '" << directive << "'." << std::endl;
+      return 0;
+      }
+    }
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void RuleManager::Publish(RuleSet * rules)
+{
+  this->WriterLock->Lock();
+
+  rules->Version = ++ this->Version;
+
+  // Swap first, then advance the epoch. A reader that observes the new
+  // epoch is guaranteed to load the new rule set.
+  const RuleSet * old = this->Current.exchange(rules);
+  unsigned long epoch = this->GlobalEpoch.fetch_add(1) + 1;
+  this->Retired.push_back(std::make_pair(old, epoch));
+
+  this->Reclaim();
+
+  this->WriterLock->Unlock();
+
+  std::stringstream ss;
+  ss << "# Rule set version " << rules->Version << " loaded";
+  if (!this->FileName.empty())
+    {
+    ss << " from " << this->FileName;
+    }
+  ss << " (" << rules->BlockedTypes.size() << " blocked types, "
+     << rules->Registrations.size() << " registrations, "
+     << rules->TypeLimits.size() + rules->DeviceLimits.size() << " rate limits)" << std::endl;
+  if (this->logger.IsNotNull())
+    {
+    this->logger->Print(ss.str());
+    }
+  else
+    {
+    std::cerr << ss.str();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void RuleManager::Reclaim()
+{
+  // A retired set can be freed once no reader is still in a critical
+  // section that started before it was replaced.
+  std::vector< std::pair<const RuleSet *, unsigned long> >::iterator it = this->Retired.begin();
+  while (it != this->Retired.end())
+    {
+    bool inUse = false;
+    for (int i = 0; i < MAX_READERS && !inUse; i ++)
+      {
+      unsigned long e = this->ReaderEpoch[i].load();
+      inUse = (e != 0 && e < it->second);
+      }
+    if (inUse)
+      {
+      ++ it;
+      }
+    else
+      {
+      delete it->first;
+      it = this->Retired.erase(it);
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+long RuleManager::GetFileModifiedTime()
+{
+  struct stat st;
+  if (stat(this->FileName.c_str(), &st) != 0)
+    {
+    return 0;
+    }
+  return (long) st.st_mtime;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,186 @@
+#ifndef RULES_H
+#define RULES_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <atomic>
+#include <csignal>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMath.h"
+#include "logger.h"
+
+namespace igtl
+{
+
+// RuleSet is an immutable snapshot of the filter rules. Once published by
+// RuleManager, it is never modified; a reload creates a new RuleSet.
+class RuleSet
+{
+public:
+
+  // Registration applied to TRANSFORM and TDATA messages of a device.
+  // A chain of registrations is composed into one matrix at load time.
+  typedef struct {
+    igtl::Matrix4x4 Matrix;
+  } Registration;
+
+  typedef std::map<std::string, Registration> RegistrationMap;
+
+  // Token bucket: 'Rate' messages per second on average, bursts of up to
+  // 'Burst' messages. Messages over the limit are dropped or delayed.
+  typedef struct {
+    double Rate;
+    double Burst;
+    int    Delay;  // 0: drop; 1: delay
+  } RateLimit;
+
+  typedef std::map<std::string, RateLimit> RateLimitMap;
+
+  RuleSet() : Version(0) {};
+
+  // Returns 1 if the message type is blocked.
+  int IsBlocked(const char * type) const;
+
+  // Returns the registration for the device name, the one for '*' if
+  // none is defined for the device, or NULL.
+  const Registration * FindRegistration(const char * deviceName) const;
+
+  // Return the rate limit for the message type / device name, or NULL.
+  const RateLimit * FindTypeLimit(const char * type) const;
+  const RateLimit * FindDeviceLimit(const char * deviceName) const;
+
+  int HasRateLimits() const { return !this->TypeLimits.empty() || !this->DeviceLimits.empty(); };
+
+public:
+
+  unsigned long            Version;
+  std::vector<std::string> BlockedTypes;
+  RegistrationMap          Registrations;
+  RateLimitMap             TypeLimits;
+  RateLimitMap             DeviceLimits;
+};
+
+
+// RuleManager owns the current RuleSet and reloads it from a configuration
+// file while the repeater is running. The current set is published through
+// an atomic pointer, and retired sets are reclaimed with epoch-based
+// reclamation, so that readers (sessions) never take a lock:
+//
+//   int slot = manager->RegisterReader();
+//   ...
+//   const RuleSet * rules = manager->EnterReader(slot);
+//   ... use 'rules' ...
+//   manager->LeaveReader(slot);
+//
+// Reloading and reclamation are done by a single writer thread calling
+// CheckForUpdate() periodically.
+class IGTLCommon_EXPORT RuleManager : public Object
+{
+public:
+
+  enum {
+    MAX_READERS = 256
+  };
+
+  igtlTypeMacro(igtl::RuleManager, igtl::Object)
+  igtlNewMacro(igtl::RuleManager);
+
+public:
+
+  virtual const char * GetClassName() { return "RuleManager"; };
+
+  // Rules given on the command line. They are merged with the rules in the file.
+  void SetBaseBlackList(const std::vector<std::string> & blist) { this->BaseBlackList = blist; };
+
+  // Configuration file. An empty name disables reloading.
+  void SetFileName(const char * name) { this->FileName = name; };
+  const char * GetFileName() { return this->FileName.c_str(); };
+
+  void SetLogger(igtl::Logger * logger) { this->logger = logger; };
+
+  // Loads the rules and publishes them as a new version.
+  // Returns 1 on success; the current rules are kept on failure.
+  int Load();
+
+  // Reloads the rules if the file has been modified or a reload was
+  // requested (SIGHUP), and frees retired rule sets no longer in use.
+  // Returns 1 if a new version was published.
+  int CheckForUpdate();
+
+  // Requests a reload at the next CheckForUpdate(). Async-signal safe.
+  static void RequestReload();
+
+  // Installs a SIGHUP handler calling RequestReload() (POSIX only).
+  static void InstallSignalHandler();
+
+  // Reader interface (lock-free).
+  int  RegisterReader();
+  void UnregisterReader(int slot);
+
+  inline const RuleSet * EnterReader(int slot)
+  {
+    this->ReaderEpoch[slot].store(this->GlobalEpoch.load());
+    return this->Current.load();
+  };
+
+  inline void LeaveReader(int slot)
+  {
+    this->ReaderEpoch[slot].store(0);
+  };
+
+protected:
+
+  RuleManager();
+  ~RuleManager();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  int            ParseFile(RuleSet * rules);
+  void           Publish(RuleSet * rules);
+  void           Reclaim();
+  long           GetFileModifiedTime();
+
+protected:
+
+  std::vector<std::string>     BaseBlackList;
+  std::string                  FileName;
+  long                         FileModifiedTime;
+  unsigned long                Version;
+
+  std::atomic<const RuleSet *> Current;
+
+  // Epoch 0 means the reader is not in a critical section.
+  std::atomic<unsigned long>   GlobalEpoch;
+  std::atomic<unsigned long>   ReaderEpoch[MAX_READERS];
+  std::atomic<int>             ReaderInUse[MAX_READERS];
+
+  // Retired rule sets and the epoch at which they were replaced.
+  std::vector< std::pair<const RuleSet *, unsigned long> > Retired;
+
+  igtl::MutexLock::Pointer     WriterLock;
+  igtl::Logger::Pointer        logger;
+
+  static volatile sig_atomic_t ReloadRequested;
+};
+
+}
+
+#endif // RULES_H
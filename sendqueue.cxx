@@ -0,0 +1,280 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+
+#include "sendqueue.h"
+#include "wire.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+SendQueue::SendQueue()
+{
+  this->transport          = NULL;
+  this->StarvationLimit    = 8;
+  this->MaximumQueuedBytes = 64 * 1024 * 1024;
+  this->memoryBudget       = NULL;
+  this->Ready   = igtl::ConditionVariable::New();
+  this->Drained = igtl::ConditionVariable::New();
+  for (int i = 0; i < NUM_PRIORITIES; i ++)
+    {
+    this->Skipped[i] = 0;
+    }
+  this->QueuedBytes = 0;
+  this->Running  = 0;
+  this->Writing  = 0;
+  this->Acquired = 0;
+  this->Closed   = 0;
+  this->Threader = igtl::MultiThreader::New();
+  this->ThreadID = -1;
+}
+
+//-----------------------------------------------------------------------------
+SendQueue::~SendQueue()
+{
+  this->Stop();
+}
+
+//-----------------------------------------------------------------------------
+void SendQueue::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int SendQueue::GetPriority(const char * type)
+{
+  static const char * pose[] = {
+    "TRANSFORM", "POSITION", "QTRANS", "TDATA", "QTDATA", NULL
+  };
+  static const char * bulk[] = {
+    "IMAGE", "VIDEO", "NDARRAY", "POLYDATA", "COLORT", "SENSOR", NULL
+  };
+
+  for (int i = 0; pose[i]; i ++)
+    {
+    if (strcmp(type, pose[i]) == 0)
+      {
+      return PRIORITY_POSE;
+      }
+    }
+  for (int i = 0; bulk[i]; i ++)
+    {
+    if (strcmp(type, bulk[i]) == 0)
+      {
+      return PRIORITY_BULK;
+      }
+    }
+  return PRIORITY_CONTROL;
+}
+
+//-----------------------------------------------------------------------------
+int SendQueue::Start()
+{
+  if (!this->transport)
+    {
+    std::cerr << "ERROR: no transport" << std::endl;
+    return 0;
+    }
+  if (this->Running)
+    {
+    return 0;
+    }
+  this->Running = 1;
+  this->ThreadID = this->Threader->SpawnThread((igtl::ThreadFunctionType) &SendQueue::WriterThreadFunction, this);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void SendQueue::Stop()
+{
+  this->Mutex.Lock();
+  if (!this->Running)
+    {
+    this->Mutex.Unlock();
+    return;
+    }
+  this->Running = 0;
+  for (int i = 0; i < NUM_PRIORITIES; i ++)
+    {
+    this->Queues[i].clear();
+    }
+  this->ReleaseQueued();
+  this->Ready->Broadcast();
+  this->Drained->Broadcast();
+  this->Mutex.Unlock();
+
+  // Waits for the message being sent, if any.
+  this->Threader->TerminateThread(this->ThreadID);
+  this->ThreadID = -1;
+}
+
+//-----------------------------------------------------------------------------
+int SendQueue::Send(igtl::MessageBase * msg, int priority)
+{
+  if (priority < 0 || priority >= NUM_PRIORITIES)
+    {
+    const unsigned char * pack = (const unsigned char *) msg->GetPackPointer();
+    char type[IGTL_HEADER_TYPE_SIZE + 1];
+    memcpy(type, pack + WIRE_DEVICE_TYPE_OFFSET, IGTL_HEADER_TYPE_SIZE);
+    type[IGTL_HEADER_TYPE_SIZE] = '\0';
+    priority = GetPriority(type);
+    }
+  igtlUint64 size = msg->GetPackSize();
+
+  this->Mutex.Lock();
+  while (this->Running && !this->Closed && this->QueuedBytes > 0 &&
+         this->QueuedBytes + size > this->MaximumQueuedBytes)
+    {
+    this->Drained->Wait(&(this->Mutex));
+    }
+  if (!this->Running || this->Closed)
+    {
+    this->Mutex.Unlock();
+    return 0;
+    }
+  this->Queues[priority].push_back(msg);
+  this->QueuedBytes += size;
+  if (this->memoryBudget.IsNotNull())
+    {
+    this->memoryBudget->Charge(size);
+    }
+  this->Ready->Signal();
+  this->Mutex.Unlock();
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int SendQueue::Acquire()
+{
+  this->Mutex.Lock();
+  while (this->Running && !this->Closed && (this->Writing || this->QueuedBytes > 0))
+    {
+    this->Drained->Wait(&(this->Mutex));
+    }
+  int r = (this->Running && !this->Closed) ? 1 : 0;
+  if (r)
+    {
+    this->Acquired = 1;
+    }
+  this->Mutex.Unlock();
+
+  return r;
+}
+
+//-----------------------------------------------------------------------------
+void SendQueue::Release()
+{
+  this->Mutex.Lock();
+  this->Acquired = 0;
+  this->Ready->Signal();
+  this->Mutex.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+int SendQueue::NextPriority()
+{
+  int next = -1;
+  for (int i = 0; i < NUM_PRIORITIES; i ++)
+    {
+    if (this->Queues[i].empty())
+      {
+      continue;
+      }
+    if (next < 0)
+      {
+      next = i;
+      }
+    else if (this->Skipped[i] >= this->StarvationLimit)
+      {
+      // Lower class waited long enough
+      next = i;
+      break;
+      }
+    }
+
+  for (int i = next + 1; i < NUM_PRIORITIES; i ++)
+    {
+    if (!this->Queues[i].empty())
+      {
+      this->Skipped[i] ++;
+      }
+    }
+  this->Skipped[next] = 0;
+
+  return next;
+}
+
+//-----------------------------------------------------------------------------
+void SendQueue::ReleaseQueued()
+{
+  if (this->memoryBudget.IsNotNull())
+    {
+    this->memoryBudget->Release(this->QueuedBytes);
+    }
+  this->QueuedBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+void SendQueue::WriterThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  SendQueue * queue = static_cast<SendQueue *>(info->UserData);
+
+  queue->Mutex.Lock();
+  while (queue->Running)
+    {
+    if (queue->Acquired || queue->QueuedBytes == 0)
+      {
+      queue->Ready->Wait(&(queue->Mutex));
+      continue;
+      }
+
+    int priority = queue->NextPriority();
+    igtl::MessageBase::Pointer msg = queue->Queues[priority].front();
+    queue->Queues[priority].pop_front();
+    queue->Writing = 1;
+    queue->Mutex.Unlock();
+
+    int r = queue->transport->Send(msg->GetPackPointer(), msg->GetPackSize());
+
+    queue->Mutex.Lock();
+    queue->Writing = 0;
+    // Already released if the queue has been cleared by Stop().
+    if (queue->QueuedBytes >= msg->GetPackSize())
+      {
+      queue->QueuedBytes -= msg->GetPackSize();
+      if (queue->memoryBudget.IsNotNull())
+        {
+        queue->memoryBudget->Release(msg->GetPackSize());
+        }
+      }
+    if (!r)
+      {
+      queue->Closed = 1;
+      for (int i = 0; i < NUM_PRIORITIES; i ++)
+        {
+        queue->Queues[i].clear();
+        }
+      queue->ReleaseQueued();
+      }
+    queue->Drained->Broadcast();
+    }
+  queue->Mutex.Unlock();
+}
+
+} // End of igtl namespace
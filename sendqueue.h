@@ -0,0 +1,134 @@
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <deque>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMessageBase.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+#include "transport.h"
+#include "budget.h"
+
+namespace igtl
+{
+
+// SendQueue decouples receiving messages from sending them to a transport.
+// Packed messages are queued by priority class and sent by a writer thread,
+// which takes the next message from the highest class that has one. Pose
+// and control messages received while an image is waiting are therefore
+// sent ahead of it. To avoid starving a lower class, a waiting message of
+// that class is sent after 'StarvationLimit' messages of higher classes.
+//
+// A message that is already being sent is never interrupted, since the
+// messages cannot be interleaved on the wire.
+class IGTLCommon_EXPORT SendQueue : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::SendQueue, igtl::Object)
+  igtlNewMacro(igtl::SendQueue);
+
+  enum {
+    PRIORITY_POSE    = 0, // TRANSFORM, POSITION, QTRANS, TDATA, QTDATA
+    PRIORITY_CONTROL = 1, // STATUS, STRING, COMMAND, GET_/STT_/STP_/RTS_, ...
+    PRIORITY_BULK    = 2, // IMAGE, VIDEO, NDARRAY, POLYDATA, ...
+    NUM_PRIORITIES   = 3
+  };
+
+public:
+
+  virtual const char * GetClassName() { return "SendQueue"; };
+
+  // Returns the priority class of a message type.
+  static int GetPriority(const char * type);
+
+  void SetTransport(igtl::Transport * transport) { this->transport = transport; };
+
+  void SetStarvationLimit(int n) { this->StarvationLimit = n; };
+  int  GetStarvationLimit()      { return this->StarvationLimit; };
+
+  // Send() blocks while more than 'size' bytes are queued.
+  void SetMaximumQueuedBytes(igtlUint64 size) { this->MaximumQueuedBytes = size; };
+
+  // Queued messages are charged to 'budget' until they have been sent.
+  void SetMemoryBudget(igtl::MemoryBudget * budget) { this->memoryBudget = budget; };
+
+  int  Start();
+  void Stop();
+
+  // Queues a packed message in the lane 'priority' (-1: by message type).
+  // The message must not be modified afterwards. Returns 0 if the
+  // transport has been closed.
+  int  Send(igtl::MessageBase * msg, int priority = -1);
+
+  // Waits until all queued messages have been sent and keeps the writer
+  // idle until Release(), so that the caller can write to the transport
+  // directly (e.g. to stream a message). Returns 0 if the transport has
+  // been closed.
+  int  Acquire();
+  void Release();
+
+  int  IsClosed() { return this->Closed; };
+
+protected:
+
+  SendQueue();
+  ~SendQueue();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  // Returns the class to send next. Called with 'Mutex' held.
+  int            NextPriority();
+
+  // Forgets the queued bytes. Called with 'Mutex' held after clearing
+  // the queues.
+  void           ReleaseQueued();
+
+  static void    WriterThreadFunction(void * ptr);
+
+protected:
+
+  igtl::Transport::Pointer     transport;
+
+  int                          StarvationLimit;
+  igtlUint64                   MaximumQueuedBytes;
+
+  igtl::MemoryBudget::Pointer  memoryBudget;
+
+  igtl::SimpleMutexLock        Mutex;
+  igtl::ConditionVariable::Pointer Ready;   // Signaled when the writer has work
+  igtl::ConditionVariable::Pointer Drained; // Signaled when a message has been sent
+
+  std::deque<igtl::MessageBase::Pointer> Queues[NUM_PRIORITIES];
+  int                          Skipped[NUM_PRIORITIES];
+  igtlUint64                   QueuedBytes;   // Including the message being sent
+
+  int                          Running;
+  int                          Writing;
+  int                          Acquired;
+  int                          Closed;
+
+  igtl::MultiThreader::Pointer Threader;
+  int                          ThreadID;
+
+};
+
+}
+
+#endif // SENDQUEUE_H
@@ -6,10 +6,12 @@
 
 
 #include "session.h"
+#include "registration.h"
+#include "wire.h"
+#include "clock.h"
 
 #include "igtlMultiThreader.h"
 #include "igtlOSUtil.h"
-#include "igtlTimeStamp.h"
 
 #include "igtlMessageHeader.h"
 #include "igtlTransformMessage.h"
@@ -17,6 +19,7 @@
 #include "igtlImageMessage.h"
 #include "igtlClientSocket.h"
 #include "igtlStatusMessage.h"
+#include "igtl_util.h"
 
 #if OpenIGTLink_PROTOCOL_VERSION >= 2
 #include "igtlBindMessage.h"
@@ -34,6 +37,107 @@
 namespace igtl
 {
 
+//-----------------------------------------------------------------------------
+// Beginning of the log line of a message: direction, arrival and message
+// time stamps, device name and type.
+static void FormatLogPrefix(std::ostream & os, const std::string & name, igtl::MessageHeader * header,
+                            igtlInt64 arrivalTime, igtlUint32 secMsg, igtlUint32 nanosecMsg)
+{
+  igtlUint32 secSys     = (igtlUint32) (arrivalTime / 1000000000LL);
+  igtlUint32 nanosecSys = (igtlUint32) (arrivalTime % 1000000000LL);
+
+  os << name << ", "
+     << secSys << "." << std::setw(9) << std::setfill('0') << nanosecSys << ", "
+     << secMsg << "." << std::setw(9) << std::setfill('0') << nanosecMsg << ", "
+     << header->GetDeviceName() << ", " << header->GetDeviceType() << ", ";
+}
+
+
+//-----------------------------------------------------------------------------
+// The log line of a message, written by a decoder thread once the message
+// has been forwarded.
+class MessageLogJob : public DecodeJob
+{
+public:
+
+  MessageLogJob(const std::string & name, igtl::MessageHeader * header,
+                igtlInt64 arrivalTime, igtlUint32 secMsg, igtlUint32 nanosecMsg)
+    : Name(name), Header(header), ArrivalTime(arrivalTime), SecMsg(secMsg), NanosecMsg(nanosecMsg),
+      Decode(NULL), Size(0)
+  {
+  };
+
+  ~MessageLogJob()
+  {
+    this->ReleaseMessage();
+  };
+
+  void Append(const std::string & text)
+  {
+    this->Text += text;
+  };
+
+  // 'msg' is decoded by 'decode' after the text. It counts toward 'budget'
+  // while it waits; it is not kept if the budget is used up.
+  void SetMessage(igtl::MessageBase * msg, igtl::SummaryTable::Formatter decode, igtl::MemoryBudget * budget)
+  {
+    igtlUint64 size = msg->GetPackSize();
+    if (budget && !budget->TryCharge(size))
+      {
+      this->Text += "Not decoded (memory limit)\n";
+      return;
+      }
+    this->Message = msg;
+    this->Decode  = decode;
+    this->Budget  = budget;
+    this->Size    = size;
+  };
+
+  virtual void Run(std::ostream & os)
+  {
+    FormatLogPrefix(os, this->Name, this->Header, this->ArrivalTime, this->SecMsg, this->NanosecMsg);
+    os << this->Text;
+    if (this->Message.IsNotNull())
+      {
+      this->Decode(this->Message, os);
+      os << std::endl;
+      this->ReleaseMessage();
+      }
+  };
+
+  virtual void Discard()
+  {
+    if (this->Message.IsNotNull())
+      {
+      this->ReleaseMessage();
+      this->Text += "Not decoded (decoders busy)\n";
+      }
+  };
+
+protected:
+
+  void ReleaseMessage()
+  {
+    if (this->Message.IsNotNull() && this->Budget.IsNotNull())
+      {
+      this->Budget->Release(this->Size);
+      }
+    this->Message = NULL;
+  };
+
+  std::string                   Name;
+  igtl::MessageHeader::Pointer  Header;
+  igtlInt64                     ArrivalTime;
+  igtlUint32                    SecMsg;
+  igtlUint32                    NanosecMsg;
+  std::string                   Text;
+  igtl::MessageBase::Pointer    Message;
+  igtl::SummaryTable::Formatter Decode;
+  igtl::MemoryBudget::Pointer   Budget;
+  igtlUint64                    Size;
+};
+
+
 //-----------------------------------------------------------------------------
 Session::Session()
 {
@@ -46,6 +150,36 @@ Session::Session()
   this->toLock = NULL;
 
   this->logger = NULL;
+  this->imageDecimator = NULL;
+  this->ruleManager = NULL;
+  this->ruleSlot = -1;
+  this->rules = NULL;
+  this->sourceMonitor = NULL;
+  this->streamThreshold = 0;
+  this->workerPool = NULL;
+  this->sendQueue = NULL;
+  this->rateLimiter = igtl::RateLimiter::New();
+  this->duplicateFilter = NULL;
+  this->responseCache = NULL;
+  this->queryCache = NULL;
+  this->replyQueue = NULL;
+  this->trafficTap = NULL;
+  this->impairment = NULL;
+  this->router = NULL;
+  this->trafficSummary = NULL;
+  this->summaryTable = NULL;
+  this->memoryBudget = NULL;
+  this->dropOnMemoryLimit = 0;
+  this->decoderPool = NULL;
+  this->logChannel = NULL;
+  this->headerVersion = 1;
+  this->arrivalTime = 0;
+  this->arrivalTicks = 0;
+  this->logJob = NULL;
+  this->pooled = 0;
+  this->deferral = DEFER_NONE;
+  this->resumeTime = 0;
+  this->pauseTime = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -59,7 +193,7 @@ void Session::PrintSelf(std::ostream& os) const
   this->Superclass::PrintSelf(os);
 }
 
-int Session::Start()
+int Session::Initialize()
 {
   if (!this->fromSocket)
     {
@@ -91,20 +225,69 @@ int Session::Start()
     return 0;
     }
 
+  if (!this->ruleManager)
+    {
+    std::cerr << "ERROR: no rule manager" << std::endl;
+    return 0;
+    }
+
   if (this->Active == 0)
     {
+    this->ruleSlot = this->ruleManager->RegisterReader();
+    if (this->ruleSlot < 0)
+      {
+      std::cerr << "ERROR: too many sessions" << std::endl;
+      return 0;
+      }
+    if (this->router.IsNotNull())
+      {
+      Destination d;
+      d.to       = this->toSocket;
+      d.lock     = this->toLock;
+      d.queue    = this->sendQueue;
+      d.emulator = this->impairment;
+      this->destinations.insert(this->destinations.begin(), d);
+      }
+    if (this->trafficSummary.IsNotNull())
+      {
+      this->summaryTable = this->trafficSummary->AddTable(this->Name.c_str());
+      }
+    else if (this->decoderPool.IsNotNull())
+      {
+      this->logChannel = igtl::LogChannel::New();
+      }
     this->Active = 1;
-    this->Threader->SpawnThread((igtl::ThreadFunctionType) &Session::MonitorThreadFunction, this);
     return 1;
     }
   else
     {
-    std::cerr << "ERROR: the thread is already running" << std::endl;
+    std::cerr << "ERROR: the session is already active" << std::endl;
     return 0;
     }
 }
 
 
+//-----------------------------------------------------------------------------
+int Session::Start()
+{
+  if (!this->Initialize())
+    {
+    return 0;
+    }
+
+  // Set first; the pool may process the session as soon as it is added.
+  this->pooled = 1;
+  if (this->workerPool &&
+      this->workerPool->AddSession(this, this->fromSocket->GetDescriptor()))
+    {
+    return 1;
+    }
+  this->pooled = 0;
+  this->Threader->SpawnThread((igtl::ThreadFunctionType) &Session::MonitorThreadFunction, this);
+  return 1;
+}
+
+
 //-----------------------------------------------------------------------------
 void Session::MonitorThreadFunction(void * ptr)
 {
@@ -121,43 +304,111 @@ void Session::MonitorThreadFunction(void * ptr)
 
   while (con->Active)
     {
-    int r;
-    r = con->Process();
-    if (r == 1)
-      {
-      std::cerr << "Connection closed by the 'from' host." << std::endl;
-      con->Active = 0;
-      }
-    else if (r == 2)
+    con->ProcessNext();
+    }
+
+  con->FinishProcessing();
+}
+
+
+//-----------------------------------------------------------------------------
+void Session::Stop()
+{
+  this->Active = 0;
+  if (this->workerPool)
+    {
+    this->workerPool->RemoveSession(this);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+void Session::AddDestination(igtl::Transport * to, igtl::MutexLock * lock,
+                             igtl::SendQueue * queue, igtl::ImpairmentEmulator * emulator)
+{
+  Destination d;
+  d.to       = to;
+  d.lock     = lock;
+  d.queue    = queue;
+  d.emulator = emulator;
+  this->destinations.push_back(d);
+}
+
+
+//-----------------------------------------------------------------------------
+void Session::SelectDestination(int i)
+{
+  if (i < 0 || i >= (int) this->destinations.size())
+    {
+    i = 0;
+    }
+  const Destination & d = this->destinations[i];
+  this->toSocket   = d.to;
+  this->toLock     = d.lock;
+  this->sendQueue  = d.queue;
+  this->impairment = d.emulator;
+}
+
+
+//-----------------------------------------------------------------------------
+int Session::ProcessNext()
+{
+  int r = this->Process();
+  if (this->logJob && r != 4)
+    {
+    this->decoderPool->Submit(this->logChannel, this->logJob);
+    this->logJob = NULL;
+    }
+  if (!this->logLine.empty() && r != 4)
+    {
+    if (this->logLine[this->logLine.size() - 1] != '\n')
       {
-      std::cerr << "Connection closed by the 'to' host." << std::endl;
-      con->Active = 0;
+      this->logLine.append("\n");
       }
+    this->logger->Print(this->logLine);
+    this->logLine.clear();
     }
-
-  con->Active = 0;
+  if (r == 1)
+    {
+    std::cerr << "Connection closed by the 'from' host." << std::endl;
+    this->Active = 0;
+    }
+  else if (r == 2)
+    {
+    std::cerr << "Connection closed by the 'to' host." << std::endl;
+    this->Active = 0;
+    }
+  return this->Active;
 }
 
 
-int Session::Process()
+//-----------------------------------------------------------------------------
+void Session::FinishProcessing()
 {
-  // Return 0: Normal
-  // Return 1: Closed by the 'from' host
-  // Return 2: Closed by the 'to' host
-  // Return 3: Size error
+  if (this->ruleSlot >= 0)
+    {
+    this->ruleManager->UnregisterReader(this->ruleSlot);
+    this->ruleSlot = -1;
+    }
+  if (this->summaryTable.IsNotNull())
+    {
+    this->summaryTable->Close();
+    }
+  // A deferred message is not finished.
+  delete this->logJob;
+  this->logJob   = NULL;
+  this->logLine.clear();
+  this->deferral = DEFER_NONE;
+  this->Active = 0;
+}
+
 
+int Session::ReceiveHeader()
+{
   // Create a message buffer to receive header
   igtl::MessageHeader::Pointer headerMsg;
   headerMsg = igtl::MessageHeader::New();
 
-  //------------------------------------------------------------
-  // Allocate a time stamp
-  igtl::TimeStamp::Pointer tsMsg;
-  tsMsg = igtl::TimeStamp::New();
-
-  igtl::TimeStamp::Pointer tsSys;
-  tsSys = igtl::TimeStamp::New();
-
   // Initialize receive buffer
   headerMsg->InitPack();
 
@@ -187,635 +438,739 @@ int Session::Process()
     std::cerr << "Large header" << std::endl;
     }
 
+  this->headerVersion = GetUint16BE(dummy + WIRE_HEADER_VERSION_OFFSET);
+  this->arrivalTime   = igtl::Clock::Now();
+  this->arrivalTicks  = igtl::Clock::Ticks();
+  memcpy(this->rawHeader, dummy, IGTL_HEADER_SIZE);
+  this->header        = headerMsg;
+
   // Deserialize the header
   headerMsg->Unpack();
 
   // Get time stamp
   igtlUint32 secMsg;
   igtlUint32 nanosecMsg;
-  igtlUint32 secSys;
-  igtlUint32 nanosecSys;
-
-  headerMsg->GetTimeStamp(tsMsg);
-  tsMsg->GetTimeStamp(&secMsg, &nanosecMsg);
-
-  tsSys->GetTime();
-  tsSys->GetTimeStamp(&secSys, &nanosecSys);
 
-  std::stringstream ss;
-  ss << this->Name << ", "
-     << secSys << "." << std::setw(9) << std::setfill('0') << nanosecSys << ", "
-     << secMsg << "." << std::setw(9) << std::setfill('0') << nanosecMsg << ", "
-     << headerMsg->GetDeviceName() << ", " << headerMsg->GetDeviceType() << ", ";
+  // Seconds and fraction of a second (1/2^32 s) in the packed header
+  secMsg     = GetUint32BE(dummy + WIRE_TIMESTAMP_OFFSET);
+  nanosecMsg = igtl_frac_to_nanosec(GetUint32BE(dummy + WIRE_TIMESTAMP_OFFSET + 4));
 
-  this->logger->Print(ss.str());
-
-  // Check if the message type is blacklisted
-  std::vector<std::string>::iterator it;
-  for (it = this->blackList.begin(); it != this->blackList.end(); it ++)
+  if (this->summaryTable.IsNotNull())
     {
-    if (strcmp(headerMsg->GetDeviceType(), (*it).c_str()) == 0)
-      {
-      std::stringstream ss;
-      ss << "Blocked message type detected: " << headerMsg->GetDeviceType() << std::endl;
-      igtlUint64 remain = headerMsg->GetBodySizeToRead();
-      ss << "  Body size = " << remain << std::endl;
-      igtlUint64 block  = 256;
-      igtlUint64 n = 0;
-      do
-        {
-        if (remain < block)
-          {
-          block = remain;
-          }
-
-        bool timeout(false);
-        n = fromSocket->Receive(dummy, block, timeout, 0);
-        if (n <= 0)
-          {
-          break;
-          }
-        remain -= n;
-        }
-      while (remain > 0);
-      return 0;
-      }
+    this->summaryTable->Update(headerMsg->GetDeviceType(), headerMsg->GetDeviceName(),
+                               IGTL_HEADER_SIZE + headerMsg->GetBodySizeToRead(), this->arrivalTicks);
+    }
+  else if (this->logChannel.IsNotNull())
+    {
+    // The line is formatted by a decoder thread.
+    this->logJob = new igtl::MessageLogJob(this->Name, headerMsg, this->arrivalTime, secMsg, nanosecMsg);
+    }
+  else
+    {
+    // The line is printed whole once the message is done, so that lines of
+    // other sessions or a dropped fragment cannot split it.
+    std::stringstream ss;
+    FormatLogPrefix(ss, this->Name, headerMsg, this->arrivalTime, secMsg, nanosecMsg);
+    this->logLine = ss.str();
     }
 
-  // Check data type and receive data body
-  if (strcmp(headerMsg->GetDeviceType(), "TRANSFORM") == 0)
+  if (this->sourceMonitor.IsNotNull())
     {
-    ReceiveTransform(headerMsg);
+    this->sourceMonitor->Update(this->Name.c_str(), headerMsg->GetDeviceName(), headerMsg->GetDeviceType(),
+                                this->arrivalTicks, this->arrivalTime,
+                                (igtlInt64) secMsg * 1000000000LL + nanosecMsg);
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "POSITION") == 0)
+
+  // The rest of the message goes to the upstream chosen by the router.
+  if (this->router.IsNotNull())
     {
-    ReceivePosition(headerMsg);
+    this->SelectDestination(this->router->Find(headerMsg->GetDeviceType(), headerMsg->GetDeviceName()));
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "IMAGE") == 0)
+
+  return 0;
+}
+
+
+int Session::Process()
+{
+  // Return 0: Normal
+  // Return 1: Closed by the 'from' host
+  // Return 2: Closed by the 'to' host
+  // Return 3: Size error
+  // Return 4: Deferred; the next call resumes the message (see GetDeferral())
+
+  // A deferred message is resumed after the stage that deferred it.
+  int resume = this->deferral;
+  this->deferral = DEFER_NONE;
+  if (resume == DEFER_NONE)
     {
-    ReceiveImage(headerMsg);
+    int r = this->ReceiveHeader();
+    if (r != 0)
+      {
+      return r;
+      }
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "STATUS") == 0)
+  igtl::MessageHeader::Pointer headerMsg = this->header;
+
+  // The rule set may be swapped by a reload at any time; the snapshot
+  // taken here is valid until LeaveReader() after the message is forwarded.
+  this->rules = this->ruleManager->EnterReader(this->ruleSlot);
+
+  // Check if the message type is blacklisted
+  if (this->rules->IsBlocked(headerMsg->GetDeviceType()))
     {
-    ReceiveStatus(headerMsg);
+    std::stringstream ss;
+    ss << "Blocked message type detected: " << headerMsg->GetDeviceType() << std::endl;
+    ss << "  Body size = " << headerMsg->GetBodySizeToRead() << std::endl;
+    this->SkipBody(headerMsg->GetBodySizeToRead());
+    this->ruleManager->LeaveReader(this->ruleSlot);
+    return 0;
     }
-#if OpenIGTLink_PROTOCOL_VERSION >= 2
-  else if (strcmp(headerMsg->GetDeviceType(), "POINT") == 0)
+
+  // Token-bucket rate limits
+  if (resume == DEFER_NONE && this->rules->HasRateLimits())
     {
-    ReceivePoint(headerMsg);
+    igtlInt64 wait = this->rateLimiter->Admit(this->rules, headerMsg->GetDeviceName(), headerMsg->GetDeviceType(),
+                                              this->arrivalTicks);
+    if (wait != 0 && this->sourceMonitor.IsNotNull())
+      {
+      this->sourceMonitor->UpdateShaped(this->Name.c_str(), headerMsg->GetDeviceName(), headerMsg->GetDeviceType(),
+                                        wait == igtl::RateLimiter::DROP);
+      }
+    if (wait == igtl::RateLimiter::DROP)
+      {
+      this->Log("Dropped by rate limit\n");
+      int rs = this->SkipBody(headerMsg->GetBodySizeToRead());
+      this->ruleManager->LeaveReader(this->ruleSlot);
+      return rs;
+      }
+    else if (wait > 0 && this->pooled)
+      {
+      // The worker is not held while waiting; the pool resumes the
+      // message when it is due.
+      this->deferral   = DEFER_RATE;
+      this->resumeTime = this->arrivalTicks + wait;
+      this->ruleManager->LeaveReader(this->ruleSlot);
+      return 4;
+      }
+    else if (wait > 0)
+      {
+      // Do not hold the rule set while waiting. Rounded up so that waits
+      // shorter than 1 ms are not skipped.
+      this->ruleManager->LeaveReader(this->ruleSlot);
+      igtl::Sleep((int) ((wait + 999999) / 1000000));
+      this->rules = this->ruleManager->EnterReader(this->ruleSlot);
+      }
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "TRAJ") == 0)
+
+  // Queries answered from the cache
+  const char * replyType = igtl::ResponseCache::GetReplyType(headerMsg->GetDeviceType());
+  if (resume != DEFER_MEMORY && this->queryCache.IsNotNull() && replyType)
     {
-    ReceiveTrajectory(headerMsg);
+    igtl::MessageBase::Pointer reply =
+      this->queryCache->Find(replyType, headerMsg->GetDeviceName(), this->arrivalTicks);
+    if (reply.IsNotNull())
+      {
+      this->Log("Answered from cache\n");
+      int rs = this->SkipBody(headerMsg->GetBodySizeToRead());
+      this->Reply(reply);
+      this->ruleManager->LeaveReader(this->ruleSlot);
+      return rs;
+      }
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "STRING") == 0)
+
+  // Large messages are forwarded while they are being received, as are
+  // those that can never fit in the memory budget, unless an emulator has
+  // to hold them.
+  igtlUint64 charge = IGTL_HEADER_SIZE + headerMsg->GetBodySizeToRead();
+  if ((this->streamThreshold > 0 && headerMsg->GetBodySizeToRead() > this->streamThreshold) ||
+      (this->memoryBudget.IsNotNull() && this->impairment.IsNull() && !this->memoryBudget->Fits(charge)))
     {
-    ReceiveString(headerMsg);
+    // The streamed message takes the 'to' transport after the queued messages.
+    int rs = 2;
+    if (this->AcquireTo())
+      {
+      rs = this->StreamMessage(headerMsg, this->rawHeader);
+      this->ReleaseTo();
+      }
+    this->ruleManager->LeaveReader(this->ruleSlot);
+    return rs;
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "BIND") == 0)
+
+  // The body is buffered until it is forwarded; it must fit in the budget.
+  int charged = this->memoryBudget.IsNotNull() ? this->ChargeMemory(charge, resume) : 1;
+  if (charged < 0)
     {
-    ReceiveBind(headerMsg);
+    this->ruleManager->LeaveReader(this->ruleSlot);
+    return 4;
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "CAPABILITY") == 0)
+  if (charged == 0)
     {
-    ReceiveCapability(headerMsg);
+    this->Log("Dropped by memory limit\n");
+    int rs = this->SkipBody(headerMsg->GetBodySizeToRead());
+    this->ruleManager->LeaveReader(this->ruleSlot);
+    return rs;
     }
-  else if (strcmp(headerMsg->GetDeviceType(), "TDATA") == 0)
+
+  // Check data type and receive data body
+  Handler handler = FindHandler(headerMsg->GetDeviceType());
+  if (handler)
     {
-    ReceiveTrackingData(headerMsg);
+    (this->*handler)(headerMsg);
     }
-#endif //OpenIGTLink_PROTOCOL_VERSION >= 2
   else
     {
-    // if the data type is unknown, skip reading.
-    //std::cerr << "Receiving : " << headerMsg->GetDeviceType() << std::endl;
-    //std::cerr << "Size : " << headerMsg->GetBodySizeToRead() << std::endl;
-    //
-    toSocket->Send(dummy, headerLength);
-
-    //fromSocket->Skip(headerMsg->GetBodySizeToRead(), 0);
-    igtlUint64 remain = headerMsg->GetBodySizeToRead();
-    igtlUint64 block  = 256;
-    igtlUint64 n = 0;
-
+    // If the data type is unknown, the message is forwarded as received,
+    // through the same stages (emulator, queue, tap) as the others.
     std::cerr << "Unrecognized data type: " << headerMsg->GetDeviceType() << std::endl;
-    std::cerr << "Size: " << remain << std::endl;
+    std::cerr << "Size: " << headerMsg->GetBodySizeToRead() << std::endl;
     std::cerr << "Content: " << std::endl;
-    for (int i = 0; i < remain; i ++)
+    for (int i = 0; i < IGTL_HEADER_SIZE; i ++)
       {
-      std::cerr << std::hex << std::setw(2) << std::setfill('0') << (int)dummy[i] << " ";
+      std::cerr << std::hex << std::setw(2) << std::setfill('0') << (int)this->rawHeader[i] << " ";
       if (i % 16 == 15)
         {
         std::cerr << std::endl;
         }
       }
+    std::cerr << std::dec;
 
-    do
+    igtl::MessageBase::Pointer msg = igtl::MessageBase::New();
+    msg->SetMessageHeader(headerMsg);
+    msg->AllocatePack();
+    if (!this->ReceiveBody(msg))
       {
-      if (remain < block)
-        {
-        block = remain;
-        }
-
-      bool timeout(false);
-      n = fromSocket->Receive(dummy, block, timeout, 0);
-      toSocket->Send(dummy, n);
-      if (n <= 0)
-        {
-        break;
-        }
-      remain -= n;
+      memcpy(msg->GetPackPointer(), this->rawHeader, IGTL_HEADER_SIZE);
+      this->Forward(msg, SendQueue::PRIORITY_BULK);
       }
-    while (remain > 0);
 
-    std::stringstream ss;
-    ss << std::endl;
-    if (this->logger.IsNotNull())
-      {
-      this->logger->Print(ss.str());
-      }
+    this->Log("\n");
     }
 
+  if (this->memoryBudget.IsNotNull())
+    {
+    this->memoryBudget->Release(charge);
+    }
+
+  this->ruleManager->LeaveReader(this->ruleSlot);
+
+  if (this->sendQueue.IsNotNull() && this->sendQueue->IsClosed())
+    {
+    return 2;
+    }
   return 0;
 }
 
 
-int Session::ReceiveTransform(igtl::MessageHeader * header)
+void Session::Log(const std::string & msg)
 {
-  // Create a message buffer to receive transform data
-  igtl::TransformMessage::Pointer transMsg;
-  transMsg = igtl::TransformMessage::New();
-  transMsg->SetMessageHeader(header);
-  transMsg->AllocatePack();
-
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(transMsg->GetPackBodyPointer(), transMsg->GetPackBodySize(), timeout);
-
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = transMsg->Unpack(1);
-
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  if (this->logJob)
     {
-    std::stringstream ss;
-
-    // Retrive the transform data
-    igtl::Matrix4x4 matrix;
-    transMsg->GetMatrix(matrix);
-    //igtl::PrintMatrix(matrix);
-    ss << "Matrix=("
-       << matrix[0][0] << ", " << matrix[1][0] << ", " << matrix[2][0] << ", " << matrix[3][0] << ", "
-       << matrix[0][1] << ", " << matrix[1][1] << ", " << matrix[2][1] << ", " << matrix[3][1] << ", "
-       << matrix[0][2] << ", " << matrix[1][2] << ", " << matrix[2][2] << ", " << matrix[3][2] << ", "
-       << matrix[0][3] << ", " << matrix[1][3] << ", " << matrix[2][3] << ", " << matrix[3][3] << ")" << std::endl;
-
-    this->logger->Print(ss.str());
-    transMsg->Pack();
-    toSocket->Send(transMsg->GetPackPointer(), transMsg->GetPackSize());
-
-    return 1;
+    this->logJob->Append(msg);
+    }
+  else if (this->summaryTable.IsNull())
+    {
+    this->logLine.append(msg);
     }
+}
 
 
+int Session::SkipBody(igtlUint64 size)
+{
+  unsigned char buf[256];
+  igtlUint64 remain = size;
+  while (remain > 0)
+    {
+    igtlUint64 block = (remain < sizeof(buf)) ? remain : sizeof(buf);
+    bool timeout(false);
+    igtlUint64 n = this->fromSocket->Receive(buf, block, timeout, 0);
+    if (n == 0)
+      {
+      return 1;
+      }
+    remain -= n;
+    }
   return 0;
-
 }
 
 
-int Session::ReceivePosition(igtl::MessageHeader * header)
+int Session::ReceiveBody(igtl::MessageBase * msg)
 {
-  // Create a message buffer to receive transform data
-  igtl::PositionMessage::Pointer positionMsg;
-  positionMsg = igtl::PositionMessage::New();
-  positionMsg->SetMessageHeader(header);
-  positionMsg->AllocatePack();
-
-  // Receive position position data from the socket
   bool timeout(false);
-  this->fromSocket->Receive(positionMsg->GetPackBodyPointer(), positionMsg->GetPackBodySize(), timeout);
-
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = positionMsg->Unpack(1);
+  this->fromSocket->Receive(msg->GetPackBodyPointer(), msg->GetPackBodySize(), timeout);
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  // Compared before Unpack(), which may convert the body in place.
+  if (this->duplicateFilter.IsNotNull() &&
+      this->duplicateFilter->IsDuplicate(msg->GetDeviceType(), msg->GetDeviceName(), this->headerVersion,
+                                         msg->GetPackBodyPointer(), msg->GetPackBodySize(), this->arrivalTicks))
     {
-    // Retrive the transform data
-    float position[3];
-    float quaternion[4];
-
-    positionMsg->GetPosition(position);
-    positionMsg->GetQuaternion(quaternion);
-
-    std::stringstream ss;
-    ss << "position=(" << position[0] << ", " << position[1] << ", " << position[2] << "),"
-       << "quaternion=(" << quaternion[0] << ", " << quaternion[1] << ", " << quaternion[2] << ", " << quaternion[3] << ")" << std::endl;
-
-    this->logger->Print(ss.str());
-    positionMsg->Pack();
-    toSocket->Send(positionMsg->GetPackPointer(), positionMsg->GetPackSize());
-
+    if (this->responseCache.IsNotNull())
+      {
+      this->responseCache->Touch(msg->GetDeviceType(), msg->GetDeviceName(), this->arrivalTicks);
+      }
+    this->Log("Suppressed duplicate\n");
     return 1;
     }
-
   return 0;
-
 }
 
 
-int Session::ReceiveImage(igtl::MessageHeader * header)
+int Session::Forward(igtl::MessageBase * msg, int priority)
 {
-  // Create a message buffer to receive transform data
-  igtl::ImageMessage::Pointer imgMsg;
-  imgMsg = igtl::ImageMessage::New();
-  imgMsg->SetMessageHeader(header);
-  imgMsg->AllocatePack();
-
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(imgMsg->GetPackBodyPointer(), imgMsg->GetPackBodySize(), timeout);
-
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = imgMsg->Unpack(1);
-
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  if (this->responseCache.IsNotNull())
     {
-    // Retrive the image data
-    int   size[3];          // image dimension
-    float spacing[3];       // spacing (mm/pixel)
-    int   svsize[3];        // sub-volume size
-    int   svoffset[3];      // sub-volume offset
-    int   scalarType;       // scalar type
-    int   endian;           // endian
-
-    scalarType = imgMsg->GetScalarType();
-    endian = imgMsg->GetEndian();
-    imgMsg->GetDimensions(size);
-    imgMsg->GetSpacing(spacing);
-    imgMsg->GetSubVolume(svsize, svoffset);
-
-    std::stringstream ss;
-    ss << "Endian=" << endian << ", "
-       << "Dimensions=("
-       << size[0] << ", " << size[1] << ", " << size[2] << "), "
-       << "Spacing=(" << spacing[0] << ", " << spacing[1] << ", " << spacing[2] << "), "
-       << "SubVolumeDimension=(" << svsize[0] << ", " << svsize[1] << ", " << svsize[2] << "), "
-       << "SubVolumeOffset=(" << svoffset[0] << ", " << svoffset[1] << ", " << svoffset[2] << ")" << std::endl;
-    this->logger->Print(ss.str());
-
-    imgMsg->Pack();
-    toSocket->Send(imgMsg->GetPackPointer(), imgMsg->GetPackSize());
-
-    return 1;
+    const char * pack = (const char *) msg->GetPackPointer();
+    char type[IGTL_HEADER_TYPE_SIZE + 1];
+    char name[IGTL_HEADER_NAME_SIZE + 1];
+    memcpy(type, pack + WIRE_DEVICE_TYPE_OFFSET, IGTL_HEADER_TYPE_SIZE);
+    memcpy(name, pack + WIRE_DEVICE_NAME_OFFSET, IGTL_HEADER_NAME_SIZE);
+    type[IGTL_HEADER_TYPE_SIZE] = '\0';
+    name[IGTL_HEADER_NAME_SIZE] = '\0';
+    if (igtl::ResponseCache::IsCacheable(type))
+      {
+      this->responseCache->Store(msg, type, name, this->arrivalTicks);
+      }
     }
 
-  return 0;
+  int r;
+  if (this->impairment.IsNotNull())
+    {
+    r = this->impairment->Send(msg, priority);
+    }
+  else if (this->sendQueue.IsNotNull())
+    {
+    r = this->sendQueue->Send(msg, priority);
+    }
+  else
+    {
+    this->toLock->Lock();
+    r = this->toSocket->Send(msg->GetPackPointer(), msg->GetPackSize());
+    this->toLock->Unlock();
+    }
 
+  // Mirrored after the message has been handed to the 'to' side.
+  if (this->trafficTap.IsNotNull())
+    {
+    this->trafficTap->Mirror(msg);
+    }
+  return r;
 }
 
 
-int Session::ReceiveStatus(igtl::MessageHeader * header)
+int Session::ChargeMemory(igtlUint64 size, int resume)
 {
-  // Create a message buffer to receive transform data
-  igtl::StatusMessage::Pointer statusMsg;
-  statusMsg = igtl::StatusMessage::New();
-  statusMsg->SetMessageHeader(header);
-  statusMsg->AllocatePack();
-
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(statusMsg->GetPackBodyPointer(), statusMsg->GetPackBodySize(), timeout);
-
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = statusMsg->Unpack(1);
-
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  int charged = this->memoryBudget->TryCharge(size);
+  int paused  = (resume == DEFER_MEMORY);
+  if (!charged && !paused)
     {
-    std::stringstream ss;
-
-    ss << "Code=" << statusMsg->GetCode() << ", "
-       << "SubCode=" << statusMsg->GetSubCode() << ", "
-       << "ErrorName=" << statusMsg->GetErrorName() << ", "
-       << "Status=" << statusMsg->GetStatusString() << std::endl;
+    if (this->dropOnMemoryLimit || !this->memoryBudget->Fits(size))
+      {
+      return 0;
+      }
 
+    // Backpressure: the 'from' host is not read until the queued messages
+    // have been sent.
+    this->pauseTime = igtl::Clock::Ticks();
+    paused = 1;
+    std::stringstream ss;
+    ss << "# MEMORY " << this->Name << ": limit reached, Usage=" << this->memoryBudget->GetUsage()
+       << " bytes; reading paused" << std::endl;
     this->logger->Print(ss.str());
+    }
 
-    statusMsg->Pack();
-    toSocket->Send(statusMsg->GetPackPointer(), statusMsg->GetPackSize());
-
+  if (!charged && this->pooled)
+    {
+    // The worker is not held while waiting; the pool resumes the message
+    // when memory is released.
+    this->deferral = DEFER_MEMORY;
+    return -1;
     }
 
-  return 0;
+  if (!charged)
+    {
+    // Do not hold the rule set while waiting.
+    this->ruleManager->LeaveReader(this->ruleSlot);
+    while (this->Active && !(charged = this->memoryBudget->TryCharge(size)))
+      {
+      igtl::Sleep(1);
+      }
+    this->rules = this->ruleManager->EnterReader(this->ruleSlot);
+    }
 
+  if (charged && paused)
+    {
+    std::stringstream resumed;
+    resumed << "# MEMORY " << this->Name << ": reading resumed after "
+            << std::fixed << std::setprecision(1) << (double) (igtl::Clock::Ticks() - this->pauseTime) * 1.0e-6 << " ms" << std::endl;
+    this->logger->Print(resumed.str());
+    }
+  return charged;
 }
 
 
-#if OpenIGTLink_PROTOCOL_VERSION >= 2
-int Session::ReceivePoint(igtl::MessageHeader * header)
+int Session::Reply(igtl::MessageBase * msg)
 {
-  // Create a message buffer to receive transform data
-  igtl::PointMessage::Pointer pointMsg;
-  pointMsg = igtl::PointMessage::New();
-  pointMsg->SetMessageHeader(header);
-  pointMsg->AllocatePack();
-
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(pointMsg->GetPackBodyPointer(), pointMsg->GetPackBodySize(), timeout);
-
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = pointMsg->Unpack(1);
-
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  if (this->replyQueue.IsNotNull())
     {
-    std::stringstream ss;
-
-    int nElements = pointMsg->GetNumberOfPointElement();
-    for (int i = 0; i < nElements; i ++)
-      {
-      igtl::PointElement::Pointer pointElement;
-      pointMsg->GetPointElement(i, pointElement);
-
-      igtlUint8 rgba[4];
-      pointElement->GetRGBA(rgba);
+    return this->replyQueue->Send(msg);
+    }
+  this->fromLock->Lock();
+  int r = this->fromSocket->Send(msg->GetPackPointer(), msg->GetPackSize());
+  this->fromLock->Unlock();
+  return r;
+}
 
-      igtlFloat32 pos[3];
-      pointElement->GetPosition(pos);
 
-      ss << "Element=" << i << ", "
-         << "Name=" << pointElement->GetName() << ", "
-         << "GroupName=" << pointElement->GetGroupName() << ", "
-         << "RGBA=( " << (int)rgba[0] << ", " << (int)rgba[1] << ", " << (int)rgba[2] << ", " << (int)rgba[3] << "), "
-         << "Position=(" << std::fixed << pos[0] << ", " << pos[1] << ", " << pos[2] << "), "
-         << "Radius=" << std::fixed << pointElement->GetRadius() << ", "
-         << "Owner=" << pointElement->GetOwner() << ", ";
-      }
-    ss << std::endl;
-    this->logger->Print(ss.str());
+int Session::AcquireTo()
+{
+  if (this->sendQueue.IsNotNull())
+    {
+    return this->sendQueue->Acquire();
+    }
+  this->toLock->Lock();
+  return 1;
+}
 
-    pointMsg->Pack();
-    toSocket->Send(pointMsg->GetPackPointer(), pointMsg->GetPackSize());
 
+void Session::ReleaseTo()
+{
+  if (this->sendQueue.IsNotNull())
+    {
+    this->sendQueue->Release();
+    }
+  else
+    {
+    this->toLock->Unlock();
     }
-
-  return 1;
 }
 
-int Session::ReceiveTrajectory(igtl::MessageHeader::Pointer& header)
+
+int Session::StreamMessage(igtl::MessageHeader * header, const unsigned char * rawHeader)
 {
-  // Create a message buffer to receive transform data
-  igtl::TrajectoryMessage::Pointer trajectoryMsg;
-  trajectoryMsg = igtl::TrajectoryMessage::New();
-  trajectoryMsg->SetMessageHeader(header);
-  trajectoryMsg->AllocatePack();
+  // Size of the chunks forwarded to the 'to' host. The leading part of the
+  // body is received in full so that the image header can be logged.
+  const igtlUint64 chunkSize = 65536;
+  const igtlUint64 leadSize  = 256;
 
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(trajectoryMsg->GetPackBodyPointer(), trajectoryMsg->GetPackBodySize(), timeout);
+  if (this->streamBuffer.size() < chunkSize)
+    {
+    this->streamBuffer.resize(chunkSize);
+    }
+  unsigned char * buf = &(this->streamBuffer[0]);
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = trajectoryMsg->Unpack(1);
+  if (!this->toSocket->Send(rawHeader, IGTL_HEADER_SIZE))
+    {
+    return 2;
+    }
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  // A copy is kept for the tap if it fits in a tap client's queue.
+  igtl::MessageBase::Pointer copy;
+  unsigned char * copyBody = NULL;
+  if (this->trafficTap.IsNotNull() &&
+      IGTL_HEADER_SIZE + header->GetBodySizeToRead() <= this->trafficTap->GetMaximumQueuedBytes())
     {
-    std::stringstream ss;
+    copy = igtl::MessageBase::New();
+    copy->SetMessageHeader(header);
+    copy->AllocatePack();
+    memcpy(copy->GetPackPointer(), rawHeader, IGTL_HEADER_SIZE);
+    copyBody = (unsigned char *) copy->GetPackBodyPointer();
+    }
 
-    int nElements = trajectoryMsg->GetNumberOfTrajectoryElement();
-    for (int i = 0; i < nElements; i ++)
-      {
-      igtl::TrajectoryElement::Pointer trajectoryElement;
-      trajectoryMsg->GetTrajectoryElement(i, trajectoryElement);
+  igtlUint64 remain = header->GetBodySizeToRead();
+  igtlUint64 crc = 0;
+  std::stringstream ss;
+  bool first = true;
 
-      igtlUint8 rgba[4];
-      trajectoryElement->GetRGBA(rgba);
+  while (remain > 0)
+    {
+    bool timeout(false);
+    igtlUint64 block = first ? leadSize : chunkSize;
+    if (remain < block)
+      {
+      block = remain;
+      }
+    igtlUint64 n = this->fromSocket->Receive(buf, block, timeout, first ? 1 : 0);
+    if (n == 0)
+      {
+      return 1;
+      }
 
-      igtlFloat32 entry[3];
-      igtlFloat32 target[3];
-      trajectoryElement->GetEntryPosition(entry);
-      trajectoryElement->GetTargetPosition(target);
+    if (first && strcmp(header->GetDeviceType(), "IMAGE") == 0)
+      {
+      // Image header: version(2), num_components(1), scalar_type(1), endian(1),
+      // coord(1), size(2x3), matrix(4x12), subvol_offset(2x3), subvol_size(2x3)
+      igtlUint64 offset = 0;
+      if (GetUint16BE(rawHeader + WIRE_HEADER_VERSION_OFFSET) >= 2 && n >= 2)
+        {
+        offset = GetUint16BE(buf);
+        }
+      if (offset + 72 <= n)
+        {
+        const unsigned char * h = buf + offset;
+        ss << "Endian=" << (int) h[4] << ", "
+           << "Dimensions=(" << GetUint16BE(h + 6) << ", " << GetUint16BE(h + 8) << ", " << GetUint16BE(h + 10) << "), "
+           << "SubVolumeDimension=(" << GetUint16BE(h + 66) << ", " << GetUint16BE(h + 68) << ", " << GetUint16BE(h + 70) << "), "
+           << "SubVolumeOffset=(" << GetUint16BE(h + 60) << ", " << GetUint16BE(h + 62) << ", " << GetUint16BE(h + 64) << "), ";
+        }
+      }
+    first = false;
 
-      ss << "Element #" << i << ", "
-         << "Name=" << trajectoryElement->GetName() << ", "
-         << "GroupName=" << trajectoryElement->GetGroupName() << ", "
-         << "RGBA=( " << (int)rgba[0] << ", " << (int)rgba[1] << ", " << (int)rgba[2] << ", " << (int)rgba[3] << " )" << ", "
-         << "EntryPt=( " << std::fixed << entry[0] << ", " << entry[1] << ", " << entry[2] << " )" << ", "
-         << "TargetPt=( " << std::fixed << target[0] << ", " << target[1] << ", " << target[2] << " )" << ", "
-         << "Radius=" << std::fixed << trajectoryElement->GetRadius() << ", "
-         << "Owner=" << trajectoryElement->GetOwner() << ", ";
+    crc = crc64(buf, n, crc);
+    if (!this->toSocket->Send(buf, n))
+      {
+      return 2;
       }
-    ss << std::endl;
-    this->logger->Print(ss.str());
+    if (copyBody)
+      {
+      memcpy(copyBody, buf, n);
+      copyBody += n;
+      }
+    remain -= n;
+    }
 
-    trajectoryMsg->Pack();
-    toSocket->Send(trajectoryMsg->GetPackPointer(), trajectoryMsg->GetPackSize());
+  if (copy.IsNotNull())
+    {
+    this->trafficTap->Mirror(copy);
+    }
 
+  // The body has already been forwarded, so a CRC error can only be
+  // reported; igtlanalyze counts this tag.
+  ss << "Streamed=" << header->GetBodySizeToRead() << " bytes";
+  if (crc != GetUint64BE(rawHeader + WIRE_CRC_OFFSET))
+    {
+    ss << ", CRC error after forwarding";
     }
+  ss << std::endl;
+  this->Log(ss.str());
 
-  return 1;
+  return 0;
 }
 
 
-int Session::ReceiveString(igtl::MessageHeader * header)
+//-----------------------------------------------------------------------------
+template <class TMessage>
+void Session::AddHandler(HandlerTable & table)
 {
+  const char * type = MessageTraits<TMessage>::Type();
+  unsigned int i = HashType(type);
+  while (table.Entries[i].Receive)
+    {
+    i = (i + 1) % HANDLER_TABLE_SIZE;
+    }
+  strncpy(table.Entries[i].Type, type, IGTL_HEADER_TYPE_SIZE);
+  table.Entries[i].Type[IGTL_HEADER_TYPE_SIZE] = '\0';
+  table.Entries[i].Receive = &Session::ReceiveMessage<TMessage>;
+}
 
-  // Create a message buffer to receive transform data
-  igtl::StringMessage::Pointer stringMsg;
-  stringMsg = igtl::StringMessage::New();
-  stringMsg->SetMessageHeader(header);
-  stringMsg->AllocatePack();
 
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(stringMsg->GetPackBodyPointer(), stringMsg->GetPackBodySize(), timeout);
+//-----------------------------------------------------------------------------
+const Session::HandlerTable & Session::GetHandlers()
+{
+  // Built once, on the first call
+  static HandlerTable table = BuildHandlers();
+  return table;
+}
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = stringMsg->Unpack(1);
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
-    {
-    std::stringstream ss;
+//-----------------------------------------------------------------------------
+Session::HandlerTable Session::BuildHandlers()
+{
+  HandlerTable table;
+  memset(&table, 0, sizeof(table));
 
-    ss << "Encoding=" << stringMsg->GetEncoding() << ", "
-       << "String=" << stringMsg->GetString() << std::endl;
+  AddHandler<igtl::TransformMessage>(table);
+  AddHandler<igtl::PositionMessage>(table);
+  AddHandler<igtl::ImageMessage>(table);
+  AddHandler<igtl::StatusMessage>(table);
+#if OpenIGTLink_PROTOCOL_VERSION >= 2
+  AddHandler<igtl::PointMessage>(table);
+  AddHandler<igtl::TrajectoryMessage>(table);
+  AddHandler<igtl::StringMessage>(table);
+  AddHandler<igtl::BindMessage>(table);
+  AddHandler<igtl::CapabilityMessage>(table);
+  AddHandler<igtl::TrackingDataMessage>(table);
+#endif //OpenIGTLink_PROTOCOL_VERSION >= 2
 
-    this->logger->Print(ss.str());
+  return table;
+}
 
-    stringMsg->Pack();
-    this->toSocket->Send(stringMsg->GetPackPointer(), stringMsg->GetPackSize());
 
+//-----------------------------------------------------------------------------
+unsigned int Session::HashType(const char * type)
+{
+  // FNV-1a over the device type (at most 12 characters)
+  unsigned int h = 2166136261U;
+  for (int i = 0; i < IGTL_HEADER_TYPE_SIZE && type[i]; i ++)
+    {
+    h = (h ^ (unsigned char) type[i]) * 16777619U;
     }
-
-  return 1;
+  return h % HANDLER_TABLE_SIZE;
 }
 
 
-int Session::ReceiveBind(igtl::MessageHeader * header)
+//-----------------------------------------------------------------------------
+Session::Handler Session::FindHandler(const char * type)
 {
-  // Create a message buffer to receive transform data
-  igtl::BindMessage::Pointer bindMsg;
-  bindMsg = igtl::BindMessage::New();
-  bindMsg->SetMessageHeader(header);
-  bindMsg->AllocatePack();
+  const HandlerTable & table = GetHandlers();
+  unsigned int i = HashType(type);
+  while (table.Entries[i].Receive)
+    {
+    if (strncmp(table.Entries[i].Type, type, IGTL_HEADER_TYPE_SIZE) == 0)
+      {
+      return table.Entries[i].Receive;
+      }
+    i = (i + 1) % HANDLER_TABLE_SIZE;
+    }
+  return NULL;
+}
 
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(bindMsg->GetPackBodyPointer(), bindMsg->GetPackBodySize(), timeout);
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = bindMsg->Unpack(1);
+//-----------------------------------------------------------------------------
+template <class TMessage>
+int Session::ReceiveMessage(igtl::MessageHeader * header)
+{
+  typename TMessage::Pointer msg = TMessage::New();
+  msg->SetMessageHeader(header);
+  msg->AllocatePack();
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+  if (this->ReceiveBody(msg))
     {
-    std::stringstream ss;
-
-    int n = bindMsg->GetNumberOfChildMessages();
+    return 0; // Suppressed duplicate
+    }
 
-    for (int i = 0; i < n; i ++)
+  // With a decoder pool, a message that no stage modifies is forwarded as
+  // received. The header is restored from the received bytes, since
+  // unpacking the header converted it in place. Only the CRC is checked
+  // here, so that a corrupted message is not forwarded; unpacking and
+  // formatting are left to the decoders.
+  if (this->decoderPool.IsNotNull() && this->IsPassThrough(msg.GetPointer()))
+    {
+    if (crc64((unsigned char *) msg->GetPackBodyPointer(), msg->GetPackBodySize(), 0) !=
+        GetUint64BE(this->rawHeader + WIRE_CRC_OFFSET))
       {
-      if (strcmp(bindMsg->GetChildMessageType(i), "STRING") == 0)
-        {
-        igtl::StringMessage::Pointer stringMsg;
-        stringMsg = igtl::StringMessage::New();
-        bindMsg->GetChildMessage(i, stringMsg);
-        stringMsg->Unpack(0);
-        ss << "MessageType=STRING,"
-           << "MessageNname=" << stringMsg->GetDeviceName() << ", "
-           << "Encoding=" << stringMsg->GetEncoding() << ", "
-           << "String=" << stringMsg->GetString() << ", ";
-        }
-      else if (strcmp(bindMsg->GetChildMessageType(i), "TRANSFORM") == 0)
-        {
-        igtl::TransformMessage::Pointer transMsg;
-        transMsg = igtl::TransformMessage::New();
-        bindMsg->GetChildMessage(i, transMsg);
-        transMsg->Unpack(0);
-        ss << "MessageType=TRANSFORM,"
-           << "MessageName=" << transMsg->GetDeviceName() << ", ";
-        igtl::Matrix4x4 matrix;
-        transMsg->GetMatrix(matrix);
-        //igtl::PrintMatrix(matrix);
-        ss << "Matrix=("
-           << matrix[0][0] << ", " << matrix[1][0] << ", " << matrix[2][0] << ", " << matrix[3][0] << ", "
-           << matrix[0][1] << ", " << matrix[1][1] << ", " << matrix[2][1] << ", " << matrix[3][1] << ", "
-           << matrix[0][2] << ", " << matrix[1][2] << ", " << matrix[2][2] << ", " << matrix[3][2] << ", "
-           << matrix[0][3] << ", " << matrix[1][3] << ", " << matrix[2][3] << ", " << matrix[3][3] << "),";
-        }
+      std::stringstream ss;
+      ss << "Invalid " << MessageTraits<TMessage>::Type() << " message." << std::endl;
+      this->Log(ss.str());
+      return 0;
       }
+    memcpy(msg->GetPackPointer(), this->rawHeader, IGTL_HEADER_SIZE);
+    this->Forward(msg, MessageTraits<TMessage>::Priority);
+    if (this->summaryTable.IsNotNull())
+      {
+      this->summaryTable->SetLastValue(msg.GetPointer(), &DecodeMessage<TMessage>);
+      }
+    else
+      {
+      this->logJob->SetMessage(msg, &DecodeMessage<TMessage>, this->memoryBudget);
+      }
+    return 1;
+    }
 
+  // Deserialize the data
+  // If you want to skip CRC check, call Unpack() without argument.
+  int c = msg->Unpack(1);
+  if (!(c & igtl::MessageHeader::UNPACK_BODY)) // if CRC check is not OK
+    {
+    std::stringstream ss;
+    ss << "Invalid " << MessageTraits<TMessage>::Type() << " message." << std::endl;
+    this->Log(ss.str());
+    return 0;
+    }
+
+  // In the summary mode, the message is formatted only if it is still the
+  // last one of its source when the summary is printed.
+  if (this->summaryTable.IsNotNull())
+    {
+    this->summaryTable->SetLastValue(msg.GetPointer(), &FormatMessage<TMessage>);
+    }
+  else
+    {
+    std::stringstream ss;
+    MessageTraits<TMessage>::Format(msg, ss);
     ss << std::endl;
-    this->logger->Print(ss.str());
-    bindMsg->Pack();
-    this->toSocket->Send(bindMsg->GetPackPointer(), bindMsg->GetPackSize());
+    this->Log(ss.str());
+    }
 
+  igtl::MessageBase::Pointer out = this->Prepare(msg.GetPointer());
+  if (out.IsNull())
+    {
+    return 0;
     }
+  this->Forward(out, MessageTraits<TMessage>::Priority);
 
   return 1;
 }
 
 
-int Session::ReceiveCapability(igtl::MessageHeader * header)
+//-----------------------------------------------------------------------------
+igtl::MessageBase::Pointer Session::Prepare(igtl::TransformMessage * msg)
 {
-  // Create a message buffer to receive transform data
-  igtl::CapabilityMessage::Pointer capabilMsg;
-  capabilMsg = igtl::CapabilityMessage::New();
-  capabilMsg->SetMessageHeader(header);
-  capabilMsg->AllocatePack();
+  msg->Pack();
 
-  // Receive transform data from the socket
-  bool timeout(false);
-  this->fromSocket->Receive(capabilMsg->GetPackBodyPointer(), capabilMsg->GetPackBodySize(), timeout);
+  const igtl::RuleSet::Registration * reg = this->rules->FindRegistration(msg->GetDeviceName());
+  if (reg)
+    {
+    igtl::ApplyRegistrationToTransform(reg->Matrix, (unsigned char *) msg->GetPackPointer());
+    }
+  return msg;
+}
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = capabilMsg->Unpack(1);
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
+//-----------------------------------------------------------------------------
+igtl::MessageBase::Pointer Session::Prepare(igtl::ImageMessage * msg)
+{
+  if (this->imageDecimator.IsNotNull() && this->imageDecimator->IsEnabled())
     {
-    std::stringstream ss;
-
-    int nTypes = capabilMsg->GetNumberOfTypes();
-    for (int i = 0; i < nTypes; i ++)
+    if (!this->imageDecimator->AcceptFrame(msg->GetDeviceName(), (double) igtl::Clock::Ticks() * 1.0e-9))
       {
-      ss << "ID=" << i << ", "
-         << "TYPE=" << capabilMsg->GetType(i) << ", ";
+      return NULL;
+      }
+    igtl::ImageMessage::Pointer smallMsg = this->imageDecimator->Downsample(msg);
+    if (smallMsg.IsNotNull())
+      {
+      return smallMsg.GetPointer();
       }
-
-    ss << std::endl;
-    this->logger->Print(ss.str());
-    capabilMsg->Pack();
-    this->toSocket->Send(capabilMsg->GetPackPointer(), capabilMsg->GetPackSize());
-
     }
 
-  return 1;
-
+  msg->Pack();
+  return msg;
 }
 
-int Session::ReceiveTrackingData(igtl::MessageHeader::Pointer& header)
-{
-  //------------------------------------------------------------
-  // Allocate TrackingData Message Class
-
-  igtl::TrackingDataMessage::Pointer trackingData;
-  trackingData = igtl::TrackingDataMessage::New();
-  trackingData->SetMessageHeader(header);
-  trackingData->AllocatePack();
-
-  // Receive body from the socket
-  bool timeout(false);
-  fromSocket->Receive(trackingData->GetPackBodyPointer(), trackingData->GetPackBodySize(), timeout);
 
-  // Deserialize the transform data
-  // If you want to skip CRC check, call Unpack() without argument.
-  int c = trackingData->Unpack(1);
+//-----------------------------------------------------------------------------
+int Session::IsPassThrough(igtl::TransformMessage * msg)
+{
+  return this->rules->FindRegistration(msg->GetDeviceName()) == NULL;
+}
 
-  if (c & igtl::MessageHeader::UNPACK_BODY) // if CRC check is OK
-    {
-    std::stringstream ss;
 
-    int nElements = trackingData->GetNumberOfTrackingDataElements();
-    for (int i = 0; i < nElements; i ++)
-      {
-      igtl::TrackingDataElement::Pointer trackingElement;
-      trackingData->GetTrackingDataElement(i, trackingElement);
+//-----------------------------------------------------------------------------
+int Session::IsPassThrough(igtl::ImageMessage *)
+{
+  return this->imageDecimator.IsNull() || !this->imageDecimator->IsEnabled();
+}
 
-      igtl::Matrix4x4 matrix;
-      trackingElement->GetMatrix(matrix);
 
-      ss << "ElementID=" << i << ", "
-         << "Name=" << trackingElement->GetName() << ", "
-         << "Type=" << (int) trackingElement->GetType() << ", ";
+#if OpenIGTLink_PROTOCOL_VERSION >= 2
+//-----------------------------------------------------------------------------
+int Session::IsPassThrough(igtl::TrackingDataMessage * msg)
+{
+  return this->rules->FindRegistration(msg->GetDeviceName()) == NULL;
+}
 
-      ss << "Matrix=("
-         << matrix[0][0] << ", " << matrix[1][0] << ", " << matrix[2][0] << ", " << matrix[3][0] << ", "
-         << matrix[0][1] << ", " << matrix[1][1] << ", " << matrix[2][1] << ", " << matrix[3][1] << ", "
-         << matrix[0][2] << ", " << matrix[1][2] << ", " << matrix[2][2] << ", " << matrix[3][2] << ", "
-         << matrix[0][3] << ", " << matrix[1][3] << ", " << matrix[2][3] << ", " << matrix[3][3] << "),";
 
-      }
+//-----------------------------------------------------------------------------
+igtl::MessageBase::Pointer Session::Prepare(igtl::TrackingDataMessage * msg)
+{
+  msg->Pack();
 
-    ss << std::endl;
-    this->logger->Print(ss.str());
-    trackingData->Pack();
-    this->toSocket->Send(trackingData->GetPackPointer(), trackingData->GetPackSize());
-    }
-  else
+  const igtl::RuleSet::Registration * reg = this->rules->FindRegistration(msg->GetDeviceName());
+  if (reg)
     {
-    this->logger->Print("Invalid TrackingData message.");
+    igtl::ApplyRegistrationToTrackingData(reg->Matrix, (unsigned char *) msg->GetPackPointer());
     }
-
-  return 1;
+  return msg;
 }
-
-
-
 #endif //OpenIGTLink_PROTOCOL_VERSION >= 2
 
 } // End of igtl namespace
@@ -2,14 +2,32 @@
 #define SESSION_H
 
 #include "igtlSocket.h"
+#include "transport.h"
 #include "igtlMultiThreader.h"
 #include "igtlMutexLock.h"
 #include "igtlMessageHeader.h"
 #include "logger.h"
+#include "decimator.h"
+#include "rules.h"
+#include "monitor.h"
+#include "workerpool.h"
+#include "sendqueue.h"
+#include "ratelimiter.h"
+#include "dedup.h"
+#include "cache.h"
+#include "tap.h"
+#include "impairment.h"
+#include "router.h"
+#include "summary.h"
+#include "budget.h"
+#include "decoder.h"
+#include "handlers.h"
 
 namespace igtl
 {
 
+class MessageLogJob;
+
 class IGTLCommon_EXPORT Session : public Object
 {
 public:
@@ -22,11 +40,16 @@ public:
   virtual const char * GetClassName() { return "Session"; };
 
   int Start();
-  void Stop() { this->Active = 0; };
+  void Stop();
+
+  // Checks the settings and makes the session active without starting a
+  // thread, so that the caller can drive it with ProcessNext(). Called by
+  // Start().
+  int Initialize();
 
   inline int     IsActive()    { return this->Active; }
 
-  void SetSockets(igtl::Socket * from, igtl::Socket * to)
+  void SetSockets(igtl::Transport * from, igtl::Transport * to)
   {
     this->fromSocket = from;
     this->toSocket   = to;
@@ -48,11 +71,127 @@ public:
     this->Name = name;
   };
 
-  void SetBlackList(std::vector<std::string> & blist)
+  void SetRuleManager(igtl::RuleManager * rules)
+  {
+    this->ruleManager = rules;
+  };
+
+  void SetImageDecimator(igtl::ImageDecimator * decimator)
+  {
+    this->imageDecimator = decimator;
+  };
+
+
+  // Messages with a body larger than 'size' bytes are forwarded in chunks
+  // as they arrive instead of being buffered (0: always buffer).
+  void SetStreamingThreshold(igtlUint64 size)
+  {
+    this->streamThreshold = size;
+  };
+
+  void SetSourceMonitor(igtl::SourceMonitor * monitor)
   {
-    this->blackList = blist;
+    this->sourceMonitor = monitor;
+  };
+
+  // Sessions with a worker pool are processed by the pool instead of a
+  // thread of their own (socket transports only).
+  void SetWorkerPool(igtl::WorkerPool * pool)
+  {
+    this->workerPool = pool;
+  };
+
+  // Repeated messages are suppressed by 'filter' (NULL: all forwarded).
+  void SetDuplicateFilter(igtl::DuplicateFilter * filter)
+  {
+    this->duplicateFilter = filter;
+  };
+
+  // CAPABILITY, STATUS, and TRANSFORM messages forwarded by this session
+  // are stored in 'cache'.
+  void SetResponseCache(igtl::ResponseCache * cache)
+  {
+    this->responseCache = cache;
+  };
+
+  // GET_ queries received by this session are answered from 'cache' when
+  // it has a fresh reply. The reply is sent back to the 'from' transport
+  // through 'queue' if not NULL.
+  void SetQueryCache(igtl::ResponseCache * cache, igtl::SendQueue * queue)
+  {
+    this->queryCache = cache;
+    this->replyQueue = queue;
+  };
+
+  // Messages are sent to the 'to' transport through 'queue' by priority
+  // class (NULL: sent directly).
+  void SetSendQueue(igtl::SendQueue * queue)
+  {
+    this->sendQueue = queue;
+  };
+
+  // Messages forwarded by this session are mirrored to 'tap' (NULL: none).
+  void SetTrafficTap(igtl::TrafficTap * tap)
+  {
+    this->trafficTap = tap;
+  };
+
+  // Forwarded messages go through 'emulator', which delays or drops them
+  // and then sends them to the 'to' side (NULL: sent directly).
+  void SetImpairmentEmulator(igtl::ImpairmentEmulator * emulator)
+  {
+    this->impairment = emulator;
+  };
+
+  // Each message is sent to the destination chosen by 'router'.
+  // Destination 0 is the 'to' transport with its queue and emulator;
+  // AddDestination() adds destinations 1, 2, ...
+  void SetRouter(igtl::Router * router)
+  {
+    this->router = router;
+  };
+  void AddDestination(igtl::Transport * to, igtl::MutexLock * lock,
+                      igtl::SendQueue * queue, igtl::ImpairmentEmulator * emulator);
+
+  // Messages being received are charged to 'budget'. When it is used up,
+  // the session stops reading from the 'from' transport until memory is
+  // released, or drops the message if 'drop' is 1. Messages that can never
+  // fit are dropped.
+  void SetMemoryBudget(igtl::MemoryBudget * budget, int drop)
+  {
+    this->memoryBudget = budget;
+    this->dropOnMemoryLimit = drop;
+  };
+
+  // Messages are counted in a table of 'summary' instead of being logged
+  // one line each (NULL: logged).
+  void SetTrafficSummary(igtl::TrafficSummary * summary)
+  {
+    this->trafficSummary = summary;
+  };
+
+  // Messages that no stage modifies are forwarded as received, and decoded
+  // and logged afterwards by 'pool' (NULL: decoded before forwarding).
+  void SetDecoderPool(igtl::DecoderPool * pool)
+  {
+    this->decoderPool = pool;
+  };
+
+  // Processes one message. Returns 1 if the session is still active.
+  int ProcessNext();
+
+  // A session processed by a worker pool does not wait in Process(); the
+  // message is deferred and resumed by the next ProcessNext().
+  enum {
+    DEFER_NONE = 0,
+    DEFER_RATE,      // Rate limit; resume at GetResumeTime()
+    DEFER_MEMORY     // Memory limit; resume when memory is released
   };
+  int       GetDeferral()   { return this->deferral; };
+  igtlInt64 GetResumeTime() { return this->resumeTime; };
 
+  // Releases the rule reader slot once the session is no longer processed.
+  void FinishProcessing();
 
   static void    MonitorThreadFunction(void * ptr);
 
@@ -65,18 +204,99 @@ protected:
 
   virtual int    Process();
 
-  int ReceiveTransform(igtl::MessageHeader * header);
-  int ReceivePosition(igtl::MessageHeader * header);
-  int ReceiveImage(igtl::MessageHeader * header);
-  int ReceiveStatus(igtl::MessageHeader * header);
+  // Receives the header of the next message and logs it. Returns 0, or
+  // 1 / 3 as Process().
+  int ReceiveHeader();
+
+  int StreamMessage(igtl::MessageHeader * header, const unsigned char * rawHeader);
+
+  // Reads and discards 'size' bytes. Returns 1 if closed by the 'from' host.
+  int SkipBody(igtlUint64 size);
+
+  // Receives the body of 'msg'. Returns 1 if the message is a suppressed
+  // duplicate.
+  int ReceiveBody(igtl::MessageBase * msg);
+
+  // Sends a packed message to the 'to' transport. 'priority' is the
+  // SendQueue::PRIORITY_* lane (-1: by message type).
+  int Forward(igtl::MessageBase * msg, int priority = -1);
+
+  // Makes destination 'i' the 'to' side for the current message.
+  void SelectDestination(int i);
+
+  // Sends a packed message back to the 'from' transport.
+  int Reply(igtl::MessageBase * msg);
+
+  // Charges a message of 'size' bytes to the memory budget, waiting for
+  // memory if needed. Returns 0 if the message is to be dropped, or -1 if
+  // it is deferred (DEFER_MEMORY). 'resume' is the deferral being resumed.
+  int ChargeMemory(igtlUint64 size, int resume);
+
+  // Prints a line about the current message unless in the summary mode.
+  // With a decoder pool, the line follows the message through the pool.
+  void Log(const std::string & msg);
+
+  // Take / give back exclusive use of the 'to' transport for writing a
+  // message in pieces. AcquireTo() returns 0 if the transport is closed.
+  int  AcquireTo();
+  void ReleaseTo();
+
+  // Message handlers are generated from MessageTraits<> (handlers.h) and
+  // looked up by device type in an open-addressed table built once.
+  typedef int (Session::*Handler)(igtl::MessageHeader * header);
 
+  enum {
+    HANDLER_TABLE_SIZE = 64
+  };
+
+  typedef struct {
+    char    Type[IGTL_HEADER_TYPE_SIZE + 1];
+    Handler Receive;  // NULL: empty slot
+  } HandlerEntry;
+
+  typedef struct {
+    HandlerEntry Entries[HANDLER_TABLE_SIZE];
+  } HandlerTable;
+
+  static const HandlerTable & GetHandlers();
+  static HandlerTable  BuildHandlers();
+  static unsigned int  HashType(const char * type);
+  static Handler       FindHandler(const char * type);
+
+  template <class TMessage>
+  static void AddHandler(HandlerTable & table);
+
+  // Receives, decodes, logs, and forwards a message of a registered type.
+  template <class TMessage>
+  int ReceiveMessage(igtl::MessageHeader * header);
+
+  // Packs a decoded message and applies the type-specific stages. Returns
+  // the message to forward, or NULL to drop it.
+  template <class TMessage>
+  igtl::MessageBase::Pointer Prepare(TMessage * msg)
+  {
+    msg->Pack();
+    return msg;
+  };
+
+  igtl::MessageBase::Pointer Prepare(igtl::TransformMessage * msg);
+  igtl::MessageBase::Pointer Prepare(igtl::ImageMessage * msg);
 #if OpenIGTLink_PROTOCOL_VERSION >= 2
-  int ReceivePoint(igtl::MessageHeader * header);
-  int ReceiveTrajectory(igtl::MessageHeader::Pointer& header);
-  int ReceiveString(igtl::MessageHeader * header);
-  int ReceiveBind(igtl::MessageHeader * header);
-  int ReceiveCapability(igtl::MessageHeader * header);
-  int ReceiveTrackingData(igtl::MessageHeader::Pointer& header);
+  igtl::MessageBase::Pointer Prepare(igtl::TrackingDataMessage * msg);
+#endif //OpenIGTLink_PROTOCOL_VERSION >= 2
+
+  // Returns 1 if Prepare() would forward the message unchanged, so that it
+  // can be forwarded without being decoded.
+  template <class TMessage>
+  int IsPassThrough(TMessage *)
+  {
+    return 1;
+  };
+
+  int IsPassThrough(igtl::TransformMessage * msg);
+  int IsPassThrough(igtl::ImageMessage * msg);
+#if OpenIGTLink_PROTOCOL_VERSION >= 2
+  int IsPassThrough(igtl::TrackingDataMessage * msg);
 #endif //OpenIGTLink_PROTOCOL_VERSION >= 2
 
 
@@ -88,15 +308,75 @@ protected:
 
   igtl::MultiThreader::Pointer Threader;
 
-  igtl::Socket * fromSocket;
-  igtl::Socket * toSocket;
-  igtl::MutexLock * fromLock;
-  igtl::MutexLock * toLock;
+  // Held by the session, since a worker may still be processing a message
+  // after the relay that created them has stopped.
+  igtl::Transport::Pointer fromSocket;
+  igtl::Transport::Pointer toSocket;
+  igtl::MutexLock::Pointer fromLock;
+  igtl::MutexLock::Pointer toLock;
 
-  std::vector<std::string> blackList;
+  igtl::RuleManager::Pointer ruleManager;
+  int ruleSlot;
+  const igtl::RuleSet * rules; // Valid only while a message is processed
 
   igtl::Logger::Pointer logger;
 
+  igtl::ImageDecimator::Pointer imageDecimator;
+
+  igtl::SourceMonitor::Pointer sourceMonitor;
+
+  igtl::WorkerPool * workerPool;
+
+  igtl::SendQueue::Pointer sendQueue;
+
+  igtl::RateLimiter::Pointer rateLimiter;
+
+  igtl::DuplicateFilter::Pointer duplicateFilter;
+
+  igtl::ResponseCache::Pointer responseCache;
+  igtl::ResponseCache::Pointer queryCache;
+  igtl::SendQueue::Pointer replyQueue;
+
+  igtl::TrafficTap::Pointer trafficTap;
+
+  igtl::ImpairmentEmulator::Pointer impairment;
+
+  typedef struct {
+    igtl::Transport::Pointer          to;
+    igtl::MutexLock::Pointer          lock;
+    igtl::SendQueue::Pointer          queue;
+    igtl::ImpairmentEmulator::Pointer emulator;
+  } Destination;
+
+  igtl::Router::Pointer    router;
+  std::vector<Destination> destinations; // [0] is set by Initialize()
+
+  igtl::MemoryBudget::Pointer memoryBudget;
+  int dropOnMemoryLimit;
+
+  igtl::TrafficSummary::Pointer trafficSummary;
+  igtl::SummaryTable::Pointer   summaryTable; // Created by Initialize()
+
+  igtl::DecoderPool::Pointer decoderPool;
+  igtl::LogChannel::Pointer  logChannel; // Created by Initialize() unless in the summary mode
+
+  // Of the message being processed
+  int       headerVersion;
+  igtlInt64 arrivalTime;  // ns since the epoch; for the log
+  igtlInt64 arrivalTicks; // ns; Clock::Ticks(), for intervals and deadlines
+  igtl::MessageHeader::Pointer header;
+  unsigned char rawHeader[IGTL_HEADER_SIZE]; // As received
+  igtl::MessageLogJob * logJob; // Submitted to the decoder pool by ProcessNext()
+  std::string logLine;          // Without a decoder pool; printed by ProcessNext()
+
+  int       pooled;     // Processed by 'workerPool'
+  int       deferral;   // DEFER_*
+  igtlInt64 resumeTime; // ns; Clock::Ticks()
+  igtlInt64 pauseTime;  // ns; Clock::Ticks() when reading was paused for memory
+
+  igtlUint64 streamThreshold;
+  std::vector<unsigned char> streamBuffer;
+
   int id;
   int nThread;
 
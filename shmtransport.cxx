@@ -0,0 +1,471 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <new>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#include "shmtransport.h"
+
+#include "igtlOSUtil.h"
+
+namespace igtl
+{
+
+static const igtlUint32 SHM_MAGIC   = 0x49475452; // 'IGTR'
+static const igtlUint32 SHM_VERSION = 2;
+
+// Interval to check if the peer is still alive while waiting (ms)
+static const int WAIT_INTERVAL = 100;
+
+//-----------------------------------------------------------------------------
+static void FutexWait(std::atomic<igtlUint32> * word, igtlUint32 expected, int msec)
+{
+#if defined(__linux__)
+  struct timespec ts;
+  ts.tv_sec  = msec / 1000;
+  ts.tv_nsec = (msec % 1000) * 1000000L;
+  syscall(SYS_futex, (int *) word, FUTEX_WAIT, (int) expected, &ts, NULL, 0);
+#else
+  if (word->load() == expected)
+    {
+    igtl::Sleep(1);
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+static void FutexWake(std::atomic<igtlUint32> * word)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, (int *) word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void) word;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+SharedMemoryTransport::SharedMemoryTransport()
+{
+  this->IsServer   = 0;
+  this->Shared     = NULL;
+  this->MappedSize = 0;
+  this->RxRing     = NULL;
+  this->RxData     = NULL;
+  this->TxRing     = NULL;
+  this->TxData     = NULL;
+  this->Mask       = 0;
+}
+
+//-----------------------------------------------------------------------------
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+  this->Close();
+  this->Unmap();
+  if (this->IsServer && !this->Name.empty())
+    {
+    shm_unlink(this->Name.c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+void SharedMemoryTransport::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::Create(const char * name, igtlUint64 ringSize)
+{
+  igtlUint64 size = 4096;
+  while (size < ringSize)
+    {
+    size <<= 1;
+    }
+
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    {
+    std::cerr << "ERROR: cannot create shared memory " << name << ": " << strerror(errno) << std::endl;
+    return 0;
+    }
+
+  igtlUint64 total = sizeof(Control) + 2 * size;
+  if (ftruncate(fd, (off_t) total) != 0 || !this->Map(fd, total))
+    {
+    std::cerr << "ERROR: cannot map shared memory " << name << ": " << strerror(errno) << std::endl;
+    close(fd);
+    shm_unlink(name);
+    return 0;
+    }
+  close(fd);
+
+  this->Name = name;
+  this->IsServer = 1;
+
+  Control * c = new (this->Shared) Control;
+  c->RingSize = size;
+  c->ServerPid = (igtlInt32) getpid();
+  c->ClientPid = 0;
+  c->State.store(STATE_WAITING);
+  for (int i = 0; i < 2; i ++)
+    {
+    RingHeader * r = &(c->Rings[i]);
+    r->Head.store(0);
+    r->Tail.store(0);
+    r->DataSeq.store(0);
+    r->SpaceSeq.store(0);
+    r->ReaderWaiting.store(0);
+    r->WriterWaiting.store(0);
+    }
+  c->Version = SHM_VERSION;
+  c->Magic   = SHM_MAGIC;
+
+  unsigned char * base = (unsigned char *) this->Shared + sizeof(Control);
+  this->RxRing = &(c->Rings[RING_UP]);
+  this->RxData = base;
+  this->TxRing = &(c->Rings[RING_DOWN]);
+  this->TxData = base + size;
+  this->Mask   = size - 1;
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::WaitForAttach(int msec)
+{
+  if (!this->Shared || !this->IsServer)
+    {
+    return 0;
+    }
+  igtlUint32 state = this->Shared->State.load();
+  if (state == STATE_WAITING || state == STATE_ATTACHING)
+    {
+    FutexWait(&(this->Shared->State), state, msec);
+    }
+  return (this->Shared->State.load() == STATE_ATTACHED);
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::Attach(const char * name)
+{
+  int fd = shm_open(name, O_RDWR, 0600);
+  if (fd < 0)
+    {
+    std::cerr << "ERROR: cannot open shared memory " << name << ": " << strerror(errno) << std::endl;
+    return 0;
+    }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (igtlUint64) st.st_size < sizeof(Control) ||
+      !this->Map(fd, (igtlUint64) st.st_size))
+    {
+    std::cerr << "ERROR: cannot map shared memory " << name << std::endl;
+    close(fd);
+    return 0;
+    }
+  close(fd);
+
+  Control * c = this->Shared;
+  if (c->Magic != SHM_MAGIC || c->Version != SHM_VERSION ||
+      sizeof(Control) + 2 * c->RingSize > this->MappedSize)
+    {
+    std::cerr << "ERROR: " << name << " is not a repeater shared memory." << std::endl;
+    this->Unmap();
+    return 0;
+    }
+
+  // Claim the memory first, so that a client that loses the race does not
+  // overwrite the PID of the one that won. ATTACHED publishes the PID.
+  igtlUint32 expected = STATE_WAITING;
+  if (!c->State.compare_exchange_strong(expected, (igtlUint32) STATE_ATTACHING))
+    {
+    std::cerr << "ERROR: " << name << " is already in use." << std::endl;
+    this->Unmap();
+    return 0;
+    }
+  c->ClientPid = (igtlInt32) getpid();
+  c->State.store(STATE_ATTACHED, std::memory_order_release);
+  FutexWake(&(c->State));
+
+  this->Name = name;
+  this->IsServer = 0;
+
+  unsigned char * base = (unsigned char *) this->Shared + sizeof(Control);
+  this->TxRing = &(c->Rings[RING_UP]);
+  this->TxData = base;
+  this->RxRing = &(c->Rings[RING_DOWN]);
+  this->RxData = base + c->RingSize;
+  this->Mask   = c->RingSize - 1;
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::Map(int fd, igtlUint64 size)
+{
+  void * p = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+    return 0;
+    }
+  this->Shared = (Control *) p;
+  this->MappedSize = size;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void SharedMemoryTransport::Unmap()
+{
+  if (this->Shared)
+    {
+    munmap((void *) this->Shared, (size_t) this->MappedSize);
+    this->Shared = NULL;
+    this->RxRing = NULL;
+    this->TxRing = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::IsClosed()
+{
+  return (!this->Shared || this->Shared->State.load() == STATE_CLOSED);
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::IsPeerAlive()
+{
+  pid_t pid = (pid_t) (this->IsServer ? this->Shared->ClientPid : this->Shared->ServerPid);
+  if (pid <= 0)
+    {
+    return 1;
+    }
+  return (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+//-----------------------------------------------------------------------------
+void SharedMemoryTransport::Close()
+{
+  if (!this->Shared)
+    {
+    return;
+    }
+  this->Shared->State.store(STATE_CLOSED);
+  FutexWake(&(this->Shared->State));
+  for (int i = 0; i < 2; i ++)
+    {
+    RingHeader * r = &(this->Shared->Rings[i]);
+    r->DataSeq.fetch_add(1);
+    r->SpaceSeq.fetch_add(1);
+    FutexWake(&(r->DataSeq));
+    FutexWake(&(r->SpaceSeq));
+    }
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::WaitForData()
+{
+  RingHeader * r = this->RxRing;
+  while (1)
+    {
+    igtlUint32 seq = r->DataSeq.load();
+    r->ReaderWaiting.store(1);
+    if (r->Head.load() != r->Tail.load())
+      {
+      r->ReaderWaiting.store(0);
+      return 1;
+      }
+    if (this->IsClosed())
+      {
+      r->ReaderWaiting.store(0);
+      return 0;
+      }
+    FutexWait(&(r->DataSeq), seq, WAIT_INTERVAL);
+    r->ReaderWaiting.store(0);
+    if (r->DataSeq.load() == seq && !this->IsPeerAlive())
+      {
+      this->Close();
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::WaitForSpace()
+{
+  RingHeader * r = this->TxRing;
+  while (1)
+    {
+    igtlUint32 seq = r->SpaceSeq.load();
+    r->WriterWaiting.store(1);
+    if (r->Head.load() - r->Tail.load() <= this->Mask)
+      {
+      r->WriterWaiting.store(0);
+      return 1;
+      }
+    if (this->IsClosed())
+      {
+      r->WriterWaiting.store(0);
+      return 0;
+      }
+    FutexWait(&(r->SpaceSeq), seq, WAIT_INTERVAL);
+    r->WriterWaiting.store(0);
+    if (r->SpaceSeq.load() == seq && !this->IsPeerAlive())
+      {
+      this->Close();
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 SharedMemoryTransport::Peek(const void ** data)
+{
+  if (!this->RxRing)
+    {
+    return 0;
+    }
+
+  RingHeader * r = this->RxRing;
+  igtlUint64 tail = r->Tail.load(std::memory_order_relaxed);
+  igtlUint64 head = r->Head.load(std::memory_order_acquire);
+  if (head == tail)
+    {
+    // Remaining data is delivered even after the peer has closed.
+    if (!this->WaitForData())
+      {
+      return 0;
+      }
+    head = r->Head.load(std::memory_order_acquire);
+    }
+
+  igtlUint64 offset = tail & this->Mask;
+  igtlUint64 contiguous = this->Mask + 1 - offset;
+  igtlUint64 available = head - tail;
+  *data = this->RxData + offset;
+  return (available < contiguous) ? available : contiguous;
+}
+
+//-----------------------------------------------------------------------------
+void SharedMemoryTransport::Consume(igtlUint64 length)
+{
+  RingHeader * r = this->RxRing;
+  r->Tail.store(r->Tail.load(std::memory_order_relaxed) + length);
+  r->SpaceSeq.fetch_add(1);
+  if (r->WriterWaiting.load())
+    {
+    FutexWake(&(r->SpaceSeq));
+    }
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 SharedMemoryTransport::Reserve(void ** data, igtlUint64 length)
+{
+  if (!this->TxRing || this->IsClosed())
+    {
+    return 0;
+    }
+
+  RingHeader * r = this->TxRing;
+  igtlUint64 head = r->Head.load(std::memory_order_relaxed);
+  if (head - r->Tail.load(std::memory_order_acquire) > this->Mask)
+    {
+    if (!this->WaitForSpace())
+      {
+      return 0;
+      }
+    }
+
+  igtlUint64 space = this->Mask + 1 - (head - r->Tail.load(std::memory_order_acquire));
+  igtlUint64 offset = head & this->Mask;
+  igtlUint64 contiguous = this->Mask + 1 - offset;
+  igtlUint64 n = (space < contiguous) ? space : contiguous;
+  *data = this->TxData + offset;
+  return (length < n) ? length : n;
+}
+
+//-----------------------------------------------------------------------------
+void SharedMemoryTransport::Commit(igtlUint64 length)
+{
+  RingHeader * r = this->TxRing;
+  r->Head.store(r->Head.load(std::memory_order_relaxed) + length);
+  r->DataSeq.fetch_add(1);
+  if (r->ReaderWaiting.load())
+    {
+    FutexWake(&(r->DataSeq));
+    }
+}
+
+//-----------------------------------------------------------------------------
+int SharedMemoryTransport::Send(const void * data, igtlUint64 length)
+{
+  const unsigned char * p = (const unsigned char *) data;
+  while (length > 0)
+    {
+    void * dst;
+    igtlUint64 n = this->Reserve(&dst, length);
+    if (n == 0)
+      {
+      return 0;
+      }
+    memcpy(dst, p, (size_t) n);
+    this->Commit(n);
+    p += n;
+    length -= n;
+    }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 SharedMemoryTransport::Receive(void * data, igtlUint64 length, bool & timeout, int readFully)
+{
+  timeout = false;
+  unsigned char * p = (unsigned char *) data;
+  igtlUint64 received = 0;
+  while (received < length)
+    {
+    const void * src;
+    igtlUint64 n = this->Peek(&src);
+    if (n == 0)
+      {
+      break;
+      }
+    if (n > length - received)
+      {
+      n = length - received;
+      }
+    memcpy(p + received, src, (size_t) n);
+    this->Consume(n);
+    received += n;
+    if (!readFully)
+      {
+      break;
+      }
+    }
+  return received;
+}
+
+} // End of igtl namespace
@@ -0,0 +1,145 @@
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <atomic>
+#include <string>
+
+#include "transport.h"
+
+namespace igtl
+{
+
+// SharedMemoryTransport connects a client on the same host to the repeater
+// through two single-producer/single-consumer byte rings in a POSIX shared
+// memory object, one per direction. Messages are copied once into the
+// ring by the producer and can be read in place by the consumer (Peek() /
+// Consume()); no data goes through the kernel. A blocked side sleeps on a
+// futex (Linux) and is woken only if it is actually waiting.
+//
+// Repeater side:
+//   transport->Create("/igtl", size);
+//   while (!transport->WaitForAttach(1000)) {}
+//
+// Client side (link shmtransport.cxx into the client application):
+//   transport->Attach("/igtl");
+//   transport->Send(msg->GetPackPointer(), msg->GetPackSize());
+//   transport->Receive(header->GetPackPointer(), header->GetPackSize(), timeout);
+//
+class IGTLCommon_EXPORT SharedMemoryTransport : public Transport
+{
+public:
+
+  igtlTypeMacro(igtl::SharedMemoryTransport, igtl::Transport)
+  igtlNewMacro(igtl::SharedMemoryTransport);
+
+  // Layout of the shared memory object
+  typedef struct {
+    std::atomic<igtlUint64> Head;          // Total # of bytes written
+    char                    Pad0[56];
+    std::atomic<igtlUint64> Tail;          // Total # of bytes read
+    char                    Pad1[56];
+    std::atomic<igtlUint32> DataSeq;       // Futex word; bumped after each write
+    std::atomic<igtlUint32> SpaceSeq;      // Futex word; bumped after each read
+    std::atomic<igtlUint32> ReaderWaiting;
+    std::atomic<igtlUint32> WriterWaiting;
+    char                    Pad2[48];
+  } RingHeader;
+
+  typedef struct {
+    igtlUint32              Magic;
+    igtlUint32              Version;
+    igtlUint64              RingSize;      // Capacity of each ring (power of 2)
+    std::atomic<igtlUint32> State;         // STATE_*; also a futex word
+    igtlInt32               ServerPid;
+    igtlInt32               ClientPid;
+    char                    Pad[36];
+    RingHeader              Rings[2];      // RING_UP (client -> repeater), RING_DOWN
+  } Control;
+
+  enum {
+    STATE_WAITING   = 0,
+    STATE_ATTACHED  = 1,
+    STATE_CLOSED    = 2,
+    STATE_ATTACHING = 3    // A client has claimed the memory; ClientPid is not set yet
+  };
+
+  enum {
+    RING_UP   = 0,
+    RING_DOWN = 1
+  };
+
+public:
+
+  virtual const char * GetClassName() { return "SharedMemoryTransport"; };
+
+  // Repeater side: creates the shared memory object with two rings of
+  // at least 'ringSize' bytes each. Returns 1 on success.
+  int Create(const char * name, igtlUint64 ringSize);
+
+  // Repeater side: returns 1 once a client has attached.
+  int WaitForAttach(int msec);
+
+  // Client side: attaches to the shared memory object created by the repeater.
+  int Attach(const char * name);
+
+  virtual int        Send(const void * data, igtlUint64 length);
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1);
+  virtual void       Close();
+
+  // Zero-copy interface. Peek() waits for data and returns the number of
+  // contiguous bytes readable at '*data' (0 if closed); Consume() releases
+  // them. Reserve() waits for space and returns the number of contiguous
+  // bytes writable at '*data' (up to 'length'; 0 if closed); Commit()
+  // publishes them.
+  igtlUint64 Peek(const void ** data);
+  void       Consume(igtlUint64 length);
+  igtlUint64 Reserve(void ** data, igtlUint64 length);
+  void       Commit(igtlUint64 length);
+
+protected:
+
+  SharedMemoryTransport();
+  ~SharedMemoryTransport();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  int            Map(int fd, igtlUint64 size);
+  void           Unmap();
+  int            IsClosed();
+  int            IsPeerAlive();
+
+  // Wait until the ring has data / space. Return 0 if the transport is closed.
+  int            WaitForData();
+  int            WaitForSpace();
+
+protected:
+
+  std::string     Name;
+  int             IsServer;
+  Control *       Shared;
+  igtlUint64      MappedSize;
+
+  RingHeader *    RxRing;
+  unsigned char * RxData;
+  RingHeader *    TxRing;
+  unsigned char * TxData;
+  igtlUint64      Mask;
+
+};
+
+}
+
+#endif // SHMTRANSPORT_H
@@ -0,0 +1,341 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <iomanip>
+#include <sstream>
+
+#include "summary.h"
+
+namespace igtl
+{
+
+// Width of the last value in the summary
+static const size_t LAST_VALUE_WIDTH = 60;
+
+//-----------------------------------------------------------------------------
+SummaryTable::SummaryTable()
+{
+  this->Current = NULL;
+  memset(&this->CurrentKey, 0, sizeof(Key));
+  this->Closed  = 0;
+}
+
+//-----------------------------------------------------------------------------
+SummaryTable::~SummaryTable()
+{
+}
+
+//-----------------------------------------------------------------------------
+void SummaryTable::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+size_t SummaryTable::KeyHash::operator()(const Key & k) const
+{
+  // FNV-1a over the device type and name
+  size_t h = 2166136261U;
+  for (int i = 0; i < IGTL_HEADER_TYPE_SIZE && k.Type[i]; i ++)
+    {
+    h = (h ^ (unsigned char) k.Type[i]) * 16777619U;
+    }
+  for (int i = 0; i < IGTL_HEADER_NAME_SIZE && k.Name[i]; i ++)
+    {
+    h = (h ^ (unsigned char) k.Name[i]) * 16777619U;
+    }
+  return h;
+}
+
+//-----------------------------------------------------------------------------
+bool SummaryTable::KeyEqual::operator()(const Key & a, const Key & b) const
+{
+  return memcmp(&a, &b, sizeof(Key)) == 0;
+}
+
+//-----------------------------------------------------------------------------
+void SummaryTable::Update(const char * type, const char * name, igtlUint64 size, igtlInt64 time)
+{
+  Key key;
+  memset(&key, 0, sizeof(Key));
+  strncpy(key.Type, type, IGTL_HEADER_TYPE_SIZE);
+  strncpy(key.Name, name, IGTL_HEADER_NAME_SIZE);
+
+  this->Lock.Lock();
+
+  // Most messages come from the same source as the previous one.
+  Entry * e = this->Current;
+  if (e == NULL || !KeyEqual()(key, this->CurrentKey))
+    {
+    std::unordered_map<Key, Entry, KeyHash, KeyEqual>::iterator it = this->Entries.find(key);
+    if (it == this->Entries.end())
+      {
+      Entry entry;
+      entry.Count       = 0;
+      entry.Bytes       = 0;
+      entry.MinInterval = 0;
+      entry.MaxInterval = 0;
+      entry.LastTime    = 0;
+      entry.Format      = NULL;
+      it = this->Entries.insert(std::make_pair(key, entry)).first;
+      }
+    // Entries are never erased, so the pointer stays valid.
+    e = &(it->second);
+    this->Current    = e;
+    this->CurrentKey = key;
+    }
+
+  if (e->LastTime != 0 && time > e->LastTime)
+    {
+    igtlInt64 interval = time - e->LastTime;
+    if (e->MinInterval == 0 || interval < e->MinInterval)
+      {
+      e->MinInterval = interval;
+      }
+    if (interval > e->MaxInterval)
+      {
+      e->MaxInterval = interval;
+      }
+    }
+  e->Count ++;
+  e->Bytes   += size;
+  e->LastTime = time;
+
+  this->Lock.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+void SummaryTable::SetLastValue(igtl::MessageBase * msg, Formatter format)
+{
+  this->Lock.Lock();
+  if (this->Current)
+    {
+    this->Current->Last   = msg;
+    this->Current->Format = format;
+    }
+  this->Lock.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+void SummaryTable::Collect(std::vector< std::pair<Key, Entry> > & entries)
+{
+  this->Lock.Lock();
+  std::unordered_map<Key, Entry, KeyHash, KeyEqual>::iterator it;
+  for (it = this->Entries.begin(); it != this->Entries.end(); it ++)
+    {
+    Entry & e = it->second;
+    if (e.Count == 0 && e.Last.IsNull())
+      {
+      continue;
+      }
+    entries.push_back(*it);
+    e.Count       = 0;
+    e.Bytes       = 0;
+    e.MinInterval = 0;
+    e.MaxInterval = 0;
+    e.Last        = NULL;
+    }
+  this->Lock.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+TrafficSummary::TrafficSummary()
+{
+  this->Period      = 0.0;
+  this->LastSummary = 0;
+  this->Mutex       = igtl::MutexLock::New();
+  this->logger      = NULL;
+}
+
+//-----------------------------------------------------------------------------
+TrafficSummary::~TrafficSummary()
+{
+}
+
+//-----------------------------------------------------------------------------
+void TrafficSummary::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+igtl::SummaryTable * TrafficSummary::AddTable(const char * direction)
+{
+  igtl::SummaryTable::Pointer table = igtl::SummaryTable::New();
+  table->SetDirection(direction);
+
+  this->Mutex->Lock();
+  this->Tables.push_back(table);
+  this->Mutex->Unlock();
+
+  return table;
+}
+
+//-----------------------------------------------------------------------------
+void TrafficSummary::Check(igtlInt64 now)
+{
+  if (this->Period <= 0.0)
+    {
+    return;
+    }
+  if (this->LastSummary == 0)
+    {
+    this->LastSummary = now;
+    }
+  double period = (double) (now - this->LastSummary) * 1.0e-9;
+  if (period >= this->Period)
+    {
+    this->PrintSummary(period);
+    this->LastSummary = now;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void TrafficSummary::PrintSummary(double period)
+{
+  this->Mutex->Lock();
+
+  std::map<std::string, Row>::iterator rit;
+  for (rit = this->Rows.begin(); rit != this->Rows.end(); rit ++)
+    {
+    Row & row = rit->second;
+    row.PeriodCount = 0;
+    row.PeriodBytes = 0;
+    row.MinInterval = 0;
+    row.MaxInterval = 0;
+    }
+
+  // Merge the tables of the sessions. A closed table has no more updates
+  // once it has been collected.
+  std::vector< std::pair<SummaryTable::Key, SummaryTable::Entry> > entries;
+  std::vector<igtl::SummaryTable::Pointer>::iterator tit = this->Tables.begin();
+  while (tit != this->Tables.end())
+    {
+    int closed = (*tit)->IsClosed();
+    entries.clear();
+    (*tit)->Collect(entries);
+    for (size_t i = 0; i < entries.size(); i ++)
+      {
+      const SummaryTable::Key & key = entries[i].first;
+      SummaryTable::Entry & e = entries[i].second;
+      std::string k = (*tit)->GetDirection() + '\n' + key.Type + '\n' + key.Name;
+      rit = this->Rows.find(k);
+      if (rit == this->Rows.end())
+        {
+        Row row;
+        row.Direction   = (*tit)->GetDirection();
+        row.Type        = key.Type;
+        row.Name        = key.Name;
+        row.Count       = 0;
+        row.Bytes       = 0;
+        row.PeriodCount = 0;
+        row.PeriodBytes = 0;
+        row.MinInterval = 0;
+        row.MaxInterval = 0;
+        row.LastTime    = 0;
+        row.Format      = NULL;
+        rit = this->Rows.insert(std::make_pair(k, row)).first;
+        }
+      Row & row = rit->second;
+      row.Count       += e.Count;
+      row.Bytes       += e.Bytes;
+      row.PeriodCount += e.Count;
+      row.PeriodBytes += e.Bytes;
+      if (e.MinInterval > 0 && (row.MinInterval == 0 || e.MinInterval < row.MinInterval))
+        {
+        row.MinInterval = e.MinInterval;
+        }
+      if (e.MaxInterval > row.MaxInterval)
+        {
+        row.MaxInterval = e.MaxInterval;
+        }
+      if (e.Last.IsNotNull() && e.LastTime >= row.LastTime)
+        {
+        row.Last   = e.Last;
+        row.Format = e.Format;
+        }
+      if (e.LastTime > row.LastTime)
+        {
+        row.LastTime = e.LastTime;
+        }
+      }
+    if (closed)
+      {
+      tit = this->Tables.erase(tit);
+      }
+    else
+      {
+      tit ++;
+      }
+    }
+
+  std::stringstream ss;
+  ss << std::fixed;
+  ss << "# SUMMARY " << std::setprecision(1) << period << " s" << std::endl;
+  ss << "# " << std::left
+     << std::setw(12) << "Direction" << std::setw(13) << "Type" << std::setw(21) << "Device"
+     << std::right
+     << std::setw(9) << "Msgs" << std::setw(9) << "Hz" << std::setw(9) << "MinHz" << std::setw(9) << "MaxHz"
+     << std::setw(11) << "kB/s" << std::setw(12) << "Total" << "  Last" << std::endl;
+
+  for (rit = this->Rows.begin(); rit != this->Rows.end(); rit ++)
+    {
+    Row & row = rit->second;
+    ss << "# " << std::left
+       << std::setw(12) << row.Direction << std::setw(13) << row.Type << std::setw(21) << row.Name
+       << std::right << std::setw(9) << row.PeriodCount
+       << std::setprecision(1) << std::setw(9) << (double) row.PeriodCount / period;
+    if (row.MaxInterval > 0)
+      {
+      ss << std::setw(9) << 1.0e9 / (double) row.MaxInterval
+         << std::setw(9) << 1.0e9 / (double) row.MinInterval;
+      }
+    else
+      {
+      ss << std::setw(9) << "-" << std::setw(9) << "-";
+      }
+    ss << std::setw(11) << (double) row.PeriodBytes / period * 1.0e-3
+       << std::setw(12) << row.Count;
+
+    // The last value is formatted here rather than for every message.
+    if (row.Last.IsNotNull() && row.Format)
+      {
+      std::stringstream value;
+      row.Format(row.Last, value);
+      std::string s = value.str();
+      for (size_t i = 0; i < s.size(); i ++)
+        {
+        if (s[i] == '\n')
+          {
+          s[i] = ' ';
+          }
+        }
+      if (s.size() > LAST_VALUE_WIDTH)
+        {
+        s = s.substr(0, LAST_VALUE_WIDTH - 3) + "...";
+        }
+      ss << "  " << s;
+      }
+    ss << std::endl;
+    }
+
+  this->Mutex->Unlock();
+
+  if (this->logger.IsNotNull())
+    {
+    this->logger->Print(ss.str());
+    }
+}
+
+}
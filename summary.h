@@ -0,0 +1,179 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMutexLock.h"
+#include "igtlMessageBase.h"
+#include "igtl_header.h"
+#include "logger.h"
+
+namespace igtl
+{
+
+// SummaryTable counts the messages of one session by (device type, device
+// name). It is written only by the thread processing the session, so its
+// lock is contended only while TrafficSummary collects the counts.
+class IGTLCommon_EXPORT SummaryTable : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::SummaryTable, igtl::Object)
+  igtlNewMacro(igtl::SummaryTable);
+
+public:
+
+  virtual const char * GetClassName() { return "SummaryTable"; };
+
+  // Writes the last value of a message type to 'os'.
+  typedef void (*Formatter)(igtl::MessageBase * msg, std::ostream & os);
+
+  void SetDirection(const char * direction) { this->Direction = direction; };
+  const std::string & GetDirection() { return this->Direction; };
+
+  // Counts a message of 'size' bytes received at 'time' (ns; Clock::Ticks()).
+  void Update(const char * type, const char * name, igtlUint64 size, igtlInt64 time);
+
+  // Keeps the decoded 'msg' as the last value of the message counted by the
+  // preceding Update(). It is formatted only when the summary is printed.
+  void SetLastValue(igtl::MessageBase * msg, Formatter format);
+
+  typedef struct {
+    char Type[IGTL_HEADER_TYPE_SIZE + 1];
+    char Name[IGTL_HEADER_NAME_SIZE + 1];
+  } Key;
+
+  typedef struct {
+    igtlUint64 Count;        // # of messages since the last collection
+    igtlUint64 Bytes;        // Bytes since the last collection
+    igtlInt64  MinInterval;  // ns; since the last collection (0: none)
+    igtlInt64  MaxInterval;  // ns
+    igtlInt64  LastTime;     // ns
+    igtl::MessageBase::Pointer Last;
+    Formatter  Format;
+  } Entry;
+
+  // Copies the entries to 'entries' and restarts the counts since the last
+  // collection.
+  void Collect(std::vector< std::pair<Key, Entry> > & entries);
+
+  // The session is finished; the table is dropped after its last summary.
+  void Close() { this->Closed = 1; };
+  int  IsClosed() { return this->Closed; };
+
+protected:
+
+  SummaryTable();
+  ~SummaryTable();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  struct KeyHash
+  {
+    size_t operator()(const Key & k) const;
+  };
+  struct KeyEqual
+  {
+    bool operator()(const Key & a, const Key & b) const;
+  };
+
+protected:
+
+  std::string Direction;
+
+  igtl::SimpleMutexLock Lock;
+  std::unordered_map<Key, Entry, KeyHash, KeyEqual> Entries;
+  Entry * Current;  // Entry of the last Update()
+  Key     CurrentKey;
+
+  volatile int Closed;
+
+};
+
+
+// TrafficSummary replaces the per-message log lines by a table of the
+// messages by (direction, device type, device name), printed every
+// 'Period' seconds: message and byte counts, average / minimum / maximum
+// rate, and the last decoded value.
+class IGTLCommon_EXPORT TrafficSummary : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::TrafficSummary, igtl::Object)
+  igtlNewMacro(igtl::TrafficSummary);
+
+public:
+
+  virtual const char * GetClassName() { return "TrafficSummary"; };
+
+  void SetLogger(igtl::Logger * logger) { this->logger = logger; };
+
+  void   SetPeriod(double s) { this->Period = s; };
+  double GetPeriod() { return this->Period; };
+
+  // Creates a table for a session in 'direction'.
+  igtl::SummaryTable * AddTable(const char * direction);
+
+  // Called periodically with Clock::Ticks(); prints the summary when due.
+  void Check(igtlInt64 now);
+
+protected:
+
+  TrafficSummary();
+  ~TrafficSummary();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  void           PrintSummary(double period);
+
+  // Totals of a (direction, device type, device name) over all sessions
+  typedef struct {
+    std::string Direction;
+    std::string Type;
+    std::string Name;
+    igtlUint64 Count;
+    igtlUint64 Bytes;
+    igtlUint64 PeriodCount;
+    igtlUint64 PeriodBytes;
+    igtlInt64  MinInterval;  // ns; in the period (0: none)
+    igtlInt64  MaxInterval;  // ns
+    igtlInt64  LastTime;     // ns
+    igtl::MessageBase::Pointer Last;
+    SummaryTable::Formatter    Format;
+  } Row;
+
+protected:
+
+  double    Period;
+  igtlInt64 LastSummary;
+
+  igtl::MutexLock::Pointer Mutex;
+  std::vector<igtl::SummaryTable::Pointer> Tables;
+  std::map<std::string, Row> Rows;  // Sorted by direction, type, and name
+
+  igtl::Logger::Pointer logger;
+
+};
+
+}
+
+#endif // SUMMARY_H
@@ -0,0 +1,243 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "tap.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+TrafficTap::TrafficTap()
+{
+  this->MaximumQueuedMessages = 256;
+  this->MaximumQueuedBytes    = 16 * 1024 * 1024;
+  this->SendTimeout           = 2000;
+  this->Running          = 0;
+  this->Threader         = igtl::MultiThreader::New();
+  this->ListenerThreadID = -1;
+  this->Dropped          = 0;
+}
+
+//-----------------------------------------------------------------------------
+TrafficTap::~TrafficTap()
+{
+  this->Stop();
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int TrafficTap::Start(int port)
+{
+  if (this->Running)
+    {
+    return 0;
+    }
+
+  this->ServerSocket = igtl::SocketTransport::New();
+  if (!this->ServerSocket->Listen(port))
+    {
+    std::cerr << "ERROR: cannot create a tap socket on port " << port << std::endl;
+    this->ServerSocket = NULL;
+    return 0;
+    }
+
+  this->Running = 1;
+  this->ListenerThreadID =
+    this->Threader->SpawnThread((igtl::ThreadFunctionType) &TrafficTap::ListenerThreadFunction, this);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::Stop()
+{
+  if (!this->Running)
+    {
+    return;
+    }
+  this->Running = 0;
+  this->Threader->TerminateThread(this->ListenerThreadID);
+  this->ListenerThreadID = -1;
+  this->ServerSocket->Close();
+
+  this->Reap(1);
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::Mirror(igtl::MessageBase * msg)
+{
+  igtlUint64 size = msg->GetPackSize();
+
+  this->ClientsLock.Lock();
+  for (size_t i = 0; i < this->Clients.size(); i ++)
+    {
+    Client * c = this->Clients[i];
+    c->Lock.Lock();
+    if (!c->Closed)
+      {
+      if ((int) c->Queue.size() >= this->MaximumQueuedMessages ||
+          c->QueuedBytes + size > this->MaximumQueuedBytes)
+        {
+        c->Dropped ++;
+        }
+      else
+        {
+        c->Queue.push_back(msg);
+        c->QueuedBytes += size;
+        c->Ready->Signal();
+        }
+      }
+    c->Lock.Unlock();
+    }
+  this->ClientsLock.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 TrafficTap::GetDropped()
+{
+  this->ClientsLock.Lock();
+  igtlUint64 dropped = this->Dropped;
+  for (size_t i = 0; i < this->Clients.size(); i ++)
+    {
+    Client * c = this->Clients[i];
+    c->Lock.Lock();
+    dropped += c->Dropped;
+    c->Lock.Unlock();
+    }
+  this->ClientsLock.Unlock();
+  return dropped;
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::Reap(int all)
+{
+  std::vector<Client *> closed;
+
+  this->ClientsLock.Lock();
+  for (size_t i = 0; i < this->Clients.size(); )
+    {
+    Client * c = this->Clients[i];
+    c->Lock.Lock();
+    if (all)
+      {
+      c->Closed = 1;
+      c->Ready->Signal();
+      }
+    int done = c->Closed;
+    c->Lock.Unlock();
+    if (done)
+      {
+      closed.push_back(c);
+      this->Clients.erase(this->Clients.begin() + i);
+      }
+    else
+      {
+      i ++;
+      }
+    }
+  this->ClientsLock.Unlock();
+
+  // Wait for the writers outside the lock so that Mirror() is not delayed.
+  // A writer blocked in Send() returns within the send timeout; all
+  // sockets are closed first so that the waits overlap.
+  for (size_t i = 0; i < closed.size(); i ++)
+    {
+    closed[i]->Socket->Close();
+    }
+  for (size_t i = 0; i < closed.size(); i ++)
+    {
+    Client * c = closed[i];
+    this->Threader->TerminateThread(c->ThreadID);
+    std::cerr << "Tap client disconnected: Sent=" << c->Sent << ", Dropped=" << c->Dropped << std::endl;
+    this->ClientsLock.Lock();
+    this->Dropped += c->Dropped;
+    this->ClientsLock.Unlock();
+    delete c;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::ListenerThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  TrafficTap * tap = static_cast<TrafficTap *>(info->UserData);
+
+  while (tap->Running)
+    {
+    igtl::SocketTransport::Pointer socket = tap->ServerSocket->Accept(500);
+    if (socket.IsNotNull() && tap->Running)
+      {
+      socket->GetSocket()->SetSendTimeout(tap->SendTimeout);
+      Client * c = new Client;
+      c->Tap         = tap;
+      c->Socket      = socket;
+      c->Ready       = igtl::ConditionVariable::New();
+      c->QueuedBytes = 0;
+      c->Sent        = 0;
+      c->Dropped     = 0;
+      c->Closed      = 0;
+      c->ThreadID    = tap->Threader->SpawnThread((igtl::ThreadFunctionType) &TrafficTap::ClientThreadFunction, c);
+
+      tap->ClientsLock.Lock();
+      tap->Clients.push_back(c);
+      tap->ClientsLock.Unlock();
+      std::cerr << "Tap client connected." << std::endl;
+      }
+    tap->Reap(0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTap::ClientThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  Client * c = static_cast<Client *>(info->UserData);
+
+  c->Lock.Lock();
+  while (!c->Closed)
+    {
+    if (c->Queue.empty())
+      {
+      c->Ready->Wait(&(c->Lock));
+      continue;
+      }
+    igtl::MessageBase::Pointer msg = c->Queue.front();
+    c->Queue.pop_front();
+    c->Lock.Unlock();
+
+    int r = c->Socket->Send(msg->GetPackPointer(), msg->GetPackSize());
+
+    c->Lock.Lock();
+    c->QueuedBytes -= msg->GetPackSize();
+    if (r)
+      {
+      c->Sent ++;
+      }
+    else
+      {
+      // Disconnected, or stalled for the send timeout
+      c->Closed = 1;
+      }
+    }
+  c->Queue.clear();
+  c->QueuedBytes = 0;
+  c->Lock.Unlock();
+}
+
+} // End of igtl namespace
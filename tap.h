@@ -0,0 +1,116 @@
+#ifndef TAP_H
+#define TAP_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <deque>
+#include <vector>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMessageBase.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+#include "transport.h"
+
+namespace igtl
+{
+
+// TrafficTap mirrors forwarded messages to any number of monitor clients
+// connected to a separate port. Mirror() queues a reference to the packed
+// message for each client and returns without waiting; each client has a
+// writer thread and a bounded queue. When a queue is full, the message is
+// dropped for that client only and counted, so a slow or stalled monitor
+// never delays the relay path. A client that accepts no data for the send
+// timeout is disconnected, so that a stalled monitor does not hold its
+// writer thread. Data sent by the monitor clients is ignored.
+class IGTLCommon_EXPORT TrafficTap : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::TrafficTap, igtl::Object)
+  igtlNewMacro(igtl::TrafficTap);
+
+public:
+
+  virtual const char * GetClassName() { return "TrafficTap"; };
+
+  // Limits of each client's queue (defaults: 256 messages, 16 MiB)
+  void SetMaximumQueuedMessages(int n)        { this->MaximumQueuedMessages = n; };
+  void SetMaximumQueuedBytes(igtlUint64 size) { this->MaximumQueuedBytes = size; };
+  igtlUint64 GetMaximumQueuedBytes()          { return this->MaximumQueuedBytes; };
+
+  // Time in ms a client may accept no data before it is disconnected
+  // (default: 2000). Set before Start().
+  void SetSendTimeout(int msec) { this->SendTimeout = msec; };
+  int  GetSendTimeout()         { return this->SendTimeout; };
+
+  // Starts accepting monitor clients on 'port'. Returns 1 on success.
+  int  Start(int port);
+  void Stop();
+
+  // Queues a packed message for all clients. The message must not be
+  // modified afterwards.
+  void Mirror(igtl::MessageBase * msg);
+
+  // Total # of messages dropped for all clients so far
+  igtlUint64 GetDropped();
+
+protected:
+
+  TrafficTap();
+  ~TrafficTap();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct {
+    TrafficTap *                 Tap;
+    igtl::SocketTransport::Pointer Socket;
+    igtl::SimpleMutexLock        Lock;
+    igtl::ConditionVariable::Pointer Ready;
+    std::deque<igtl::MessageBase::Pointer> Queue;
+    igtlUint64                   QueuedBytes;
+    igtlUint64                   Sent;
+    igtlUint64                   Dropped;
+    int                          Closed;
+    int                          ThreadID;
+  } Client;
+
+  // Removes the clients that have disconnected.
+  void           Reap(int all);
+
+  static void    ListenerThreadFunction(void * ptr);
+  static void    ClientThreadFunction(void * ptr);
+
+protected:
+
+  int                          MaximumQueuedMessages;
+  igtlUint64                   MaximumQueuedBytes;
+  int                          SendTimeout;
+
+  int                          Running;
+  igtl::SocketTransport::Pointer ServerSocket;
+  igtl::MultiThreader::Pointer Threader;
+  int                          ListenerThreadID;
+
+  igtl::SimpleMutexLock        ClientsLock;
+  std::vector<Client *>        Clients;
+  igtlUint64                   Dropped;   // By the clients already removed
+
+};
+
+}
+
+#endif // TAP_H
@@ -0,0 +1,111 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+//
+// Downsamples uniform volumes at the largest values of each scalar type
+// with factors around the limit of the 32-bit accumulator, and checks that
+// the average is the input value.
+//
+//   test_decimator
+//
+
+#include <iostream>
+#include <vector>
+
+#include "decimator.h"
+
+#include "igtl_util.h"
+
+template <typename T>
+static int Check(const char * name, int scalarType, T value, int factor)
+{
+  int size[3] = {factor, factor, factor};
+  float spacing[3] = {1.0f, 1.0f, 1.0f};
+  int zero[3] = {0, 0, 0};
+
+  igtl::ImageMessage::Pointer src = igtl::ImageMessage::New();
+  src->SetDeviceName("Test");
+  src->SetDimensions(size);
+  src->SetSpacing(spacing);
+  src->SetScalarType(scalarType);
+  src->SetEndian(igtl_is_little_endian() ? igtl::ImageMessage::ENDIAN_LITTLE : igtl::ImageMessage::ENDIAN_BIG);
+  src->SetNumComponents(1);
+  src->SetSubVolume(size, zero);
+  src->AllocateScalars();
+
+  T * in = (T *) src->GetScalarPointer();
+  igtlUint64 n = (igtlUint64) factor * factor * factor;
+  for (igtlUint64 i = 0; i < n; i ++)
+    {
+    in[i] = value;
+    }
+
+  igtl::ImageDecimator::Pointer decimator = igtl::ImageDecimator::New();
+  decimator->SetDownsampleFactor(factor);
+  igtl::ImageMessage::Pointer dst = decimator->Downsample(src);
+  if (dst.IsNull())
+    {
+    std::cerr << name << ", factor " << factor << ": not downsampled" << std::endl;
+    return 1;
+    }
+
+  int osize[3];
+  dst->GetDimensions(osize);
+  T out = *(T *) dst->GetScalarPointer();
+  if (osize[0] != 1 || osize[1] != 1 || osize[2] != 1 || out != value)
+    {
+    std::cerr << name << ", factor " << factor << ": " << (double) out
+              << " instead of " << (double) value << std::endl;
+    return 1;
+    }
+  return 0;
+}
+
+int main(int, char **)
+{
+  int failed = 0;
+
+  // 32^3 samples of 16-bit scalars are the most that fit in 32 bits.
+  for (int f = 31; f <= 34; f ++)
+    {
+    failed += Check<igtlUint16>("uint16", igtl::ImageMessage::TYPE_UINT16, 65535, f);
+    failed += Check<igtlInt16>("int16", igtl::ImageMessage::TYPE_INT16, -32768, f);
+    failed += Check<igtlInt16>("int16", igtl::ImageMessage::TYPE_INT16, 32767, f);
+    failed += Check<igtlInt32>("int32", igtl::ImageMessage::TYPE_INT32, -2147483647 - 1, f);
+    failed += Check<igtlUint32>("uint32", igtl::ImageMessage::TYPE_UINT32, 4294967295U, f);
+    }
+
+  // ... and 203^3 samples of 8-bit scalars.
+  for (int f = 203; f <= 204; f ++)
+    {
+    failed += Check<igtlUint8>("uint8", igtl::ImageMessage::TYPE_UINT8, 255, f);
+    failed += Check<igtlInt8>("int8", igtl::ImageMessage::TYPE_INT8, -128, f);
+    }
+
+  // Factors that a 64-bit sum of 32-bit scalars cannot hold are clamped.
+  igtl::ImageDecimator::Pointer decimator = igtl::ImageDecimator::New();
+  decimator->SetDownsampleFactor(1 << 20);
+  if (decimator->GetDownsampleFactor() != igtl::ImageDecimator::MAXIMUM_DOWNSAMPLE_FACTOR)
+    {
+    std::cerr << "Factor not clamped: " << decimator->GetDownsampleFactor() << std::endl;
+    failed ++;
+    }
+
+  if (failed)
+    {
+    std::cerr << failed << " checks failed" << std::endl;
+    return 1;
+    }
+  std::cout << "All checks passed" << std::endl;
+  return 0;
+}
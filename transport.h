@@ -0,0 +1,195 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlSocket.h"
+#include "igtlClientSocket.h"
+#include "igtlServerSocket.h"
+
+namespace igtl
+{
+
+// Transport is the byte stream a Session receives messages from and sends
+// messages to. Its interface follows igtl::Socket so that a Session can be
+// connected to a TCP socket or to another transport (e.g. shared memory).
+class IGTLCommon_EXPORT Transport : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::Transport, igtl::Object)
+
+public:
+
+  virtual const char * GetClassName() { return "Transport"; };
+
+  // Returns 1 on success, 0 on failure (same as igtl::Socket::Send()).
+  virtual int        Send(const void * data, igtlUint64 length) = 0;
+
+  // Returns the number of bytes received; 0 if the connection is closed
+  // (same as igtl::Socket::Receive()). If 'readFully' is 0, returns as soon
+  // as some data is available.
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1) = 0;
+
+  virtual void       Close() = 0;
+
+  // Returns a descriptor that can be passed to poll() to wait for incoming
+  // data, or -1 if the transport has none.
+  virtual int        GetDescriptor() { return -1; };
+
+protected:
+
+  Transport() {};
+  ~Transport() {};
+
+};
+
+
+// Transport over an igtl::Socket (TCP). The transport creates its socket,
+// so that it can hand the descriptor to poll().
+//
+// Listening side:
+//   listener->Listen(18944);
+//   SocketTransport::Pointer transport = listener->Accept(1000);
+//
+// Connecting side:
+//   transport->Connect("localhost", 18944);
+//
+class IGTLCommon_EXPORT SocketTransport : public Transport
+{
+public:
+
+  igtlTypeMacro(igtl::SocketTransport, igtl::Transport)
+  igtlNewMacro(igtl::SocketTransport);
+
+public:
+
+  virtual const char * GetClassName() { return "SocketTransport"; };
+
+  // Listens on 'port'. Returns 1 on success.
+  int        Listen(int port)
+  {
+    Server::Pointer server = Server::New();
+    if (server->CreateServer(port) < 0)
+      {
+      return 0;
+      }
+    this->socket     = server.GetPointer();
+    this->Descriptor = server->GetDescriptor();
+    return 1;
+  };
+
+  // Waits up to 'msec' ms for a connection on a listening transport.
+  // Returns NULL on timeout or error.
+  SocketTransport::Pointer Accept(int msec)
+  {
+    Server * server = dynamic_cast<Server *>(this->socket.GetPointer());
+    Client::Pointer client = server ? server->WaitForClient(msec) : NULL;
+    if (client.IsNull())
+      {
+      return NULL;
+      }
+    SocketTransport::Pointer transport = SocketTransport::New();
+    transport->socket     = client.GetPointer();
+    transport->Descriptor = client->GetDescriptor();
+    return transport;
+  };
+
+  // Connects to 'hostname':'port'. Returns 1 on success.
+  int        Connect(const char * hostname, int port)
+  {
+    Client::Pointer client = Client::New();
+    if (client->ConnectToServer(hostname, port) != 0)
+      {
+      return 0;
+      }
+    this->socket     = client.GetPointer();
+    this->Descriptor = client->GetDescriptor();
+    return 1;
+  };
+
+  igtl::Socket * GetSocket() { return this->socket; };
+
+  virtual int        Send(const void * data, igtlUint64 length)
+  {
+    return this->socket->Send(data, length);
+  };
+
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1)
+  {
+    return this->socket->Receive(data, length, timeout, readFully);
+  };
+
+  virtual void       Close()
+  {
+    if (this->socket.IsNotNull())
+      {
+      this->socket->CloseSocket();
+      }
+  };
+
+  virtual int        GetDescriptor() { return this->Descriptor; };
+
+protected:
+
+  // Sockets that give their descriptor to the transport.
+  class Client : public igtl::ClientSocket
+  {
+  public:
+    igtlTypeMacro(igtl::SocketTransport::Client, igtl::ClientSocket)
+    igtlNewMacro(igtl::SocketTransport::Client);
+
+    int  GetDescriptor() { return this->m_SocketDescriptor; };
+    void SetDescriptor(int fd) { this->m_SocketDescriptor = fd; };
+  };
+
+  class Server : public igtl::ServerSocket
+  {
+  public:
+    igtlTypeMacro(igtl::SocketTransport::Server, igtl::ServerSocket)
+    igtlNewMacro(igtl::SocketTransport::Server);
+
+    int  GetDescriptor() { return this->m_SocketDescriptor; };
+
+    // As igtl::ServerSocket::WaitForConnection(), with a Client.
+    Client::Pointer WaitForClient(unsigned long msec)
+    {
+      if (this->m_SocketDescriptor < 0 || this->SelectSocket(this->m_SocketDescriptor, msec) <= 0)
+        {
+        return NULL;
+        }
+      int fd = this->Accept(this->m_SocketDescriptor);
+      if (fd < 0)
+        {
+        return NULL;
+        }
+      Client::Pointer client = Client::New();
+      client->SetDescriptor(fd);
+      return client;
+    };
+  };
+
+  SocketTransport() : Descriptor(-1) {};
+  ~SocketTransport() {};
+
+  igtl::Socket::Pointer socket;
+  int                   Descriptor;
+
+};
+
+}
+
+#endif // TRANSPORT_H
@@ -0,0 +1,227 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string.h>
+#include <errno.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "unixtransport.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+static int SetPath(struct sockaddr_un & addr, const char * path)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    {
+    std::cerr << "ERROR: socket path is too long: " << path << std::endl;
+    return 0;
+    }
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+static void DisableSigPipe(int fd)
+{
+#if defined(SO_NOSIGPIPE)
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+  (void) fd;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+UnixSocketTransport::UnixSocketTransport()
+{
+  this->Descriptor = -1;
+}
+
+//-----------------------------------------------------------------------------
+UnixSocketTransport::~UnixSocketTransport()
+{
+  this->Close();
+  if (!this->Path.empty())
+    {
+    unlink(this->Path.c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+void UnixSocketTransport::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int UnixSocketTransport::Listen(const char * path)
+{
+  struct sockaddr_un addr;
+  if (!SetPath(addr, path))
+    {
+    return 0;
+    }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+    std::cerr << "ERROR: cannot create a socket: " << strerror(errno) << std::endl;
+    return 0;
+    }
+
+  unlink(path);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(fd, 1) < 0)
+    {
+    std::cerr << "ERROR: cannot listen on " << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return 0;
+    }
+
+  this->Descriptor = fd;
+  this->Path = path;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+UnixSocketTransport::Pointer UnixSocketTransport::Accept(int msec)
+{
+  if (this->Descriptor < 0)
+    {
+    return NULL;
+    }
+
+  struct pollfd pfd;
+  pfd.fd      = this->Descriptor;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, msec) <= 0)
+    {
+    return NULL;
+    }
+
+  int fd = accept(this->Descriptor, NULL, NULL);
+  if (fd < 0)
+    {
+    return NULL;
+    }
+  DisableSigPipe(fd);
+
+  UnixSocketTransport::Pointer transport = UnixSocketTransport::New();
+  transport->Descriptor = fd;
+  return transport;
+}
+
+//-----------------------------------------------------------------------------
+int UnixSocketTransport::Connect(const char * path)
+{
+  struct sockaddr_un addr;
+  if (!SetPath(addr, path))
+    {
+    return 0;
+    }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+    std::cerr << "ERROR: cannot create a socket: " << strerror(errno) << std::endl;
+    return 0;
+    }
+
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+    std::cerr << "ERROR: cannot connect to " << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return 0;
+    }
+  DisableSigPipe(fd);
+
+  this->Descriptor = fd;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+int UnixSocketTransport::Send(const void * data, igtlUint64 length)
+{
+#if defined(MSG_NOSIGNAL)
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+
+  const char * p = (const char *) data;
+  while (length > 0)
+    {
+    ssize_t n = send(this->Descriptor, p, (size_t) length, flags);
+    if (n < 0)
+      {
+      if (errno == EINTR)
+        {
+        continue;
+        }
+      return 0;
+      }
+    p += n;
+    length -= (igtlUint64) n;
+    }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+igtlUint64 UnixSocketTransport::Receive(void * data, igtlUint64 length, bool & timeout, int readFully)
+{
+  timeout = false;
+  char * p = (char *) data;
+  igtlUint64 received = 0;
+  while (received < length)
+    {
+    ssize_t n = recv(this->Descriptor, p + received, (size_t) (length - received), 0);
+    if (n < 0 && errno == EINTR)
+      {
+      continue;
+      }
+    if (n <= 0)
+      {
+      return 0;
+      }
+    received += (igtlUint64) n;
+    if (!readFully)
+      {
+      break;
+      }
+    }
+  return received;
+}
+
+//-----------------------------------------------------------------------------
+void UnixSocketTransport::Close()
+{
+  if (this->Descriptor >= 0)
+    {
+    // Wakes a thread blocked in Receive() before the descriptor goes away.
+    shutdown(this->Descriptor, SHUT_RDWR);
+    close(this->Descriptor);
+    this->Descriptor = -1;
+    }
+}
+
+} // End of igtl namespace
@@ -0,0 +1,78 @@
+#ifndef UNIXTRANSPORT_H
+#define UNIXTRANSPORT_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <string>
+
+#include "transport.h"
+
+namespace igtl
+{
+
+// UnixSocketTransport is a stream over a Unix-domain socket. It connects
+// repeaters and clients on the same host without the TCP/IP stack.
+//
+// Listening side:
+//   listener->Listen("/tmp/igtl.sock");
+//   UnixSocketTransport::Pointer transport = listener->Accept(1000);
+//
+// Connecting side:
+//   transport->Connect("/tmp/igtl.sock");
+//
+class IGTLCommon_EXPORT UnixSocketTransport : public Transport
+{
+public:
+
+  igtlTypeMacro(igtl::UnixSocketTransport, igtl::Transport)
+  igtlNewMacro(igtl::UnixSocketTransport);
+
+public:
+
+  virtual const char * GetClassName() { return "UnixSocketTransport"; };
+
+  // Creates a socket file at 'path' and listens on it. An existing file
+  // at 'path' is replaced. Returns 1 on success.
+  int        Listen(const char * path);
+
+  // Waits up to 'msec' ms for a connection on a listening transport.
+  // Returns NULL on timeout or error.
+  UnixSocketTransport::Pointer Accept(int msec);
+
+  // Connects to the socket file at 'path'. Returns 1 on success.
+  int        Connect(const char * path);
+
+  virtual int        Send(const void * data, igtlUint64 length);
+  virtual igtlUint64 Receive(void * data, igtlUint64 length, bool & timeout, int readFully = 1);
+  virtual void       Close();
+
+  virtual int        GetDescriptor() { return this->Descriptor; };
+
+protected:
+
+  UnixSocketTransport();
+  ~UnixSocketTransport();
+
+  void           PrintSelf(std::ostream& os) const;
+
+protected:
+
+  int            Descriptor;
+  std::string    Path;           // Socket file created by Listen()
+
+};
+
+}
+
+#endif // UNIXTRANSPORT_H
@@ -0,0 +1,60 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "wire.h"
+
+#include "igtl_util.h"
+
+namespace igtl
+{
+
+//-----------------------------------------------------------------------------
+int GetPackedContent(unsigned char * pack, unsigned char ** content, igtlUint64 * contentSize)
+{
+  unsigned char * body = pack + IGTL_HEADER_SIZE;
+  igtlUint64 bodySize  = GetPackedBodySize(pack);
+
+  if (GetUint16BE(pack + WIRE_HEADER_VERSION_OFFSET) < 2)
+    {
+    *content     = body;
+    *contentSize = bodySize;
+    return 1;
+    }
+
+  // Extended header: ext_header_size(2), meta_data_header_size(2),
+  // meta_data_size(4), message_id(4)
+  if (bodySize < 12)
+    {
+    return 0;
+    }
+  igtlUint64 extSize      = GetUint16BE(body);
+  igtlUint64 metaHeadSize = GetUint16BE(body + 2);
+  igtlUint64 metaSize     = GetUint32BE(body + 4);
+  if (extSize < 12 || extSize + metaHeadSize + metaSize > bodySize)
+    {
+    return 0;
+    }
+
+  *content     = body + extSize;
+  *contentSize = bodySize - extSize - metaHeadSize - metaSize;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void UpdatePackedCRC(unsigned char * pack)
+{
+  igtlUint64 crc = crc64(pack + IGTL_HEADER_SIZE, GetPackedBodySize(pack), 0LL);
+  SetUint64BE(pack + WIRE_CRC_OFFSET, crc);
+}
+
+} // End of igtl namespace
@@ -0,0 +1,97 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Helpers to access fields of packed OpenIGTLink messages (network byte
+// order) without unpacking them into message objects.
+
+#include <string.h>
+
+#include "igtlTypes.h"
+#include "igtl_header.h"
+
+namespace igtl
+{
+
+// Offsets of the fields in the packed header
+enum {
+  WIRE_HEADER_VERSION_OFFSET = 0,
+  WIRE_DEVICE_TYPE_OFFSET    = 2,
+  WIRE_DEVICE_NAME_OFFSET    = 14,
+  WIRE_TIMESTAMP_OFFSET      = 34,
+  WIRE_BODY_SIZE_OFFSET      = 42,
+  WIRE_CRC_OFFSET            = 50
+};
+
+inline igtlUint16 GetUint16BE(const unsigned char * p)
+{
+  return (igtlUint16) ((p[0] << 8) | p[1]);
+}
+
+inline igtlUint32 GetUint32BE(const unsigned char * p)
+{
+  return ((igtlUint32) p[0] << 24) | ((igtlUint32) p[1] << 16) | ((igtlUint32) p[2] << 8) | (igtlUint32) p[3];
+}
+
+inline igtlUint64 GetUint64BE(const unsigned char * p)
+{
+  return ((igtlUint64) GetUint32BE(p) << 32) | (igtlUint64) GetUint32BE(p + 4);
+}
+
+inline void SetUint32BE(unsigned char * p, igtlUint32 v)
+{
+  p[0] = (unsigned char) (v >> 24);
+  p[1] = (unsigned char) (v >> 16);
+  p[2] = (unsigned char) (v >> 8);
+  p[3] = (unsigned char) v;
+}
+
+inline void SetUint64BE(unsigned char * p, igtlUint64 v)
+{
+  SetUint32BE(p, (igtlUint32) (v >> 32));
+  SetUint32BE(p + 4, (igtlUint32) v);
+}
+
+inline float GetFloat32BE(const unsigned char * p)
+{
+  igtlUint32 v = GetUint32BE(p);
+  float f;
+  memcpy(&f, &v, sizeof(float));
+  return f;
+}
+
+inline void SetFloat32BE(unsigned char * p, float f)
+{
+  igtlUint32 v;
+  memcpy(&v, &f, sizeof(float));
+  SetUint32BE(p, v);
+}
+
+inline igtlUint64 GetPackedBodySize(const unsigned char * pack)
+{
+  return GetUint64BE(pack + WIRE_BODY_SIZE_OFFSET);
+}
+
+// Locates the message content in the body of a packed message, skipping
+// the extended header and the meta data of version 2 headers.
+// Returns 0 if the sizes in the body are inconsistent.
+int  GetPackedContent(unsigned char * pack, unsigned char ** content, igtlUint64 * contentSize);
+
+// Recomputes the CRC of the body and stores it in the packed header.
+void UpdatePackedCRC(unsigned char * pack);
+
+}
+
+#endif // WIRE_H
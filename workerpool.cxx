@@ -0,0 +1,606 @@
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#ifndef _WIN32
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "workerpool.h"
+#include "session.h"
+#include "clock.h"
+
+namespace igtl
+{
+
+// Number of messages a worker processes from a session in a row while the
+// socket stays readable, before handing it back to the poller.
+static const int MAX_BATCH = 16;
+
+// Time (ms) queued tasks may wait with no worker taking one before the
+// poller starts a helper. There are at most as many helpers as workers.
+static const int STALL_TIME  = 10;
+
+//-----------------------------------------------------------------------------
+WorkerPool::WorkerPool()
+{
+  this->Running    = 0;
+  this->Threader   = igtl::MultiThreader::New();
+  this->NextWorker = 0;
+  this->Idle       = igtl::ConditionVariable::New();
+  this->Pending    = 0;
+  this->Progress   = 0;
+  this->WakePipe[0] = -1;
+  this->WakePipe[1] = -1;
+  this->MemoryWaiters  = 0;
+  this->MemoryReleases = 0;
+  this->MemoryReleased = 0;
+}
+
+//-----------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+  this->Stop();
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::PrintSelf(std::ostream& os) const
+{
+  this->Superclass::PrintSelf(os);
+}
+
+//-----------------------------------------------------------------------------
+int WorkerPool::Start(int nWorkers)
+{
+#ifdef _WIN32
+  (void) nWorkers;
+  return 0;
+#else
+  if (this->Running)
+    {
+    return 0;
+    }
+
+  if (nWorkers <= 0)
+    {
+    nWorkers = igtl::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+
+  if (pipe(this->WakePipe) != 0)
+    {
+    std::cerr << "ERROR: cannot create a pipe for the worker pool." << std::endl;
+    return 0;
+    }
+  fcntl(this->WakePipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(this->WakePipe[1], F_SETFL, O_NONBLOCK);
+
+  this->Running = 1;
+  for (int i = 0; i < nWorkers; i ++)
+    {
+    WorkerQueue * q = new WorkerQueue;
+    q->Pool  = this;
+    q->Index = i;
+    this->Workers.push_back(q);
+    }
+  for (int i = 0; i < nWorkers; i ++)
+    {
+    this->ThreadIDs.push_back(this->Threader->SpawnThread((igtl::ThreadFunctionType) &WorkerPool::WorkerThreadFunction, this->Workers[i]));
+    }
+  this->ThreadIDs.push_back(this->Threader->SpawnThread((igtl::ThreadFunctionType) &WorkerPool::PollerThreadFunction, this));
+
+  return 1;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::Stop()
+{
+  if (!this->Running)
+    {
+    return;
+    }
+
+  this->Running = 0;
+  this->WakePoller();
+  this->IdleLock.Lock();
+  this->Idle->Broadcast();
+  this->IdleLock.Unlock();
+
+  for (size_t i = 0; i < this->ThreadIDs.size(); i ++)
+    {
+    this->Threader->TerminateThread(this->ThreadIDs[i]);
+    }
+  this->ThreadIDs.clear();
+  this->ReapHelpers(true);
+
+  for (size_t i = 0; i < this->Workers.size(); i ++)
+    {
+    delete this->Workers[i];
+    }
+  this->Workers.clear();
+
+  for (size_t i = 0; i < this->Entries.size(); i ++)
+    {
+    this->Entries[i]->session->FinishProcessing();
+    delete this->Entries[i];
+    }
+  this->Entries.clear();
+
+#ifndef _WIN32
+  close(this->WakePipe[0]);
+  close(this->WakePipe[1]);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+int WorkerPool::AddSession(igtl::Session * session, int fd)
+{
+  if (!this->Running || fd < 0)
+    {
+    return 0;
+    }
+
+  Entry * e = new Entry;
+  e->session   = session;
+  e->fd        = fd;
+  e->armed     = 1;
+  e->busy      = 0;
+  e->cancelled = 0;
+  e->deferred  = Session::DEFER_NONE;
+  e->resumeTime = 0;
+
+  this->EntryLock.Lock();
+  this->Entries.push_back(e);
+  this->EntryLock.Unlock();
+
+  this->WakePoller();
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::RemoveSession(igtl::Session * session)
+{
+  this->EntryLock.Lock();
+  for (size_t i = 0; i < this->Entries.size(); i ++)
+    {
+    if (this->Entries[i]->session.GetPointer() == session)
+      {
+      this->Entries[i]->cancelled = 1;
+      }
+    }
+  this->EntryLock.Unlock();
+
+  this->WakePoller();
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::ReleaseMemory()
+{
+  this->MemoryReleases ++;
+  if (this->MemoryWaiters.load() > 0 && !this->MemoryReleased.exchange(1))
+    {
+    this->WakePoller();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::Submit(Entry * entry)
+{
+  this->IdleLock.Lock();
+  if (this->Pending == 0)
+    {
+    this->Progress = igtl::Clock::Ticks();
+    }
+  this->Pending ++;
+  this->IdleLock.Unlock();
+
+  WorkerQueue * q = this->Workers[this->NextWorker % this->Workers.size()];
+  this->NextWorker ++;
+  q->Lock.Lock();
+  q->Tasks.push_back(entry);
+  q->Lock.Unlock();
+
+  this->IdleLock.Lock();
+  this->Idle->Signal();
+  this->IdleLock.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+WorkerPool::Entry * WorkerPool::NextTask(int worker)
+{
+  Entry * e = NULL;
+  int n = (int) this->Workers.size();
+
+  // Own queue first (newest task), then steal the oldest task of the others.
+  for (int i = 0; i < n && !e; i ++)
+    {
+    WorkerQueue * q = this->Workers[(worker + i) % n];
+    q->Lock.Lock();
+    if (!q->Tasks.empty())
+      {
+      if (i == 0)
+        {
+        e = q->Tasks.back();
+        q->Tasks.pop_back();
+        }
+      else
+        {
+        e = q->Tasks.front();
+        q->Tasks.pop_front();
+        }
+      }
+    q->Lock.Unlock();
+    }
+
+  if (e)
+    {
+    this->IdleLock.Lock();
+    this->Pending --;
+    this->Progress = igtl::Clock::Ticks();
+    this->IdleLock.Unlock();
+    }
+  return e;
+}
+
+//-----------------------------------------------------------------------------
+int WorkerPool::IsCancelled(Entry * e)
+{
+  this->EntryLock.Lock();
+  int cancelled = e->cancelled;
+  this->EntryLock.Unlock();
+  return cancelled;
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::RunTask(Entry * e)
+{
+#ifndef _WIN32
+  // Memory released from here on may be missed by a session that defers
+  // for memory (see below).
+  igtlUint64 releases = this->MemoryReleases.load();
+
+  // Process the messages that are already available, up to MAX_BATCH.
+  int active = 1;
+  for (int i = 0; i < MAX_BATCH && active && !this->IsCancelled(e); i ++)
+    {
+    active = e->session->ProcessNext();
+    if (e->session->GetDeferral() != Session::DEFER_NONE)
+      {
+      break;
+      }
+    struct pollfd pfd;
+    pfd.fd = e->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+      {
+      break;
+      }
+    }
+
+  int deferral = e->session->GetDeferral();
+  this->EntryLock.Lock();
+  e->busy = 0;
+  if (active && !e->cancelled && deferral != Session::DEFER_NONE)
+    {
+    e->deferred   = deferral;
+    e->resumeTime = e->session->GetResumeTime();
+    if (deferral == Session::DEFER_MEMORY)
+      {
+      this->MemoryWaiters ++;
+      }
+    }
+  else if (active && !e->cancelled)
+    {
+    e->armed = 1;
+    }
+  else
+    {
+    e->cancelled = 1;
+    }
+  this->EntryLock.Unlock();
+
+  // The session is retried at once if memory was released while it was
+  // being processed, as ReleaseMemory() may have seen no waiter.
+  if (deferral == Session::DEFER_MEMORY && this->MemoryReleases.load() != releases)
+    {
+    this->MemoryReleased = 1;
+    }
+  this->WakePoller();
+#else
+  (void) e;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+int WorkerPool::CheckStall()
+{
+  // Called by the poller
+  this->ReapHelpers(false);
+
+  igtlInt64 now = igtl::Clock::Ticks();
+  this->IdleLock.Lock();
+  int pending = this->Pending;
+  igtlInt64 waited = (now - this->Progress) / 1000000;
+  this->IdleLock.Unlock();
+
+  if (pending == 0)
+    {
+    return -1;
+    }
+  if (waited < STALL_TIME)
+    {
+    return STALL_TIME - (int) waited;
+    }
+
+  // Every worker is held by a session; the queued ones get a helper.
+  this->EntryLock.Lock();
+  size_t nSessions = this->Entries.size();
+  this->EntryLock.Unlock();
+  if (this->Helpers.size() < this->Workers.size() && this->Helpers.size() < nSessions)
+    {
+    Helper * h = new Helper;
+    h->Pool = this;
+    h->Done = 0;
+    h->ThreadID = this->Threader->SpawnThread((igtl::ThreadFunctionType) &WorkerPool::HelperThreadFunction, h);
+    this->Helpers.push_back(h);
+    }
+
+  // The next helper, if needed, after another STALL_TIME.
+  this->IdleLock.Lock();
+  this->Progress = now;
+  this->IdleLock.Unlock();
+  return STALL_TIME;
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::ReapHelpers(bool all)
+{
+  std::vector<Helper *>::iterator it = this->Helpers.begin();
+  while (it != this->Helpers.end())
+    {
+    Helper * h = *it;
+    this->IdleLock.Lock();
+    int done = h->Done;
+    this->IdleLock.Unlock();
+    if (done || all)
+      {
+      this->Threader->TerminateThread(h->ThreadID);
+      delete h;
+      it = this->Helpers.erase(it);
+      }
+    else
+      {
+      ++ it;
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::Reap()
+{
+  // Called by the poller with 'EntryLock' held.
+  std::vector<Entry *>::iterator it = this->Entries.begin();
+  while (it != this->Entries.end())
+    {
+    Entry * e = *it;
+    if (e->cancelled && !e->busy)
+      {
+      if (e->deferred == Session::DEFER_MEMORY)
+        {
+        this->MemoryWaiters --;
+        }
+      e->session->FinishProcessing();
+      delete e;
+      it = this->Entries.erase(it);
+      }
+    else
+      {
+      ++ it;
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::WakePoller()
+{
+#ifndef _WIN32
+  if (this->WakePipe[1] >= 0)
+    {
+    char c = 0;
+    ssize_t r = write(this->WakePipe[1], &c, 1);
+    (void) r;
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::WorkerThreadFunction(void * ptr)
+{
+#ifndef _WIN32
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  WorkerQueue * q = static_cast<WorkerQueue *>(info->UserData);
+  WorkerPool * pool = q->Pool;
+
+  while (pool->Running)
+    {
+    Entry * e = pool->NextTask(q->Index);
+    if (!e)
+      {
+      pool->IdleLock.Lock();
+      while (pool->Pending == 0 && pool->Running)
+        {
+        pool->Idle->Wait(&(pool->IdleLock));
+        }
+      pool->IdleLock.Unlock();
+      continue;
+      }
+
+    pool->RunTask(e);
+    }
+#else
+  (void) ptr;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::HelperThreadFunction(void * ptr)
+{
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  Helper * h = static_cast<Helper *>(info->UserData);
+  WorkerPool * pool = h->Pool;
+
+  // Runs the queued tasks, stealing from all queues, until there are none.
+  while (pool->Running)
+    {
+    Entry * e = pool->NextTask(0);
+    if (!e)
+      {
+      break;
+      }
+    pool->RunTask(e);
+    }
+
+  pool->IdleLock.Lock();
+  h->Done = 1;
+  pool->IdleLock.Unlock();
+  pool->WakePoller();
+}
+
+//-----------------------------------------------------------------------------
+void WorkerPool::PollerThreadFunction(void * ptr)
+{
+#ifndef _WIN32
+  igtl::MultiThreader::ThreadInfo* info =
+    static_cast<igtl::MultiThreader::ThreadInfo*>(ptr);
+  WorkerPool * pool = static_cast<WorkerPool *>(info->UserData);
+
+  std::vector<struct pollfd> fds;
+  std::vector<Entry *> polled;
+  std::vector<Entry *> due;
+
+  while (pool->Running)
+    {
+    fds.clear();
+    polled.clear();
+    due.clear();
+    int timeout = 500;
+
+    struct pollfd wake;
+    wake.fd = pool->WakePipe[0];
+    wake.events = POLLIN;
+    wake.revents = 0;
+    fds.push_back(wake);
+
+    igtlInt64 now = igtl::Clock::Ticks();
+    int released = pool->MemoryReleased.exchange(0);
+    pool->EntryLock.Lock();
+    pool->Reap();
+    for (size_t i = 0; i < pool->Entries.size(); i ++)
+      {
+      Entry * e = pool->Entries[i];
+      if (e->deferred == Session::DEFER_MEMORY && !e->cancelled)
+        {
+        if (released)
+          {
+          e->deferred = Session::DEFER_NONE;
+          e->busy     = 1;
+          due.push_back(e);
+          pool->MemoryWaiters --;
+          }
+        }
+      else if (e->deferred == Session::DEFER_RATE && !e->cancelled)
+        {
+        if (now >= e->resumeTime)
+          {
+          e->deferred = Session::DEFER_NONE;
+          e->busy     = 1;
+          due.push_back(e);
+          }
+        else
+          {
+          // Rounded up, so that the entry is due when the poller wakes.
+          int ms = (int) ((e->resumeTime - now + 999999) / 1000000);
+          if (ms < timeout)
+            {
+            timeout = ms;
+            }
+          }
+        }
+      else if (e->armed && !e->cancelled)
+        {
+        struct pollfd pfd;
+        pfd.fd = e->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        polled.push_back(e);
+        }
+      }
+    pool->EntryLock.Unlock();
+
+    for (size_t i = 0; i < due.size(); i ++)
+      {
+      pool->Submit(due[i]);
+      }
+
+    // Entries in 'polled' are only deleted by this thread (Reap()).
+    int stall = pool->CheckStall();
+    if (stall >= 0 && stall < timeout)
+      {
+      timeout = stall;
+      }
+    int r = poll(&fds[0], (nfds_t) fds.size(), timeout);
+    if (r <= 0)
+      {
+      continue;
+      }
+
+    if (fds[0].revents)
+      {
+      char buf[64];
+      while (read(pool->WakePipe[0], buf, sizeof(buf)) > 0)
+        {
+        }
+      }
+
+    for (size_t i = 0; i < polled.size(); i ++)
+      {
+      if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+        Entry * e = polled[i];
+        bool submit = false;
+        pool->EntryLock.Lock();
+        if (e->armed && !e->cancelled)
+          {
+          e->armed = 0;
+          e->busy  = 1;
+          submit = true;
+          }
+        pool->EntryLock.Unlock();
+        if (submit)
+          {
+          pool->Submit(e);
+          }
+        }
+      }
+    }
+#else
+  (void) ptr;
+#endif
+}
+
+} // End of igtl namespace
@@ -0,0 +1,160 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+/*=========================================================================
+
+  Program:   IGTL Repeater
+  Language:  C++
+
+  Copyright (c) Junichi Tokuda. All rights reserved.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "igtlWin32Header.h"
+#include "igtlObject.h"
+#include "igtlMultiThreader.h"
+#include "igtlMutexLock.h"
+#include "igtlConditionVariable.h"
+
+namespace igtl
+{
+
+class Session;
+
+// WorkerPool drives sessions with a fixed number of worker threads instead
+// of a thread per session. A poller thread waits until the 'from' socket of
+// a session is readable and queues the session as a task; a worker then
+// processes one message with Session::ProcessNext(). Each worker has its
+// own queue and steals from the others when it runs out of tasks.
+//
+// A session is either waiting in the poller or queued/running on a worker,
+// never both, so that the messages in each direction stay in order.
+//
+// A worker receives and sends a whole message with blocking calls, so a
+// slow sender or a full 'to' side holds it. When tasks are queued but no
+// worker has taken one for STALL_TIME, the poller starts a helper thread
+// that runs the queued tasks and exits when there are none left. Up to as
+// many helpers as workers are started, so the pool never has more than
+// twice its size in threads; a session is left waiting behind blocked
+// workers only when all of those are blocked.
+//
+// A session whose message is deferred (Session::GetDeferral()) is held by
+// the poller instead of a worker, and queued again when it is due: at its
+// resume time for a rate limit, or after memory has been released
+// (ReleaseMemory()) for a memory limit.
+class IGTLCommon_EXPORT WorkerPool : public Object
+{
+public:
+
+  igtlTypeMacro(igtl::WorkerPool, igtl::Object)
+  igtlNewMacro(igtl::WorkerPool);
+
+public:
+
+  virtual const char * GetClassName() { return "WorkerPool"; };
+
+  // Starts 'nWorkers' worker threads (0: one per core) and the poller.
+  int  Start(int nWorkers);
+  void Stop();
+
+  int  GetNumberOfWorkers() { return (int) this->Workers.size(); };
+
+  // Adds a session reading from descriptor 'fd'.
+  int  AddSession(igtl::Session * session, int fd);
+
+  // Removes a session. If the session is being processed, it is dropped
+  // by the worker once the current message is done.
+  void RemoveSession(igtl::Session * session);
+
+  // Queues the sessions waiting for memory again. Called whenever memory
+  // is released; returns at once if no session is waiting.
+  void ReleaseMemory();
+
+protected:
+
+  WorkerPool();
+  ~WorkerPool();
+
+  void           PrintSelf(std::ostream& os) const;
+
+  typedef struct Entry {
+    igtl::SmartPointer<igtl::Session> session;
+    int  fd;
+    int  armed;      // Waiting in the poller
+    int  busy;       // Queued or running on a worker
+    int  cancelled;
+    int  deferred;   // Session::DEFER_*; held by the poller
+    igtlInt64 resumeTime;  // ns
+  } Entry;
+
+  typedef struct {
+    WorkerPool *          Pool;
+    int                   Index;
+    igtl::SimpleMutexLock Lock;
+    std::deque<Entry *>   Tasks;
+  } WorkerQueue;
+
+  typedef struct {
+    WorkerPool *          Pool;
+    int                   ThreadID;
+    int                   Done;  // Under 'IdleLock'
+  } Helper;
+
+  void           Submit(Entry * entry);
+  Entry *        NextTask(int worker);
+  void           RunTask(Entry * e);
+  int            IsCancelled(Entry * e);
+  void           Reap();
+  void           WakePoller();
+
+  // Starts a helper if the queued tasks have not been taken for a while.
+  // Returns the time to the next check in ms (-1: nothing queued).
+  int            CheckStall();
+  void           ReapHelpers(bool all);
+
+  static void    WorkerThreadFunction(void * ptr);
+  static void    HelperThreadFunction(void * ptr);
+  static void    PollerThreadFunction(void * ptr);
+
+protected:
+
+  int                           Running;
+  igtl::MultiThreader::Pointer  Threader;
+  std::vector<int>              ThreadIDs;
+
+  std::vector<WorkerQueue *>    Workers;
+  unsigned int                  NextWorker;
+
+  // Idle workers sleep on 'Idle'; 'Pending' counts queued tasks.
+  // 'Progress' is when a task was last taken, or queued to an empty queue.
+  igtl::SimpleMutexLock         IdleLock;
+  igtl::ConditionVariable::Pointer Idle;
+  int                           Pending;
+  igtlInt64                     Progress;  // ns; Clock::Ticks()
+
+  std::vector<Helper *>         Helpers;  // Used by the poller only
+
+  // Entries and their poll state
+  igtl::SimpleMutexLock         EntryLock;
+  std::vector<Entry *>          Entries;
+  int                           WakePipe[2];
+
+  // Sessions deferred for memory, # of ReleaseMemory() calls, and whether
+  // the poller is to queue the sessions again.
+  std::atomic<int>              MemoryWaiters;
+  std::atomic<igtlUint64>       MemoryReleases;
+  std::atomic<int>              MemoryReleased;
+
+};
+
+}
+
+#endif // WORKERPOOL_H